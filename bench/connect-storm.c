@@ -0,0 +1,132 @@
+#include <http-connection.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <pthread.h>
+
+// Connects per thread in every round
+#define DEFAULT_CONNECTIONS 200
+#define DEFAULT_THREADS 64
+
+struct storm
+{
+    const char *host;
+    const char *service;
+    size_t connections;
+    size_t failed;
+};
+
+static void *
+storm_worker(void *data)
+{
+    struct storm *storm;
+    storm = data;
+    for (size_t index = 0; index < storm->connections; ++index) {
+        struct httpio *link;
+        link = httpio_connect(storm->host, storm->service);
+        if (link == NULL)
+            storm->failed += 1;
+        httpio_disconnect(link);
+    }
+    return NULL;
+}
+
+static void *
+storm_acceptor(void *data)
+{
+    int server;
+    server = *(int *) data;
+    for (;;) {
+        int client;
+        client = accept(server, NULL, NULL);
+        if (client == -1)
+            continue;
+        close(client);
+    }
+    return NULL;
+}
+
+// Without a target, connect to a local listener that
+// accepts and closes right away
+static int
+storm_listen(char *service, size_t size)
+{
+    struct sockaddr_in address;
+    socklen_t length;
+    pthread_t thread;
+    static int server;
+
+    server = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (server == -1)
+        return -1;
+    memset(&address, 0, sizeof(address));
+
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    length = sizeof(address);
+    if (bind(server, (struct sockaddr *) &address, length) == -1)
+        return -1;
+    if (listen(server, 4096) == -1)
+        return -1;
+    if (getsockname(server, (struct sockaddr *) &address, &length) == -1)
+        return -1;
+    snprintf(service, size, "%d", ntohs(address.sin_port));
+    if (pthread_create(&thread, NULL, storm_acceptor, &server) != 0)
+        return -1;
+    pthread_detach(thread);
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    struct storm storms[DEFAULT_THREADS];
+    pthread_t threads[DEFAULT_THREADS];
+    char service[16];
+    const char *host;
+    size_t connections;
+
+    connections = DEFAULT_CONNECTIONS;
+    if (argc > 2) {
+        host = argv[1];
+        snprintf(service, sizeof(service), "%s", argv[2]);
+    } else {
+        host = "localhost";
+        if (storm_listen(service, sizeof(service)) == -1) {
+            perror("listen");
+            return 1;
+        }
+    }
+    if (argc > 3)
+        connections = strtoul(argv[3], NULL, 10);
+    fprintf(stdout, "%8s %12s %12s %8s\n", "threads", "connects", "per second", "failed");
+    for (size_t count = 1; count <= DEFAULT_THREADS; count *= 2) {
+        int64_t start;
+        int64_t elapsed;
+        size_t failed;
+
+        start = httpio_monotonic_time();
+        for (size_t index = 0; index < count; ++index) {
+            storms[index].host = host;
+            storms[index].service = service;
+            storms[index].connections = connections;
+            storms[index].failed = 0;
+            pthread_create(&threads[index], NULL, storm_worker, &storms[index]);
+        }
+        failed = 0;
+        for (size_t index = 0; index < count; ++index) {
+            pthread_join(threads[index], NULL);
+            failed += storms[index].failed;
+        }
+        elapsed = httpio_monotonic_time() - start;
+        fprintf(stdout, "%8zu %12zu %12.0f %8zu\n", count, count * connections,
+                                   1.0E9 * count * connections / elapsed, failed);
+    }
+    return 0;
+}
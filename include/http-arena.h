@@ -0,0 +1,30 @@
+#ifndef __HTTP_ARENA_H__
+#define __HTTP_ARENA_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct httpio_arena httpio_arena;
+
+#define HTTPIO_ARENA_DEFAULT_SIZE 0x2000
+#define HTTPIO_ARENA_ALIGNMENT 16
+#define HTTPIO_ARENA_MAXIMUM_RETAINED 0x100000
+
+/* A bump allocator, whatever is allocated from it is released at once by
+ * resetting or freeing the arena. It's not thread safe, use one per thread */
+httpio_arena *httpio_arena_create(size_t size);
+void *httpio_arena_alloc(httpio_arena *arena, size_t size);
+char *httpio_arena_strndup(httpio_arena *arena, const char *const string, size_t length);
+/* Keeps the memory for the next round, in a single region */
+void httpio_arena_reset(httpio_arena *arena);
+void httpio_arena_free(httpio_arena *arena);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HTTP_ARENA_H__ */
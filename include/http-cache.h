@@ -0,0 +1,49 @@
+#ifndef __HTTP_CACHE_H__
+#define __HTTP_CACHE_H__
+
+#include <http-connection.h>
+#include <http-protocol.h>
+#include <http-request.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HTTPIO_CACHE_DEFAULT_SIZE 0x4000000
+#define HTTPIO_CACHE_DEFAULT_SHARDS 16
+
+typedef struct httpio_cache httpio_cache;
+
+typedef struct httpio_cache_stats
+{
+    /* Answered from the cache without asking the server */
+    uint64_t hits;
+    uint64_t misses;
+    /* Conditional requests sent for stale entries, and how many of them
+     * the server answered with 304 Not Modified */
+    uint64_t revalidations;
+    uint64_t not_modified;
+    uint64_t evictions;
+    /* Bytes held, bodies and headers */
+    uint64_t size;
+} httpio_cache_stats;
+
+/* A private cache of GET responses, bounded to `size' bytes split among
+ * `shards' least recently used lists, each with its own lock. Entries
+ * follow Cache-Control max-age, no-store and no-cache, and Vary. Stale
+ * ones are revalidated with If-None-Match or If-Modified-Since */
+httpio_cache *httpio_cache_create(size_t size, size_t shards);
+void httpio_cache_free(httpio_cache *cache);
+/* Sends `request' over `link' unless a fresh response is cached. What is
+ * returned belongs to the caller either way, a 304 for a cached entry
+ * comes back as the cached response. Requests other than GET go to the
+ * server and invalidate what is cached for their target */
+httpio_response *httpio_cache_fetch(httpio_cache *cache, struct httpio *link, const httpio_request *const request);
+void httpio_cache_get_stats(httpio_cache *cache, httpio_cache_stats *stats);
+void httpio_cache_flush(httpio_cache *cache);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HTTP_CACHE_H__ */
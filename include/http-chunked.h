@@ -0,0 +1,55 @@
+#ifndef __HTTP_CHUNKED_H__
+#define __HTTP_CHUNKED_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum httpio_chunked_state
+{
+    HttpChunkedSize,
+    HttpChunkedExtension,
+    HttpChunkedSizeLF,
+    HttpChunkedData,
+    HttpChunkedDataCR,
+    HttpChunkedDataLF,
+    HttpChunkedTrailer,
+    HttpChunkedTrailerLine,
+    HttpChunkedTrailerLF,
+    HttpChunkedDone
+};
+
+/* Where a chunked body is, it goes on from there with whatever bytes
+ * arrive next, however they are split */
+typedef struct httpio_chunked
+{
+    enum httpio_chunked_state state;
+    // The size being read, then what's left of the chunk
+    // while the state is HttpChunkedData
+    uint64_t remaining;
+    size_t digits;
+    // Bytes of the current size or trailer line
+    size_t line;
+} httpio_chunked;
+
+void httpio_chunked_start(httpio_chunked *chunked);
+/* Consumes framing bytes: size lines, extensions, line terminators and
+ * trailers. It stops at the start of chunk data, which the caller takes
+ * where it is, up to `remaining' bytes, and reports with
+ * httpio_chunked_advance(). Returns how many bytes it used, or -1 if the
+ * body is malformed */
+ssize_t httpio_chunked_parse(httpio_chunked *chunked, const uint8_t *const data, size_t length);
+void httpio_chunked_advance(httpio_chunked *chunked, size_t size);
+bool httpio_chunked_finished(const httpio_chunked *const chunked);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HTTP_CHUNKED_H__ */
@@ -5,14 +5,19 @@
 #include <stdarg.h>
 #include <stdbool.h>
 
+#include <sys/uio.h>
+
 #include <http-util.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+#define HTTPIO_CONNECT_DEFAULT_TIMEOUT 30000000000LL
+
 typedef struct httpio httpio;
 typedef struct httpio_proxy httpio_proxy;
+struct httpio_tls_context;
 /* Normal Connection Handler: advanced error handling */
 typedef int (*httpio_connection_error_handler)(struct httpio *const,int,void *);
 /* WebSocket handlers */
@@ -21,17 +26,66 @@ typedef int (*httpio_websocket_onclose_handler)(struct httpio *const,int,void *)
 
 bool httpio_has_data(struct httpio *link, int64_t nanoseconds);
 bool httpio_wants_data(struct httpio *link, int64_t nanoseconds);
+int httpio_has_data_many(struct httpio **links, size_t count, bool *ready, int64_t nanoseconds);
 struct httpio *httpio_connect(const char *const host, const char *const service);
+/* Races the resolved addresses and fails after `nanoseconds', a negative
+ * value waits as long as the kernel does. The deadline applies to
+ * every reconnect too */
+struct httpio *httpio_connect_deadline(const char *const host, const char *const service, int64_t nanoseconds);
+/* TLS handshakes, reconnects included, use `context' instead of the
+ * default one. This is how a link offers "h2" through ALPN without every
+ * other link offering it too */
+struct httpio *httpio_connect_with_context(const char *const host, const char *const service, struct httpio_tls_context *context, int64_t nanoseconds);
 void httpio_disconnect(struct httpio *link);
 ssize_t httpio_get_chunk(struct httpio *link, uint8_t *buffer, int size, int64_t nanoseconds);
 ssize_t httpio_write(struct httpio *link, const uint8_t *const data, size_t size);
+/* One sendmsg() on plain sockets, a single SSL_write() on TLS ones */
+ssize_t httpio_writev(struct httpio *link, const struct iovec *const vector, size_t count);
 ssize_t httpio_read(struct httpio *link, uint8_t *const buffer, int size, int64_t nanoseconds);
+/* Moves up to `size' received bytes to `fd', with splice() on plain TCP
+ * once nothing is buffered. Returns 0 when the peer closed it */
+ssize_t httpio_splice(struct httpio *link, int fd, size_t size, int64_t nanoseconds);
 ssize_t httpio_write_line(struct httpio *link, const char *format, ...)  __attribute__((format(printf, 2, 3)));
 ssize_t httpio_vwrite_line(struct httpio *link, const char *format, va_list args);
 ssize_t httpio_write_newline(struct httpio *link);
+/* Receive buffer: parsers look at buffered bytes and consume what they use */
+ssize_t httpio_buffer_fill(struct httpio *link, int64_t nanoseconds);
+ssize_t httpio_buffer_drain(struct httpio *link, bool *closed);
+size_t httpio_buffered(struct httpio *link);
+ssize_t httpio_peek(struct httpio *link, const uint8_t **data, size_t size, int64_t nanoseconds);
+void httpio_consume(struct httpio *link, size_t size);
+ssize_t httpio_read_until(struct httpio *link, const char *const delimiter, size_t length, const uint8_t **data, int64_t nanoseconds);
 
 const char *httpio_host(struct httpio *link);
+const char *httpio_service(struct httpio *link);
+/* The context given to httpio_connect_with_context(), NULL when the link
+ * uses the default one */
+struct httpio_tls_context *httpio_context(struct httpio *link);
+bool httpio_is_alive(struct httpio *link);
+int httpio_socket(struct httpio *link);
+/* Writes to a non blocking link never wait, what the socket doesn't take
+ * is queued and httpio_flush() sends what it can of it. It returns how
+ * many bytes are still queued, or -1. Going back to blocking mode sends
+ * them all */
+int httpio_set_nonblocking(struct httpio *link, bool enable);
+ssize_t httpio_flush(struct httpio *link);
+size_t httpio_unsent(struct httpio *link);
+int httpio_set_receive_limit(struct httpio *link, size_t limit);
 int httpio_connection_reconnect(struct httpio *link);
+/* Whether the connection sits at a message boundary and the server
+ * didn't say it closes it, reading a response updates it */
+bool httpio_is_reusable(struct httpio *link);
+void httpio_set_reusable(struct httpio *link, bool reusable);
+/* The peer closed the connection, what it sent might still be buffered */
+bool httpio_at_eof(struct httpio *link);
+size_t httpio_tls_handshake_count(struct httpio *link);
+size_t httpio_tls_resumed_count(struct httpio *link);
+/* The protocol negotiated with ALPN, "h2" for instance, or NULL */
+const char *httpio_alpn_protocol(struct httpio *link);
+/* Pipelining state, see http-pipeline.h. The link releases it with
+ * `release' when it's disconnected */
+struct httpio_pipeline *httpio_get_pipeline(struct httpio *link);
+void httpio_set_pipeline(struct httpio *link, struct httpio_pipeline *pipeline, void (*release)(struct httpio_pipeline *));
 
 void httpio_set_error_handler(struct httpio *const link, httpio_connection_error_handler handler, void *data);
 void httpio_connection_set_websocket_onclose_handler(struct httpio *const websocket, httpio_websocket_onclose_handler handler, void *data);
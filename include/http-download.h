@@ -0,0 +1,38 @@
+#ifndef __HTTP_DOWNLOAD_H__
+#define __HTTP_DOWNLOAD_H__
+
+#include <http-pool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HTTPIO_DOWNLOAD_DEFAULT_CONNECTIONS 4
+#define HTTPIO_DOWNLOAD_DEFAULT_SEGMENT_SIZE 0x800000
+/* Attempts for each segment after the first one failed */
+#define HTTPIO_DOWNLOAD_MAXIMUM_RETRIES 3
+
+typedef struct httpio_download httpio_download;
+
+/* Fetches `path' in byte ranges over several connections at once. The
+ * first range tells whether the server supports them, if it doesn't the
+ * whole object comes over that single connection */
+httpio_download *httpio_download_create(const char *const host, const char *const service, const char *const path);
+void httpio_download_free(httpio_download *download);
+int httpio_download_set_connections(httpio_download *download, size_t count);
+int httpio_download_set_segment_size(httpio_download *download, size_t size);
+/* Connections come from `pool' and go back to it, otherwise a pool that
+ * lives as long as the transfer is used */
+void httpio_download_set_pool(httpio_download *download, httpio_pool *pool);
+/* Sent with every request, "Name: value" */
+int httpio_download_add_header(httpio_download *download, const char *const header);
+/* The file is created, or truncated, and each range is written at its
+ * offset. Returns the length of the object or -1 */
+int64_t httpio_download_to(httpio_download *download, const char *const destination);
+size_t httpio_download_retries(const httpio_download *const download);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HTTP_DOWNLOAD_H__ */
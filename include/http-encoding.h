@@ -0,0 +1,40 @@
+#ifndef __HTTP_ENCODING_H__
+#define __HTTP_ENCODING_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HTTPIO_ENCODING_MAXIMUM_CODECS 16
+
+/* Streaming transforms for a content coding. Both directions take as much
+ * of `input' as they can and write up to `*length' bytes to `output', then
+ * set `*size' and `*length' to what was used and produced. They return 1
+ * once the stream ended, 0 if there is more to come and -1 on errors. A
+ * codec might implement only one of the directions */
+typedef struct httpio_codec
+{
+    const char *name;
+    void *(*decoder_create)(void);
+    int (*decode)(void *state, const uint8_t *input, size_t *size, uint8_t *output, size_t *length);
+    void (*decoder_free)(void *state);
+    void *(*encoder_create)(int level);
+    int (*encode)(void *state, const uint8_t *input, size_t *size, uint8_t *output, size_t *length, bool finish);
+    void (*encoder_free)(void *state);
+} httpio_codec;
+
+/* Codecs with a decoder are advertised in Accept-Encoding, register them
+ * before any request is made */
+int httpio_encoding_register(const httpio_codec *const codec);
+const httpio_codec *httpio_encoding_find(const char *const name, size_t length);
+const char *httpio_accept_encoding(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HTTP_ENCODING_H__ */
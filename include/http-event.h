@@ -0,0 +1,32 @@
+#ifndef __HTTP_EVENT_H__
+#define __HTTP_EVENT_H__
+
+#include <http-protocol.h>
+#include <http-websockets.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct httpio_event_loop httpio_event_loop;
+/* Called with a NULL response or frame when the connection closes,
+ * by then the link is no longer watched and can be disconnected.
+ * A whole message must fit in the link's receive buffer, see
+ * httpio_set_receive_limit(). Writes to a watched link don't wait,
+ * the loop sends what the socket didn't take once it can */
+typedef void (*httpio_event_response_handler)(struct httpio *const,httpio_response *,void *);
+typedef void (*httpio_event_frame_handler)(struct httpio *const,struct httpio_websocket_frame *,void *);
+
+httpio_event_loop *httpio_event_loop_create(void);
+void httpio_event_loop_free(httpio_event_loop *loop);
+int httpio_event_loop_add_http(httpio_event_loop *loop, struct httpio *link, httpio_event_response_handler handler, void *data);
+int httpio_event_loop_add_websocket(httpio_event_loop *loop, struct httpio *link, httpio_event_frame_handler handler, void *data);
+int httpio_event_loop_remove(httpio_event_loop *loop, struct httpio *link);
+int httpio_event_loop_run_once(httpio_event_loop *loop, int64_t nanoseconds);
+size_t httpio_event_loop_count(const httpio_event_loop *const loop);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HTTP_EVENT_H__ */
@@ -0,0 +1,44 @@
+#ifndef __HTTP_H2_H__
+#define __HTTP_H2_H__
+
+#include <http-connection.h>
+#include <http-protocol.h>
+#include <http-request.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* What each stream, and the connection, may receive before the server
+ * has to wait for a WINDOW_UPDATE. A stream's window opens again as its
+ * response is read, one that is not waited for stops at a window */
+#define HTTPIO_H2_DEFAULT_WINDOW 0x100000
+/* Header blocks larger than this fail the connection */
+#define HTTPIO_H2_MAXIMUM_HEADER_BLOCK 0x100000
+
+typedef struct httpio_h2 httpio_h2;
+
+/* HTTP/2 over a link that negotiated "h2", see httpio_alpn_protocol(),
+ * httpio_tls_context_set_alpn() and httpio_connect_with_context(). The
+ * link still belongs to the caller and must not be used for anything
+ * else until the session is freed */
+httpio_h2 *httpio_h2_create(struct httpio *link);
+void httpio_h2_free(httpio_h2 *session);
+/* Opens a stream for the request and returns its identifier, or -1. The
+ * request is copied, body included. When the server allows no more open
+ * streams it waits until one of them is complete, unless it allows none
+ * at all */
+int32_t httpio_h2_submit(httpio_h2 *session, const httpio_request *const request);
+/* Responses can be read in any order, frames for other streams are kept
+ * until their turn. The status line of a response reads "HTTP/2 200" */
+httpio_response *httpio_h2_read_response(httpio_h2 *session, int32_t stream);
+/* Whichever response is complete first, `*stream' tells which one it is.
+ * NULL means that stream failed, or there's none left if it's -1 */
+httpio_response *httpio_h2_read_next(httpio_h2 *session, int32_t *stream);
+size_t httpio_h2_pending(httpio_h2 *session);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HTTP_H2_H__ */
@@ -0,0 +1,53 @@
+#ifndef __HTTP_HPACK_H__
+#define __HTTP_HPACK_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include <http-util.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HTTPIO_HPACK_DEFAULT_TABLE_SIZE 4096
+
+struct httpio_hpack_field;
+
+/* One direction of a connection, the dynamic table a peer's encoder and
+ * our decoder keep in sync, or the other way around */
+typedef struct httpio_hpack
+{
+    // Newest entry first, a ring
+    struct httpio_hpack_field **entries;
+    size_t capacity;
+    size_t first;
+    size_t count;
+    // Sizes as RFC 7541 counts them
+    size_t size;
+    size_t maximum;
+    // The largest `maximum' settings allow
+    size_t limit;
+    // The encoder owes the decoder a size update
+    bool update;
+} httpio_hpack;
+
+/* Called for each decoded field, the strings are not terminated and
+ * only valid during the call. A non zero return value stops decoding */
+typedef int (*httpio_hpack_handler)(const char *name, size_t name_length, const char *value, size_t value_length, void *data);
+
+void httpio_hpack_start(httpio_hpack *hpack, size_t limit);
+void httpio_hpack_free(httpio_hpack *hpack);
+/* The encoder follows the decoder's SETTINGS_HEADER_TABLE_SIZE */
+void httpio_hpack_set_limit(httpio_hpack *hpack, size_t limit);
+int httpio_hpack_decode(httpio_hpack *hpack, const uint8_t *const block, size_t length, httpio_hpack_handler handler, void *data);
+/* Fields go one at a time, httpio_hpack_encode_start() begins a block */
+int httpio_hpack_encode_start(httpio_hpack *hpack, httpio_bstream *stream);
+int httpio_hpack_encode(httpio_hpack *hpack, const char *const name, size_t name_length, const char *const value, size_t value_length, httpio_bstream *stream);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HTTP_HPACK_H__ */
@@ -0,0 +1,34 @@
+#ifndef __HTTP_PIPELINE_H__
+#define __HTTP_PIPELINE_H__
+
+#include <http-connection.h>
+#include <http-protocol.h>
+#include <http-request.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HTTPIO_PIPELINE_DEFAULT_DEPTH 8
+#define HTTPIO_PIPELINE_MAXIMUM_RETRIES 2
+
+/* At most `depth' requests are sent ahead of their responses, 1 turns
+ * pipelining off and 0 drops the queue. It fails while requests are
+ * still waiting for a response */
+int httpio_set_pipeline_depth(struct httpio *link, size_t depth);
+/* The request is copied and queued. Only idempotent ones are pipelined,
+ * any other waits for those before it and delays those after it until
+ * its response is read */
+int httpio_pipeline_send(struct httpio *link, const httpio_request *const request);
+/* Responses come in the order the requests were queued. When the server
+ * closes the connection the requests it didn't answer are sent again
+ * on a new one, if they are idempotent. NULL means the oldest request
+ * failed, it's removed from the queue all the same */
+httpio_response *httpio_pipeline_read_response(struct httpio *link);
+size_t httpio_pipeline_pending(struct httpio *link);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HTTP_PIPELINE_H__ */
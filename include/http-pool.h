@@ -0,0 +1,25 @@
+#ifndef __HTTP_POOL_H__
+#define __HTTP_POOL_H__
+
+#include <http-connection.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct httpio_pool httpio_pool;
+
+#define HTTPIO_POOL_DEFAULT_IDLE 8
+#define HTTPIO_POOL_DEFAULT_TIMEOUT 30000000000LL
+
+httpio_pool *httpio_pool_create(size_t maximum, int64_t timeout);
+void httpio_pool_free(httpio_pool *pool);
+struct httpio *httpio_pool_checkout(httpio_pool *pool, const char *const host, const char *const service);
+void httpio_pool_checkin(httpio_pool *pool, struct httpio *link);
+size_t httpio_pool_prune(httpio_pool *pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HTTP_POOL_H__ */
@@ -2,6 +2,8 @@
 #define __HTTP_PROTOCOL_H__
 
 #include <http-connection.h>
+#include <http-arena.h>
+#include <http-sink.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -11,6 +13,8 @@ typedef struct httpio_response httpio_response;
 typedef struct httpio_header_list httpio_header_list;
 typedef struct httpio_header httpio_header;
 typedef struct httpio_body httpio_body;
+/* Receives body bytes as they arrive, a non zero return value stops it */
+typedef int (*httpio_body_handler)(const uint8_t *const,size_t,void *);
 
 enum httpio_code
 {
@@ -24,8 +28,43 @@ enum httpio_code
     HTTP_INVALID_CODE = -1
 };
 
+/* Interim 1xx responses are skipped, and a body without a length is read
+ * until the server closes the connection. httpio_is_reusable() tells
+ * whether another request can follow on the link afterwards */
 httpio_response *httpio_read_response(httpio *link);
+/* The same but NULL when it can't be read completely, `method' is that
+ * of the request since responses to HEAD have no body */
+httpio_response *httpio_read_response_to(httpio *link, const char *const method);
+/* The response is allocated from `arena', and so is the body when `body' is
+ * true. httpio_response_free() releases only what lives outside of it, call
+ * it before the arena is reset */
+httpio_response *httpio_read_response_arena(httpio *link, httpio_arena *arena, bool body);
+/* For responses that didn't come as HTTP/1 text. `head' is a status
+ * line and headers as they would be, ending with an empty line, and the
+ * body is taken over, decoded if it has a Content-Encoding */
+httpio_response *httpio_response_create(const char *const head, size_t length, uint8_t *body, size_t size);
+bool httpio_response_buffered(httpio *link);
+/* Reads the status line and the headers only, the body is then read with
+ * httpio_response_read_body() or httpio_response_stream_body() and it's
+ * decompressed on the fly. Both return 0 once the body ended, the link
+ * can't be reused before that. `method' is that of the request, there's
+ * no body to read after a HEAD */
+httpio_response *httpio_read_response_head(httpio *link, const char *const method);
+ssize_t httpio_response_read_body(httpio_response *response, httpio *link, uint8_t *const buffer, size_t size);
+int httpio_response_stream_body(httpio_response *response, httpio *link, httpio_body_handler handler, void *data);
+/* The body goes to `sink' as it arrives and the response has none, see
+ * http-sink.h. NULL when it can't be read completely, the sink keeps
+ * whatever arrived before that */
+httpio_response *httpio_read_response_sink(httpio *link, const char *const method, httpio_sink *sink);
 const char *httpio_header_list_get(const httpio_header_list *list, const char *const key);
+/* Values are views into the header block, valid until the response is freed */
+const char *httpio_header_list_find(const httpio_header_list *list, const char *const key, size_t length, size_t *size);
+/* Every value of a repeated header in the order they arrived, start with
+ * `*position' set to 0 and call it until it returns NULL */
+const char *httpio_header_list_get_next(const httpio_header_list *list, const char *const key, size_t *position);
+size_t httpio_header_list_count(const httpio_header_list *list);
+const char *httpio_header_list_key_at(const httpio_header_list *list, size_t index, size_t *length);
+const char *httpio_header_list_value_at(const httpio_header_list *list, size_t index, size_t *length);
 void httpio_response_free(httpio_response *response);
 const httpio_header_list *httpio_response_get_headers(httpio_response *response);
 httpio_body *httpio_response_get_body(httpio_response *response);
@@ -0,0 +1,28 @@
+#ifndef __HTTP_REQUEST_H__
+#define __HTTP_REQUEST_H__
+
+#include <http-connection.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct httpio_request httpio_request;
+
+/* Accept-Encoding lists the compiled in codings unless a header for it
+ * is added explicitly */
+httpio_request *httpio_request_create(const char *const method, const char *const path);
+void httpio_request_free(httpio_request *request);
+int httpio_request_add_header(httpio_request *request, const char *format, ...) __attribute__((format(printf, 2, 3)));
+int httpio_request_vadd_header(httpio_request *request, const char *format, va_list args);
+/* The body is not copied, it must stay valid until the request is sent */
+int httpio_request_set_body(httpio_request *request, const uint8_t *const data, size_t size);
+/* The request line, headers and body go out in a single write */
+ssize_t httpio_request_send(const httpio_request *const request, struct httpio *link);
+char *httpio_request_serialize(const httpio_request *const request, size_t *length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HTTP_REQUEST_H__ */
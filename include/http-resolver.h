@@ -0,0 +1,41 @@
+#ifndef __HTTP_RESOLVER_H__
+#define __HTTP_RESOLVER_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct httpio_resolver_stats
+{
+    uint64_t hits;
+    uint64_t stale_hits;
+    uint64_t negative_hits;
+    uint64_t misses;
+    uint64_t refreshes;
+} httpio_resolver_stats;
+
+#define RESOLVER_DEFAULT_TTL 60000000000LL
+#define RESOLVER_DEFAULT_STALE_TTL 300000000000LL
+#define RESOLVER_DEFAULT_NEGATIVE_TTL 5000000000LL
+
+/* Both IPv4 and IPv6 addresses are returned, alternating families */
+int httpio_resolve(const char *const host, const char *const service, struct sockaddr_storage *list, int maximum);
+/* Addresses are cached per (host, service). Past `ttl' they are still
+ * served for `stale' more nanoseconds while they're refreshed in the
+ * background, failed lookups are remembered for `negative'. A `ttl'
+ * of 0 disables the cache */
+void httpio_resolver_set_ttl(int64_t ttl, int64_t stale, int64_t negative);
+void httpio_resolver_get_stats(httpio_resolver_stats *stats);
+void httpio_resolver_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HTTP_RESOLVER_H__ */
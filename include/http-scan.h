@@ -0,0 +1,59 @@
+#ifndef __HTTP_SCAN_H__
+#define __HTTP_SCAN_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HTTPIO_SCAN_INLINE_LINES 32
+#define HTTPIO_SCAN_NONE SIZE_MAX
+
+/* Offsets from the start of the message head, `end' excludes the line
+ * terminator. The first line is the start line and has no `colon'. A
+ * `folded' line takes in obs-fold continuation lines, its value still
+ * has their line breaks */
+typedef struct httpio_scan_line
+{
+    size_t start;
+    size_t colon;
+    size_t end;
+    bool folded;
+} httpio_scan_line;
+
+typedef struct httpio_scanner
+{
+    httpio_scan_line *lines;
+    size_t count;
+    size_t capacity;
+    // Where to go on when more data arrives, and the
+    // state of the line that is not complete yet
+    size_t offset;
+    size_t start;
+    size_t colon;
+    size_t invalid;
+    httpio_scan_line inline_lines[HTTPIO_SCAN_INLINE_LINES];
+} httpio_scanner;
+
+void httpio_scanner_start(httpio_scanner *scanner);
+void httpio_scanner_free(httpio_scanner *scanner);
+/* Finds the lines of a message head and their colons in a single pass,
+ * rejecting field names that are not tokens. Lines that start with
+ * whitespace continue the previous field (RFC 7230 section 3.2.4). Returns the length of the
+ * head with the empty line that ends it, 0 if it's not complete yet, in
+ * which case it can be called again with the same data and more after
+ * it, or -1 if it's malformed */
+ssize_t httpio_scan_head(httpio_scanner *scanner, const uint8_t *const data, size_t length);
+/* Replaces the line breaks left in the value of a folded line with spaces */
+void httpio_scan_unfold(char *value, size_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HTTP_SCAN_H__ */
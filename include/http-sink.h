@@ -0,0 +1,43 @@
+#ifndef __HTTP_SINK_H__
+#define __HTTP_SINK_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include <http-connection.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct httpio_sink httpio_sink;
+
+/* Where a response body goes instead of memory the library allocates, see
+ * httpio_read_response_sink(). A sink takes a single body */
+httpio_sink *httpio_sink_buffer(uint8_t *buffer, size_t size);
+/* Appended to `fd', which still belongs to the caller. Bodies that are not
+ * encoded move from the socket with splice() on plain TCP */
+httpio_sink *httpio_sink_descriptor(int fd);
+/* Creates the file, or truncates it, and maps it with the size of the body
+ * when Content-Length tells it. Otherwise it's written like a descriptor */
+httpio_sink *httpio_sink_file(const char *const path);
+void httpio_sink_free(httpio_sink *sink);
+/* The length of the body, even beyond what a buffer could hold */
+size_t httpio_sink_length(const httpio_sink *const sink);
+/* The body didn't fit in the buffer, only its first bytes are there */
+bool httpio_sink_overflowed(const httpio_sink *const sink);
+
+/* The protocol layer drives a sink with these. Body bytes either come
+ * from a decoder through httpio_sink_write(), or the sink takes up to
+ * `size' of them from the link itself, 0 meaning the peer closed it */
+int httpio_sink_prepare(httpio_sink *sink, int64_t length);
+int httpio_sink_write(httpio_sink *sink, const uint8_t *const data, size_t size);
+ssize_t httpio_sink_receive(httpio_sink *sink, struct httpio *link, size_t size);
+int httpio_sink_finish(httpio_sink *sink);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HTTP_SINK_H__ */
@@ -6,14 +6,40 @@
 #include <stdlib.h>
 
 struct httpio_ssl;
+struct httpio_tls_context;
 
 void httpio_ssl_initialize();
 void httpio_ssl_finalize();
 
+/* One TLS context is shared by every link that uses it, configure it
+ * before handing it to httpio_tls_context_set_default() or to
+ * httpio_connect_with_context() */
+struct httpio_tls_context *httpio_tls_context_create(void);
+struct httpio_tls_context *httpio_tls_context_ref(struct httpio_tls_context *context);
+void httpio_tls_context_unref(struct httpio_tls_context *context);
+int httpio_tls_context_set_protocols(struct httpio_tls_context *context, int minimum, int maximum);
+int httpio_tls_context_set_ciphers(struct httpio_tls_context *context, const char *const list, const char *const suites);
+/* A comma separated list, most preferred first: "h2,http/1.1". Only
+ * links that can speak every protocol listed should use the context */
+int httpio_tls_context_set_alpn(struct httpio_tls_context *context, const char *const protocols);
+int httpio_tls_context_set_verify(struct httpio_tls_context *context, bool verify, const char *const file, const char *const path);
+struct httpio_tls_context *httpio_tls_context_default(void);
+void httpio_tls_context_set_default(struct httpio_tls_context *context);
+int httpio_tls_context_set_session_lifetime(struct httpio_tls_context *context, int64_t nanoseconds);
+void httpio_tls_context_flush_sessions(struct httpio_tls_context *context);
+
+struct httpio_ssl *httpio_ssl_create(struct httpio_tls_context *context, int sock, const char *const host, int port);
 struct httpio_ssl *httpio_ssl_create_with_socket(int sock);
+bool httpio_ssl_session_reused(struct httpio_ssl *ssl);
+/* NULL unless the server agreed on a protocol */
+const char *httpio_ssl_alpn_protocol(struct httpio_ssl *ssl);
 bool httpio_ssl_has_data(struct httpio_ssl *ssl, int64_t nanoseconds);
+bool httpio_ssl_has_pending(struct httpio_ssl *ssl);
 void httpio_ssl_free(struct httpio_ssl *ssl);
 
 ssize_t httpio_recvssl(struct httpio_ssl *ssl, uint8_t *const buffer, size_t size, int64_t nanoseconds);
+ssize_t httpio_recvssl_nowait(struct httpio_ssl *ssl, uint8_t *const buffer, size_t size);
+ssize_t httpio_recvssl_some(struct httpio_ssl *ssl, uint8_t *const buffer, size_t size, int64_t nanoseconds);
 ssize_t httpio_sendssl(struct httpio_ssl *ssl, const uint8_t *const buffer, size_t size);
+ssize_t httpio_sendssl_nowait(struct httpio_ssl *ssl, const uint8_t *const buffer, size_t size);
 #endif // __HTTP_SSL_H__
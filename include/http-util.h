@@ -6,6 +6,7 @@
 #include <stdbool.h>
 
 #include <sys/types.h>
+#include <poll.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -22,6 +23,7 @@ typedef struct httpio_bstream
 } httpio_bstream;
 
 #define BYTE_STREAM_DEFAULT_SIZE 0x4000
+#define BYTE_STREAM_DEFAULT_GROWTH 2.0
 
 uint8_t *httpio_base64_decode(const char *const data, size_t *length);
 char *httpio_base64_encode(const uint8_t *const data, size_t length);
@@ -29,16 +31,28 @@ char *httpio_stripdup(const char *string);
 void httpio_string_list_free(char **list);
 char **httpio_string_splitchr(const char *const string, char delimiter);
 char **bt_util_string_splitstr(const char *const string, const char *const delimiter);
+/* Capacity is multiplied by `factor' each time a stream runs out of room,
+ * it applies to every stream so set it before any is used */
+int httpio_byte_stream_set_growth(double factor);
 void httpio_byte_stream_start(struct httpio_bstream *buffer);
-void httpio_byte_stream_append(struct httpio_bstream *buffer, const uint8_t *const data, size_t size);
+/* Makes room for `capacity' bytes in total */
+int httpio_byte_stream_reserve(struct httpio_bstream *buffer, size_t capacity);
+/* Makes room for `size' more bytes, the way append does */
+int httpio_byte_stream_grow(struct httpio_bstream *buffer, size_t size);
+int httpio_byte_stream_shrink_to_fit(struct httpio_bstream *buffer);
+int httpio_byte_stream_append(struct httpio_bstream *buffer, const uint8_t *const data, size_t size);
 bool httpio_byte_stream_ends_with(const struct httpio_bstream *const buffer, const char *const tail, size_t length);
 void httpio_byte_stream_free(struct httpio_bstream *buffer);
 char *httpio_concatenate(const char *const first, ...);
 int32_t httpio_safe_random(void);
 size_t httpio_strreplace(char **string, const char *const needle, const char *const replacement);
+int64_t httpio_monotonic_time(void);
 
 bool httpio_socket_has_data(int sock, int64_t nanoseconds);
 bool httpio_socket_wants_data(int sock, int64_t nanoseconds);
+int httpio_sockets_wait(struct pollfd *fds, size_t count, int64_t nanoseconds);
+/* Every byte or -1, `fd' is usually a regular file */
+int httpio_write_descriptor(int fd, const uint8_t *data, size_t size);
 
 #define countof(list) sizeof list / sizeof *list
 #define DEFAULT_TIMEOUT 1000000000000LL
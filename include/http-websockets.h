@@ -22,6 +22,7 @@ struct httpio_websocket_frame;
 char *httpio_websocket_key_accept(const char *const source);
 char *httpio_websocket_secret();
 struct httpio_websocket_frame *httpio_websocket_get_frame(struct httpio *link);
+bool httpio_websocket_frame_buffered(struct httpio *link);
 void httpio_websocket_frame_free(struct httpio_websocket_frame *frame);
 enum httpio_websocket_frame_type httpio_websocket_frame_type(struct httpio_websocket_frame *frame);
 uint8_t *httpio_websocket_frame_data(const struct httpio_websocket_frame *const frame);
@@ -0,0 +1,145 @@
+#include <http-arena.h>
+
+#include <string.h>
+
+struct httpio_arena_region
+{
+    struct httpio_arena_region *next;
+    size_t size;
+    size_t used;
+    uint8_t data[];
+};
+
+struct httpio_arena
+{
+    // The region allocations come from, older ones follow it
+    struct httpio_arena_region *regions;
+    size_t size;
+};
+
+static struct httpio_arena_region *httpio_arena_region_create(size_t size);
+
+static struct httpio_arena_region *
+httpio_arena_region_create(size_t size)
+{
+    struct httpio_arena_region *region;
+    if (size > SIZE_MAX - sizeof(*region))
+        return NULL;
+    region = malloc(sizeof(*region) + size);
+    if (region == NULL)
+        return NULL;
+    region->next = NULL;
+    region->size = size;
+    region->used = 0;
+    return region;
+}
+
+httpio_arena *
+httpio_arena_create(size_t size)
+{
+    httpio_arena *arena;
+    arena = malloc(sizeof(*arena));
+    if (arena == NULL)
+        return NULL;
+    if (size == 0)
+        size = HTTPIO_ARENA_DEFAULT_SIZE;
+    arena->size = size;
+    arena->regions = httpio_arena_region_create(size);
+    if (arena->regions == NULL) {
+        free(arena);
+        return NULL;
+    }
+    return arena;
+}
+
+void *
+httpio_arena_alloc(httpio_arena *arena, size_t size)
+{
+    struct httpio_arena_region *region;
+    uintptr_t address;
+    size_t offset;
+
+    if (arena == NULL)
+        return NULL;
+    region = arena->regions;
+    if (region != NULL) {
+        address = (uintptr_t) (region->data + region->used);
+        offset = region->used + (-address & (HTTPIO_ARENA_ALIGNMENT - 1));
+        if ((offset <= region->size) && (size <= region->size - offset)) {
+            region->used = offset + size;
+            return region->data + offset;
+        }
+    }
+    if (size > SIZE_MAX - HTTPIO_ARENA_ALIGNMENT)
+        return NULL;
+    // Chain a new region, large allocations get one of their own size
+    region = httpio_arena_region_create((size + HTTPIO_ARENA_ALIGNMENT > arena->size) ?
+                                             size + HTTPIO_ARENA_ALIGNMENT : arena->size);
+    if (region == NULL)
+        return NULL;
+    region->next = arena->regions;
+    arena->regions = region;
+
+    address = (uintptr_t) region->data;
+    offset = -address & (HTTPIO_ARENA_ALIGNMENT - 1);
+    region->used = offset + size;
+    return region->data + offset;
+}
+
+char *
+httpio_arena_strndup(httpio_arena *arena, const char *const string, size_t length)
+{
+    char *copy;
+    if (string == NULL)
+        return NULL;
+    copy = httpio_arena_alloc(arena, length + 1);
+    if (copy == NULL)
+        return NULL;
+    memcpy(copy, string, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+void
+httpio_arena_reset(httpio_arena *arena)
+{
+    struct httpio_arena_region *region;
+    size_t total;
+
+    if ((arena == NULL) || (arena->regions == NULL))
+        return;
+    region = arena->regions;
+    if (region->next == NULL) {
+        region->used = 0;
+        return;
+    }
+    // It took a chain this time, next time a single region large
+    // enough for all of it is used unless that's too much to keep
+    total = 0;
+    while (region != NULL) {
+        struct httpio_arena_region *next;
+        next = region->next;
+        total += region->size;
+        free(region);
+        region = next;
+    }
+    if (total > HTTPIO_ARENA_MAXIMUM_RETAINED)
+        total = (arena->size > HTTPIO_ARENA_MAXIMUM_RETAINED) ? arena->size : HTTPIO_ARENA_MAXIMUM_RETAINED;
+    arena->regions = httpio_arena_region_create(total);
+}
+
+void
+httpio_arena_free(httpio_arena *arena)
+{
+    struct httpio_arena_region *region;
+    if (arena == NULL)
+        return;
+    region = arena->regions;
+    while (region != NULL) {
+        struct httpio_arena_region *next;
+        next = region->next;
+        free(region);
+        region = next;
+    }
+    free(arena);
+}
@@ -0,0 +1,968 @@
+#define _GNU_SOURCE
+#include <http-cache.h>
+#include <http-util.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#define CACHE_BUCKET_DEFAULT_COUNT 64
+
+struct httpio_cache_variant
+{
+    // A header named by Vary, lower case, and what the request that
+    // got the response sent in it or NULL if it didn't
+    char *name;
+    char *value;
+};
+
+struct httpio_cache_entry
+{
+    char *key;
+    uint32_t hash;
+    enum httpio_code code;
+    // Status line and headers without the framing ones, the body
+    // is kept decoded
+    char *head;
+    size_t length;
+    uint8_t *body;
+    size_t size;
+    char *etag;
+    char *modified;
+    struct httpio_cache_variant *variants;
+    size_t count;
+    // When it was stored or last validated, it's fresh for
+    // `lifetime' nanoseconds after that
+    int64_t stored;
+    int64_t lifetime;
+    // Cache-Control: no-cache, always validated before it's used
+    bool revalidate;
+    // Bytes charged to the shard
+    size_t charge;
+    struct httpio_cache_entry *next;
+    struct httpio_cache_entry *newer;
+    struct httpio_cache_entry *older;
+};
+
+struct httpio_cache_shard
+{
+    pthread_mutex_t mutex;
+    struct httpio_cache_entry **buckets;
+    size_t capacity;
+    size_t count;
+    // The least recently used entry is evicted first
+    struct httpio_cache_entry *newest;
+    struct httpio_cache_entry *oldest;
+    size_t size;
+    size_t limit;
+    httpio_cache_stats stats;
+};
+
+struct httpio_cache
+{
+    struct httpio_cache_shard *shards;
+    size_t count;
+};
+
+// A stored response copied out of the cache, so it can be
+// used without holding the lock
+struct httpio_cache_copy
+{
+    enum httpio_code code;
+    char *head;
+    size_t length;
+    uint8_t *body;
+    size_t size;
+    char *etag;
+    char *modified;
+};
+
+static uint32_t httpio_cache_hash(const char *const key);
+static struct httpio_cache_shard *httpio_cache_shard_of(httpio_cache *cache, uint32_t hash);
+static struct httpio_cache_entry *httpio_cache_find(struct httpio_cache_shard *shard, const char *const key, uint32_t hash);
+static void httpio_cache_unlink(struct httpio_cache_shard *shard, struct httpio_cache_entry *entry);
+static void httpio_cache_touch(struct httpio_cache_shard *shard, struct httpio_cache_entry *entry);
+static int httpio_cache_insert(struct httpio_cache_shard *shard, struct httpio_cache_entry *entry);
+static void httpio_cache_remove(httpio_cache *cache, const char *const key);
+static void httpio_cache_entry_free(struct httpio_cache_entry *entry);
+static void httpio_cache_copy_free(struct httpio_cache_copy *copy);
+static int httpio_cache_copy_entry(const struct httpio_cache_entry *const entry, struct httpio_cache_copy *copy);
+static const char *httpio_cache_request_header(const char *const head, const char *const name, size_t *length);
+static bool httpio_cache_directive(const char *value, size_t length, const char *const name, int64_t *seconds);
+static bool httpio_cache_response_directive(const httpio_header_list *list, const char *const name, int64_t *seconds);
+static bool httpio_cache_variants_match(const struct httpio_cache_entry *const entry, const char *const head);
+static int64_t httpio_cache_parse_date(const char *const value);
+static int64_t httpio_cache_lifetime(const httpio_header_list *list);
+static bool httpio_cache_stored_header(const char *const key, size_t length);
+static char *httpio_cache_serialize_head(enum httpio_code code, const httpio_header_list *list, const char *const previous, size_t size, size_t *length);
+static char *httpio_cache_conditional(const char *const request, size_t length, size_t head, const struct httpio_cache_copy *const copy, size_t *size);
+static struct httpio_cache_entry *httpio_cache_entry_create(const char *const key, const char *const head, httpio_response *response);
+static void httpio_cache_store(httpio_cache *cache, const char *const key, const char *const head, httpio_response *response);
+static void httpio_cache_refresh(httpio_cache *cache, const char *const key, const struct httpio_cache_copy *const copy, char *head, size_t length, const httpio_header_list *list);
+static httpio_response *httpio_cache_forward(struct httpio *link, const char *const data, size_t length, const char *const method);
+
+static uint32_t
+httpio_cache_hash(const char *const key)
+{
+    uint32_t hash;
+    // FNV-1a
+    hash = 2166136261u;
+    for (const char *next = key; *next != '\0'; ++next)
+        hash = (hash ^ (uint8_t) *next) * 16777619u;
+    return hash;
+}
+
+static struct httpio_cache_shard *
+httpio_cache_shard_of(httpio_cache *cache, uint32_t hash)
+{
+    // Buckets are picked with the low bits
+    return &cache->shards[(hash >> 16) % cache->count];
+}
+
+static struct httpio_cache_entry *
+httpio_cache_find(struct httpio_cache_shard *shard, const char *const key, uint32_t hash)
+{
+    struct httpio_cache_entry *entry;
+    entry = shard->buckets[hash & (shard->capacity - 1)];
+    for (; entry != NULL; entry = entry->next) {
+        if ((entry->hash == hash) && (strcmp(entry->key, key) == 0))
+            return entry;
+    }
+    return NULL;
+}
+
+static void
+httpio_cache_unlink(struct httpio_cache_shard *shard, struct httpio_cache_entry *entry)
+{
+    struct httpio_cache_entry **link;
+    link = &shard->buckets[entry->hash & (shard->capacity - 1)];
+    while ((*link != NULL) && (*link != entry))
+        link = &(*link)->next;
+    if (*link != NULL)
+        *link = entry->next;
+    if (entry->newer != NULL)
+        entry->newer->older = entry->older;
+    else
+        shard->newest = entry->older;
+    if (entry->older != NULL)
+        entry->older->newer = entry->newer;
+    else
+        shard->oldest = entry->newer;
+    shard->size -= entry->charge;
+    shard->count -= 1;
+}
+
+static void
+httpio_cache_touch(struct httpio_cache_shard *shard, struct httpio_cache_entry *entry)
+{
+    if (shard->newest == entry)
+        return;
+    entry->newer->older = entry->older;
+    if (entry->older != NULL)
+        entry->older->newer = entry->newer;
+    else
+        shard->oldest = entry->newer;
+    entry->newer = NULL;
+    entry->older = shard->newest;
+    shard->newest->newer = entry;
+    shard->newest = entry;
+}
+
+// The shard makes room for it by evicting the least recently
+// used entries, it must not have the key already
+static int
+httpio_cache_insert(struct httpio_cache_shard *shard, struct httpio_cache_entry *entry)
+{
+    size_t index;
+    if (entry->charge > shard->limit)
+        return -1;
+    while ((shard->oldest != NULL) && (shard->size + entry->charge > shard->limit)) {
+        struct httpio_cache_entry *oldest;
+        oldest = shard->oldest;
+        httpio_cache_unlink(shard, oldest);
+        httpio_cache_entry_free(oldest);
+        shard->stats.evictions += 1;
+    }
+    if (shard->count >= shard->capacity) {
+        struct httpio_cache_entry **buckets;
+        size_t capacity;
+        capacity = 2 * shard->capacity;
+        buckets = calloc(capacity, sizeof(*buckets));
+        // It works with longer chains too
+        if (buckets != NULL) {
+            for (size_t bucket = 0; bucket < shard->capacity; ++bucket) {
+                struct httpio_cache_entry *next;
+                for (struct httpio_cache_entry *item = shard->buckets[bucket]; item != NULL; item = next) {
+                    next = item->next;
+                    item->next = buckets[item->hash & (capacity - 1)];
+                    buckets[item->hash & (capacity - 1)] = item;
+                }
+            }
+            free(shard->buckets);
+            shard->buckets = buckets;
+            shard->capacity = capacity;
+        }
+    }
+    index = entry->hash & (shard->capacity - 1);
+    entry->next = shard->buckets[index];
+    shard->buckets[index] = entry;
+    entry->newer = NULL;
+    entry->older = shard->newest;
+    if (shard->newest != NULL)
+        shard->newest->newer = entry;
+    else
+        shard->oldest = entry;
+    shard->newest = entry;
+    shard->size += entry->charge;
+    shard->count += 1;
+    return 0;
+}
+
+static void
+httpio_cache_remove(httpio_cache *cache, const char *const key)
+{
+    struct httpio_cache_shard *shard;
+    struct httpio_cache_entry *entry;
+    uint32_t hash;
+
+    hash = httpio_cache_hash(key);
+    shard = httpio_cache_shard_of(cache, hash);
+    pthread_mutex_lock(&shard->mutex);
+    entry = httpio_cache_find(shard, key, hash);
+    if (entry != NULL)
+        httpio_cache_unlink(shard, entry);
+    pthread_mutex_unlock(&shard->mutex);
+    httpio_cache_entry_free(entry);
+}
+
+static void
+httpio_cache_entry_free(struct httpio_cache_entry *entry)
+{
+    if (entry == NULL)
+        return;
+    for (size_t index = 0; index < entry->count; ++index) {
+        free(entry->variants[index].name);
+        free(entry->variants[index].value);
+    }
+    free(entry->variants);
+    free(entry->key);
+    free(entry->head);
+    free(entry->body);
+    free(entry->etag);
+    free(entry->modified);
+    free(entry);
+}
+
+static void
+httpio_cache_copy_free(struct httpio_cache_copy *copy)
+{
+    free(copy->head);
+    free(copy->body);
+    free(copy->etag);
+    free(copy->modified);
+    memset(copy, 0, sizeof(*copy));
+}
+
+static int
+httpio_cache_copy_entry(const struct httpio_cache_entry *const entry, struct httpio_cache_copy *copy)
+{
+    copy->code = entry->code;
+    copy->head = strdup(entry->head);
+    copy->length = entry->length;
+    copy->body = NULL;
+    copy->size = entry->size;
+    copy->etag = NULL;
+    copy->modified = NULL;
+    if (copy->head == NULL)
+        goto error;
+    if (entry->size > 0) {
+        copy->body = malloc(entry->size);
+        if (copy->body == NULL)
+            goto error;
+        memcpy(copy->body, entry->body, entry->size);
+    }
+    if ((entry->etag != NULL) && ((copy->etag = strdup(entry->etag)) == NULL))
+        goto error;
+    if ((entry->modified != NULL) && ((copy->modified = strdup(entry->modified)) == NULL))
+        goto error;
+    return 0;
+error:
+    httpio_cache_copy_free(copy);
+    return -1;
+}
+
+// The value of the first `name' header in a serialized request head,
+// without the surrounding white space
+static const char *
+httpio_cache_request_header(const char *const head, const char *const name, size_t *length)
+{
+    const char *line;
+    size_t size;
+
+    size = strlen(name);
+    // Skip the request line
+    line = strstr(head, "\r\n");
+    while ((line != NULL) && (line[2] != '\r') && (line[2] != '\0')) {
+        const char *value;
+        const char *end;
+        line += 2;
+        end = strstr(line, "\r\n");
+        if (end == NULL)
+            return NULL;
+        if ((strncasecmp(line, name, size) == 0) && (line[size] == ':')) {
+            value = line + size + 1;
+            while ((value < end) && ((*value == ' ') || (*value == '\t')))
+                ++value;
+            while ((end > value) && ((end[-1] == ' ') || (end[-1] == '\t')))
+                --end;
+            *length = end - value;
+            return value;
+        }
+        line = end;
+    }
+    return NULL;
+}
+
+// Finds `name' among the Cache-Control directives in `value', with
+// the number of seconds it carries if any
+static bool
+httpio_cache_directive(const char *value, size_t length, const char *const name, int64_t *seconds)
+{
+    const char *end;
+    size_t size;
+
+    size = strlen(name);
+    end = value + length;
+    while (value < end) {
+        const char *token;
+        while ((value < end) && ((*value == ',') || (isspace((unsigned char) *value) != 0)))
+            ++value;
+        token = value;
+        while ((value < end) && (*value != ',') && (*value != '=') && (isspace((unsigned char) *value) == 0))
+            ++value;
+        if (((size_t) (value - token) == size) && (strncasecmp(token, name, size) == 0)) {
+            if (seconds == NULL)
+                return true;
+            *seconds = -1;
+            if ((value < end) && (*value == '=')) {
+                int64_t number;
+                ++value;
+                if ((value < end) && (*value == '"'))
+                    ++value;
+                number = 0;
+                if ((value < end) && (isdigit((unsigned char) *value) != 0)) {
+                    for (; (value < end) && (isdigit((unsigned char) *value) != 0); ++value) {
+                        // RFC 7234 caps large values at 2^31
+                        if (number < 0x80000000LL)
+                            number = 10 * number + (*value - '0');
+                    }
+                    *seconds = number;
+                }
+            }
+            return true;
+        }
+        // Skip the argument, quoted strings might have commas
+        if ((value < end) && (*value == '=')) {
+            ++value;
+            if ((value < end) && (*value == '"')) {
+                for (++value; (value < end) && (*value != '"'); ++value) {
+                    if ((*value == '\\') && (value + 1 < end))
+                        ++value;
+                }
+            }
+            while ((value < end) && (*value != ','))
+                ++value;
+        }
+    }
+    return false;
+}
+
+static bool
+httpio_cache_response_directive(const httpio_header_list *list, const char *const name, int64_t *seconds)
+{
+    const char *value;
+    size_t position;
+
+    position = 0;
+    while ((value = httpio_header_list_get_next(list, "cache-control", &position)) != NULL) {
+        if (httpio_cache_directive(value, strlen(value), name, seconds) == true)
+            return true;
+    }
+    return false;
+}
+
+static bool
+httpio_cache_variants_match(const struct httpio_cache_entry *const entry, const char *const head)
+{
+    for (size_t index = 0; index < entry->count; ++index) {
+        const struct httpio_cache_variant *variant;
+        const char *value;
+        size_t length;
+        variant = &entry->variants[index];
+        value = httpio_cache_request_header(head, variant->name, &length);
+        if ((value == NULL) != (variant->value == NULL))
+            return false;
+        if (value == NULL)
+            continue;
+        if ((strlen(variant->value) != length) || (memcmp(variant->value, value, length) != 0))
+            return false;
+    }
+    return true;
+}
+
+// An IMF-fixdate in seconds since the epoch, or -1
+static int64_t
+httpio_cache_parse_date(const char *const value)
+{
+    struct tm tm;
+    const char *end;
+    if (value == NULL)
+        return -1;
+    memset(&tm, 0, sizeof(tm));
+    end = strptime(value, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (end == NULL)
+        return -1;
+    return timegm(&tm);
+}
+
+// How long a response stays fresh from now in nanoseconds, 0 when it
+// must be validated, RFC 7234 section 4.2.1 but without heuristics
+static int64_t
+httpio_cache_lifetime(const httpio_header_list *list)
+{
+    const char *value;
+    int64_t lifetime;
+    int64_t expires;
+    int64_t seconds;
+    int64_t date;
+
+    lifetime = 0;
+    if ((httpio_cache_response_directive(list, "max-age", &seconds) == true) && (seconds >= 0)) {
+        lifetime = seconds;
+    } else if ((value = httpio_header_list_get(list, "expires")) != NULL) {
+        // An invalid date means it already expired
+        expires = httpio_cache_parse_date(value);
+        date = httpio_cache_parse_date(httpio_header_list_get(list, "date"));
+        if (date == -1)
+            date = time(NULL);
+        if (expires > date)
+            lifetime = expires - date;
+    }
+    value = httpio_header_list_get(list, "age");
+    if (value != NULL) {
+        seconds = strtoll(value, NULL, 10);
+        if (seconds > 0)
+            lifetime -= seconds;
+    }
+    if (lifetime <= 0)
+        return 0;
+    return lifetime * 1000000000LL;
+}
+
+// The body is stored decoded and served from memory, so the
+// headers about how it came over the wire are dropped
+static bool
+httpio_cache_stored_header(const char *const key, size_t length)
+{
+    static const char *const dropped[] = {
+        "connection", "keep-alive", "proxy-connection", "te", "trailer",
+        "transfer-encoding", "upgrade", "content-encoding", "content-length"
+    };
+    for (size_t index = 0; index < countof(dropped); ++index) {
+        if ((strlen(dropped[index]) == length) && (strncasecmp(dropped[index], key, length) == 0))
+            return false;
+    }
+    return true;
+}
+
+// The status line and the headers of `list', after those lines of a
+// `previous' head that `list' doesn't replace, and the length of the body
+static char *
+httpio_cache_serialize_head(enum httpio_code code, const httpio_header_list *list,
+                                   const char *const previous, size_t size, size_t *length)
+{
+    struct httpio_bstream stream;
+    char line[64];
+    int count;
+
+    httpio_byte_stream_start(&stream);
+    count = snprintf(line, sizeof(line), "HTTP/1.1 %d\r\n", code);
+    if (httpio_byte_stream_append(&stream, (const uint8_t *) line, count) == -1)
+        goto error;
+    if (previous != NULL) {
+        const char *next;
+        next = strstr(previous, "\r\n");
+        while ((next != NULL) && (next[2] != '\r') && (next[2] != '\0')) {
+            const char *colon;
+            const char *end;
+            next += 2;
+            end = strstr(next, "\r\n");
+            colon = memchr(next, ':', (end != NULL) ? (size_t) (end - next) : 0);
+            if ((end == NULL) || (colon == NULL))
+                break;
+            if ((httpio_cache_stored_header(next, colon - next) == true) &&
+                            (httpio_header_list_find(list, next, colon - next, NULL) == NULL)) {
+                if (httpio_byte_stream_append(&stream, (const uint8_t *) next, end - next + 2) == -1)
+                    goto error;
+            }
+            next = end;
+        }
+    }
+    for (size_t index = 0; index < httpio_header_list_count(list); ++index) {
+        const char *key;
+        const char *value;
+        size_t key_length;
+        size_t value_length;
+        key = httpio_header_list_key_at(list, index, &key_length);
+        value = httpio_header_list_value_at(list, index, &value_length);
+        if (httpio_cache_stored_header(key, key_length) == false)
+            continue;
+        if ((httpio_byte_stream_append(&stream, (const uint8_t *) key, key_length) == -1) ||
+                       (httpio_byte_stream_append(&stream, (const uint8_t *) ": ", 2) == -1) ||
+                 (httpio_byte_stream_append(&stream, (const uint8_t *) value, value_length) == -1) ||
+                             (httpio_byte_stream_append(&stream, (const uint8_t *) "\r\n", 2) == -1))
+            goto error;
+    }
+    count = snprintf(line, sizeof(line), "Content-Length: %zu\r\n\r\n", size);
+    if (httpio_byte_stream_append(&stream, (const uint8_t *) line, count + 1) == -1)
+        goto error;
+    httpio_byte_stream_shrink_to_fit(&stream);
+    *length = stream.length - 1;
+    return (char *) stream.data;
+error:
+    free(stream.data);
+    return NULL;
+}
+
+// The request with the validators of the stored response added
+// after its last header
+static char *
+httpio_cache_conditional(const char *const request, size_t length,
+                      size_t head, const struct httpio_cache_copy *const copy, size_t *size)
+{
+    char *result;
+    int count;
+
+    count = 0;
+    if (copy->etag != NULL)
+        count += strlen(copy->etag) + 17;
+    if (copy->modified != NULL)
+        count += strlen(copy->modified) + 21;
+    result = malloc(length + count + 1);
+    if (result == NULL)
+        return NULL;
+    memcpy(result, request, head);
+    *size = head;
+    if (copy->etag != NULL)
+        *size += sprintf(result + *size, "If-None-Match: %s\r\n", copy->etag);
+    if (copy->modified != NULL)
+        *size += sprintf(result + *size, "If-Modified-Since: %s\r\n", copy->modified);
+    memcpy(result + *size, request + head, length - head + 1);
+    *size += length - head;
+    return result;
+}
+
+static struct httpio_cache_entry *
+httpio_cache_entry_create(const char *const key, const char *const head, httpio_response *response)
+{
+    const httpio_header_list *list;
+    struct httpio_cache_entry *entry;
+    httpio_body *body;
+    const char *value;
+    size_t position;
+
+    list = httpio_response_get_headers(response);
+    body = httpio_response_get_body(response);
+    entry = calloc(1, sizeof(*entry));
+    if (entry == NULL)
+        return NULL;
+    entry->key = strdup(key);
+    if (entry->key == NULL)
+        goto error;
+    entry->hash = httpio_cache_hash(key);
+    entry->code = httpio_response_get_code(response);
+    entry->size = httpio_response_body_length(body);
+    if (entry->size > 0) {
+        entry->body = malloc(entry->size);
+        if (entry->body == NULL)
+            goto error;
+        memcpy(entry->body, httpio_response_body_get_data(body), entry->size);
+    }
+    entry->head = httpio_cache_serialize_head(entry->code, list, NULL, entry->size, &entry->length);
+    if (entry->head == NULL)
+        goto error;
+    // Weak tags are fine for If-None-Match
+    if (((value = httpio_header_list_get(list, "etag")) != NULL) && ((entry->etag = strdup(value)) == NULL))
+        goto error;
+    if (((value = httpio_header_list_get(list, "last-modified")) != NULL) && ((entry->modified = strdup(value)) == NULL))
+        goto error;
+    entry->charge = sizeof(*entry) + strlen(entry->key) + entry->length + entry->size;
+    position = 0;
+    while ((value = httpio_header_list_get_next(list, "vary", &position)) != NULL) {
+        while (*value != '\0') {
+            struct httpio_cache_variant *variant;
+            const char *found;
+            size_t length;
+            size_t size;
+            void *pointer;
+            while ((*value == ',') || (isspace((unsigned char) *value) != 0))
+                ++value;
+            for (length = 0; (value[length] != '\0') && (value[length] != ',') &&
+                                     (isspace((unsigned char) value[length]) == 0); ++length)
+                ;
+            if (length == 0)
+                break;
+            pointer = realloc(entry->variants, (entry->count + 1) * sizeof(*entry->variants));
+            if (pointer == NULL)
+                goto error;
+            entry->variants = pointer;
+            variant = &entry->variants[entry->count++];
+            variant->value = NULL;
+            variant->name = strndup(value, length);
+            if (variant->name == NULL)
+                goto error;
+            for (char *next = variant->name; *next != '\0'; ++next)
+                *next = tolower((unsigned char) *next);
+            found = httpio_cache_request_header(head, variant->name, &size);
+            if ((found != NULL) && ((variant->value = strndup(found, size)) == NULL))
+                goto error;
+            entry->charge += sizeof(*variant) + length + ((found != NULL) ? size : 0);
+            value += length;
+        }
+    }
+    entry->stored = httpio_monotonic_time();
+    entry->lifetime = httpio_cache_lifetime(list);
+    entry->revalidate = httpio_cache_response_directive(list, "no-cache", NULL);
+    return entry;
+error:
+    httpio_cache_entry_free(entry);
+    return NULL;
+}
+
+// Replaces what is stored for `key' with `response' if it may be
+// stored, a response that may not be just removes it
+static void
+httpio_cache_store(httpio_cache *cache, const char *const key, const char *const head, httpio_response *response)
+{
+    static const enum httpio_code storable[] = {200, 203, 204, 300, 301, 404, 410};
+    struct httpio_cache_entry *existing;
+    struct httpio_cache_entry *entry;
+    struct httpio_cache_shard *shard;
+    const httpio_header_list *list;
+    enum httpio_code code;
+    const char *value;
+    size_t position;
+    bool allowed;
+
+    code = httpio_response_get_code(response);
+    // The stored response might still be good
+    if (code >= 500)
+        return;
+    list = httpio_response_get_headers(response);
+    allowed = false;
+    for (size_t index = 0; index < countof(storable); ++index)
+        allowed = (allowed == true) || (storable[index] == code);
+    if (httpio_cache_response_directive(list, "no-store", NULL) == true)
+        allowed = false;
+    // Vary: * can't match any other request
+    position = 0;
+    while ((value = httpio_header_list_get_next(list, "vary", &position)) != NULL) {
+        if (strchr(value, '*') != NULL)
+            allowed = false;
+    }
+    entry = NULL;
+    if (allowed == true)
+        entry = httpio_cache_entry_create(key, head, response);
+    // Useless without freshness or a way to validate it
+    if ((entry != NULL) && (entry->lifetime == 0) && (entry->etag == NULL) && (entry->modified == NULL)) {
+        httpio_cache_entry_free(entry);
+        entry = NULL;
+    }
+    shard = httpio_cache_shard_of(cache, httpio_cache_hash(key));
+    pthread_mutex_lock(&shard->mutex);
+    existing = httpio_cache_find(shard, key, httpio_cache_hash(key));
+    if (existing != NULL)
+        httpio_cache_unlink(shard, existing);
+    if ((entry != NULL) && (httpio_cache_insert(shard, entry) == 0))
+        entry = NULL;
+    pthread_mutex_unlock(&shard->mutex);
+    httpio_cache_entry_free(existing);
+    httpio_cache_entry_free(entry);
+}
+
+// A 304 updates the stored headers and starts a new freshness lifetime,
+// unless the entry was replaced while the request was in flight
+static void
+httpio_cache_refresh(httpio_cache *cache, const char *const key,
+           const struct httpio_cache_copy *const copy, char *head, size_t length, const httpio_header_list *list)
+{
+    struct httpio_cache_entry *entry;
+    struct httpio_cache_shard *shard;
+    const char *etag;
+    const char *modified;
+    uint32_t hash;
+
+    hash = httpio_cache_hash(key);
+    shard = httpio_cache_shard_of(cache, hash);
+    pthread_mutex_lock(&shard->mutex);
+    shard->stats.not_modified += 1;
+    entry = httpio_cache_find(shard, key, hash);
+    if (entry != NULL) {
+        etag = entry->etag;
+        modified = entry->modified;
+        if (((etag == NULL) != (copy->etag == NULL)) || ((etag != NULL) && (strcmp(etag, copy->etag) != 0)))
+            entry = NULL;
+        else if (((modified == NULL) != (copy->modified == NULL)) || ((modified != NULL) && (strcmp(modified, copy->modified) != 0)))
+            entry = NULL;
+    }
+    if (entry != NULL) {
+        shard->size = shard->size - entry->length + length;
+        entry->charge = entry->charge - entry->length + length;
+        free(entry->head);
+        entry->head = head;
+        entry->length = length;
+        entry->stored = httpio_monotonic_time();
+        entry->lifetime = httpio_cache_lifetime(list);
+        entry->revalidate = httpio_cache_response_directive(list, "no-cache", NULL);
+        httpio_cache_touch(shard, entry);
+        head = NULL;
+    }
+    pthread_mutex_unlock(&shard->mutex);
+    free(head);
+}
+
+static httpio_response *
+httpio_cache_forward(struct httpio *link, const char *const data, size_t length, const char *const method)
+{
+    if (httpio_write(link, (const uint8_t *) data, length) != (ssize_t) length)
+        return NULL;
+    return httpio_read_response_to(link, method);
+}
+
+httpio_cache *
+httpio_cache_create(size_t size, size_t shards)
+{
+    httpio_cache *cache;
+    if ((size == 0) || (shards == 0))
+        return NULL;
+    cache = malloc(sizeof(*cache));
+    if (cache == NULL)
+        return NULL;
+    // Freeing it goes through the shards made so far
+    cache->count = 0;
+    cache->shards = calloc(shards, sizeof(*cache->shards));
+    if (cache->shards == NULL)
+        goto error;
+    for (cache->count = 0; cache->count < shards; ++cache->count) {
+        struct httpio_cache_shard *shard;
+        shard = &cache->shards[cache->count];
+        shard->capacity = CACHE_BUCKET_DEFAULT_COUNT;
+        shard->buckets = calloc(shard->capacity, sizeof(*shard->buckets));
+        if (shard->buckets == NULL)
+            goto error;
+        if (pthread_mutex_init(&shard->mutex, NULL) != 0) {
+            free(shard->buckets);
+            goto error;
+        }
+        shard->limit = size / shards;
+    }
+    return cache;
+error:
+    httpio_cache_free(cache);
+    return NULL;
+}
+
+void
+httpio_cache_free(httpio_cache *cache)
+{
+    if (cache == NULL)
+        return;
+    httpio_cache_flush(cache);
+    for (size_t index = 0; index < cache->count; ++index) {
+        pthread_mutex_destroy(&cache->shards[index].mutex);
+        free(cache->shards[index].buckets);
+    }
+    free(cache->shards);
+    free(cache);
+}
+
+httpio_response *
+httpio_cache_fetch(httpio_cache *cache, struct httpio *link, const httpio_request *const request)
+{
+    struct httpio_cache_copy copy;
+    struct httpio_cache_entry *entry;
+    struct httpio_cache_shard *shard;
+    httpio_response *response;
+    const char *value;
+    char *conditional;
+    char *serialized;
+    char method[16];
+    size_t length;
+    size_t head;
+    size_t size;
+    char *key;
+    char *end;
+    uint32_t hash;
+
+    if ((cache == NULL) || (link == NULL) || (request == NULL))
+        return NULL;
+    memset(&copy, 0, sizeof(copy));
+    response = NULL;
+    conditional = NULL;
+    key = NULL;
+    serialized = httpio_request_serialize(request, &length);
+    if (serialized == NULL)
+        return NULL;
+    end = strstr(serialized, "\r\n\r\n");
+    if (end == NULL)
+        goto done;
+    head = end - serialized + 2;
+    size = strcspn(serialized, " ");
+    if (size >= sizeof(method))
+        goto done;
+    memcpy(method, serialized, size);
+    method[size] = '\0';
+    value = serialized + size + strspn(serialized + size, " ");
+    // Request targets are case sensitive, but not the host
+    if (asprintf(&key, "%s:%s %.*s", httpio_host(link), httpio_service(link),
+                                  (int) strcspn(value, " \r"), value) == -1) {
+        key = NULL;
+        goto done;
+    }
+    for (char *next = key; *next != ':'; ++next)
+        *next = tolower((unsigned char) *next);
+    if (strcmp(method, "GET") != 0) {
+        response = httpio_cache_forward(link, serialized, length, method);
+        // RFC 7234 section 4.4, unsafe methods invalidate the target
+        if ((response != NULL) && (httpio_response_get_code(response) < 400) && (strcmp(method, "HEAD") != 0) &&
+                      (strcmp(method, "OPTIONS") != 0) && (strcmp(method, "TRACE") != 0))
+            httpio_cache_remove(cache, key);
+        goto done;
+    }
+    // The caller's own conditional and partial requests, and those
+    // that forbid storing, don't involve the cache
+    if ((httpio_cache_request_header(serialized, "if-none-match", &size) != NULL) ||
+                    (httpio_cache_request_header(serialized, "if-modified-since", &size) != NULL) ||
+                                       (httpio_cache_request_header(serialized, "range", &size) != NULL) ||
+            (((value = httpio_cache_request_header(serialized, "cache-control", &size)) != NULL) &&
+                                       (httpio_cache_directive(value, size, "no-store", NULL) == true))) {
+        response = httpio_cache_forward(link, serialized, length, method);
+        goto done;
+    }
+    hash = httpio_cache_hash(key);
+    shard = httpio_cache_shard_of(cache, hash);
+    pthread_mutex_lock(&shard->mutex);
+    entry = httpio_cache_find(shard, key, hash);
+    if ((entry != NULL) && (httpio_cache_variants_match(entry, serialized) == false))
+        entry = NULL;
+    if (entry == NULL) {
+        shard->stats.misses += 1;
+    } else if ((entry->revalidate == false) && (httpio_monotonic_time() - entry->stored < entry->lifetime) &&
+                         (((value = httpio_cache_request_header(serialized, "cache-control", &size)) == NULL) ||
+                                                (httpio_cache_directive(value, size, "no-cache", NULL) == false))) {
+        shard->stats.hits += 1;
+        httpio_cache_touch(shard, entry);
+        httpio_cache_copy_entry(entry, &copy);
+        pthread_mutex_unlock(&shard->mutex);
+        if (copy.head != NULL) {
+            response = httpio_response_create(copy.head, copy.length, copy.body, copy.size);
+            copy.body = NULL;
+        }
+        goto done;
+    } else if ((entry->etag != NULL) || (entry->modified != NULL)) {
+        shard->stats.revalidations += 1;
+        httpio_cache_copy_entry(entry, &copy);
+    } else {
+        shard->stats.misses += 1;
+    }
+    pthread_mutex_unlock(&shard->mutex);
+    if (copy.head != NULL) {
+        conditional = httpio_cache_conditional(serialized, length, head, &copy, &size);
+        if (conditional == NULL)
+            goto done;
+        response = httpio_cache_forward(link, conditional, size, method);
+    } else {
+        response = httpio_cache_forward(link, serialized, length, method);
+    }
+    if (response == NULL)
+        goto done;
+    if ((copy.head != NULL) && (httpio_response_get_code(response) == 304)) {
+        const httpio_header_list *list;
+        httpio_response *cached;
+        char *updated;
+        list = httpio_response_get_headers(response);
+        updated = httpio_cache_serialize_head(copy.code, list, copy.head, copy.size, &size);
+        if (updated == NULL) {
+            updated = copy.head;
+            size = copy.length;
+            copy.head = NULL;
+        }
+        // The cache takes the updated head over, and another thread can
+        // replace it as soon as it's stored, the response comes first
+        cached = httpio_response_create(updated, size, copy.body, copy.size);
+        copy.body = NULL;
+        httpio_cache_refresh(cache, key, &copy, updated, size, list);
+        httpio_response_free(response);
+        response = cached;
+    } else {
+        httpio_cache_store(cache, key, serialized, response);
+    }
+done:
+    httpio_cache_copy_free(&copy);
+    free(conditional);
+    free(serialized);
+    free(key);
+    return response;
+}
+
+void
+httpio_cache_get_stats(httpio_cache *cache, httpio_cache_stats *stats)
+{
+    if (stats == NULL)
+        return;
+    memset(stats, 0, sizeof(*stats));
+    if (cache == NULL)
+        return;
+    for (size_t index = 0; index < cache->count; ++index) {
+        struct httpio_cache_shard *shard;
+        shard = &cache->shards[index];
+        pthread_mutex_lock(&shard->mutex);
+        stats->hits += shard->stats.hits;
+        stats->misses += shard->stats.misses;
+        stats->revalidations += shard->stats.revalidations;
+        stats->not_modified += shard->stats.not_modified;
+        stats->evictions += shard->stats.evictions;
+        stats->size += shard->size;
+        pthread_mutex_unlock(&shard->mutex);
+    }
+}
+
+void
+httpio_cache_flush(httpio_cache *cache)
+{
+    if (cache == NULL)
+        return;
+    for (size_t index = 0; index < cache->count; ++index) {
+        struct httpio_cache_shard *shard;
+        struct httpio_cache_entry *entry;
+        shard = &cache->shards[index];
+        pthread_mutex_lock(&shard->mutex);
+        entry = shard->newest;
+        memset(shard->buckets, 0, shard->capacity * sizeof(*shard->buckets));
+        shard->newest = NULL;
+        shard->oldest = NULL;
+        shard->size = 0;
+        shard->count = 0;
+        pthread_mutex_unlock(&shard->mutex);
+        while (entry != NULL) {
+            struct httpio_cache_entry *older;
+            older = entry->older;
+            httpio_cache_entry_free(entry);
+            entry = older;
+        }
+    }
+}
@@ -0,0 +1,177 @@
+#include <http-chunked.h>
+
+#include <string.h>
+
+// Sizes beyond 15 hex digits don't fit, and lines
+// this long are not legitimate
+#define CHUNKED_MAXIMUM_DIGITS 15
+#define CHUNKED_MAXIMUM_LINE 0x1000
+
+static int httpio_chunked_hex(uint8_t byte);
+static ssize_t httpio_chunked_skip_line(httpio_chunked *chunked, const uint8_t *const data, size_t length, enum httpio_chunked_state next);
+
+static int
+httpio_chunked_hex(uint8_t byte)
+{
+    if ((byte >= '0') && (byte <= '9'))
+        return byte - '0';
+    byte |= 0x20;
+    if ((byte >= 'a') && (byte <= 'f'))
+        return byte - 'a' + 10;
+    return -1;
+}
+
+// Up to and including the next line feed, `next' is the
+// state after it
+static ssize_t
+httpio_chunked_skip_line(httpio_chunked *chunked,
+              const uint8_t *const data, size_t length, enum httpio_chunked_state next)
+{
+    const uint8_t *newline;
+    size_t size;
+
+    newline = memchr(data, '\n', length);
+    size = (newline == NULL) ? length : (size_t) (newline - data) + 1;
+    chunked->line += size;
+    if (chunked->line > CHUNKED_MAXIMUM_LINE)
+        return -1;
+    if (newline != NULL) {
+        chunked->state = next;
+        chunked->line = 0;
+    }
+    return size;
+}
+
+void
+httpio_chunked_start(httpio_chunked *chunked)
+{
+    chunked->state = HttpChunkedSize;
+    chunked->remaining = 0;
+    chunked->digits = 0;
+    chunked->line = 0;
+}
+
+ssize_t
+httpio_chunked_parse(httpio_chunked *chunked, const uint8_t *const data, size_t length)
+{
+    size_t offset;
+
+    offset = 0;
+    while (offset < length) {
+        uint8_t byte;
+        ssize_t size;
+        int digit;
+
+        byte = data[offset];
+        switch (chunked->state) {
+        case HttpChunkedSize:
+            digit = httpio_chunked_hex(byte);
+            if (digit != -1) {
+                if (chunked->digits == CHUNKED_MAXIMUM_DIGITS)
+                    return -1;
+                chunked->remaining = (chunked->remaining << 4) | digit;
+                chunked->digits += 1;
+                offset += 1;
+                break;
+            }
+            if (chunked->digits == 0)
+                return -1;
+            if (byte == '\r')
+                chunked->state = HttpChunkedSizeLF;
+            else if ((byte == ';') || (byte == ' ') || (byte == '\t'))
+                chunked->state = HttpChunkedExtension;
+            else if (byte != '\n')
+                return -1;
+            offset += 1;
+            chunked->line = chunked->digits + 1;
+            if (byte == '\n')
+                goto size_end;
+            break;
+        case HttpChunkedExtension:
+            // Chunk extensions are ignored
+            size = httpio_chunked_skip_line(chunked, data + offset, length - offset, HttpChunkedSizeLF);
+            if (size == -1)
+                return -1;
+            offset += size;
+            if (chunked->state == HttpChunkedSizeLF)
+                goto size_end;
+            break;
+        case HttpChunkedSizeLF:
+            if (byte != '\n')
+                return -1;
+            offset += 1;
+        size_end:
+            chunked->digits = 0;
+            chunked->line = 0;
+            if (chunked->remaining > 0) {
+                chunked->state = HttpChunkedData;
+                // The data is the caller's
+                return offset;
+            }
+            chunked->state = HttpChunkedTrailer;
+            break;
+        case HttpChunkedData:
+            return offset;
+        case HttpChunkedDataCR:
+            if (byte == '\r')
+                chunked->state = HttpChunkedDataLF;
+            else if (byte == '\n')
+                chunked->state = HttpChunkedSize;
+            else
+                return -1;
+            offset += 1;
+            break;
+        case HttpChunkedDataLF:
+            if (byte != '\n')
+                return -1;
+            chunked->state = HttpChunkedSize;
+            offset += 1;
+            break;
+        case HttpChunkedTrailer:
+            // An empty line ends the trailers and the body
+            if (byte == '\r') {
+                chunked->state = HttpChunkedTrailerLF;
+                offset += 1;
+            } else if (byte == '\n') {
+                chunked->state = HttpChunkedDone;
+                return offset + 1;
+            } else {
+                chunked->state = HttpChunkedTrailerLine;
+            }
+            break;
+        case HttpChunkedTrailerLine:
+            // Trailer fields are not used
+            size = httpio_chunked_skip_line(chunked, data + offset, length - offset, HttpChunkedTrailer);
+            if (size == -1)
+                return -1;
+            offset += size;
+            break;
+        case HttpChunkedTrailerLF:
+            if (byte != '\n')
+                return -1;
+            chunked->state = HttpChunkedDone;
+            return offset + 1;
+        case HttpChunkedDone:
+            return offset;
+        }
+    }
+    return offset;
+}
+
+void
+httpio_chunked_advance(httpio_chunked *chunked, size_t size)
+{
+    if (chunked->state != HttpChunkedData)
+        return;
+    if (size > chunked->remaining)
+        size = chunked->remaining;
+    chunked->remaining -= size;
+    if (chunked->remaining == 0)
+        chunked->state = HttpChunkedDataCR;
+}
+
+bool
+httpio_chunked_finished(const httpio_chunked *const chunked)
+{
+    return (chunked->state == HttpChunkedDone);
+}
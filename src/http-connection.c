@@ -1,10 +1,17 @@
+// For `splice()'
+#define _GNU_SOURCE
 #include <http-ssl.h>
 #include <http-connection.h>
 #include <http-protocol.h>
+#include <http-resolver.h>
 
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
+
+#include <fcntl.h>
+#include <limits.h>
 
 #include <netdb.h>
 
@@ -15,7 +22,6 @@
 #include <stdio.h>
 
 #include <unistd.h>
-#include <pthread.h>
 
 #include <signal.h>
 #include <ctype.h>
@@ -27,6 +33,21 @@
 #define SOCKS5_IPv6_ADDRESS_TYPE 0x04
 
 #define httpio_read_dt(link, data, size) httpio_read(link, data, size, DEFAULT_TIMEOUT)
+// Initial size of the receive buffer, it grows when a parser
+// needs to look further ahead but never beyond the maximum
+#define RECEIVE_BUFFER_DEFAULT_SIZE 0x4000
+#define RECEIVE_BUFFER_MAXIMUM_SIZE 0x100000
+// Stagger between connection attempts, RFC 8305 recommends 250ms
+#define CONNECT_ATTEMPT_DELAY 250000000LL
+#define CONNECT_MAXIMUM_ATTEMPTS 32
+// Lines shorter than this are formatted on the stack
+#define WRITE_LINE_DEFAULT_SIZE 0x200
+#define WRITE_VECTOR_DEFAULT_COUNT 16
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+// Gathered TLS writes up to a full record are copied on the stack
+#define WRITE_COALESCE_SIZE 0x4000
 struct httpio_proxy {
     const char *host;
     short int port;
@@ -35,7 +56,7 @@ struct httpio_proxy {
 struct httpio
 {
     // The address we connected to!
-    struct sockaddr_in address;
+    struct sockaddr_storage address;
     // Socket for IO
     int socket;
     // Host to connect to
@@ -44,6 +65,9 @@ struct httpio
     char *service;
     // SSL context (it's abstracted from SSL_ctx
     struct httpio_ssl *ssl;
+    // The TLS context for this link's handshakes, or NULL for
+    // the default one
+    struct httpio_tls_context *context;
     // Error handler callback and data
     httpio_connection_error_handler error_handler;
     void *error_handler_data;
@@ -53,16 +77,36 @@ struct httpio
     // Websocket onclose handler and data
     httpio_websocket_onclose_handler websocket_onclose;
     void *websocket_on_close_data;
+    // Receive buffer, bytes in [head, tail) were read from the
+    // socket but have not been consumed by any parser yet
+    uint8_t *input;
+    size_t head;
+    size_t tail;
+    size_t capacity;
+    size_t limit;
+    // The socket is in non blocking mode, for event loops, and
+    // what it didn't take yet goes out before anything else
+    bool nonblocking;
+    httpio_bstream output;
+    // TLS handshakes done, and how many resumed a session
+    size_t handshakes;
+    size_t resumed;
+    // Connecting, reconnects included, gives up after this
+    int64_t timeout;
+    // Requests sent ahead of their responses, if pipelining
+    struct httpio_pipeline *pipeline;
+    void (*pipeline_free)(struct httpio_pipeline *);
+    // The peer closed its side, and whether the last
+    // response left the connection usable for another
+    bool eof;
+    bool reusable;
+    // Between the socket and a descriptor, see httpio_splice()
+    int pipe[2];
 };
 
-// Internal variables
-static int httpio_get_address_list(struct sockaddr_in *list, int maximum,
-                                 const char *const url, const char *service);
 // Library initialization
 static void httpio_initialize(void) __attribute__((constructor));
 static void httpio_finalize(void) __attribute__((destructor));
-// Global mutex to allow multithreading
-static pthread_mutex_t GLOBAL_MUTEX = PTHREAD_MUTEX_INITIALIZER;
 
 static void
 httpio_initialize(void)
@@ -73,45 +117,10 @@ httpio_initialize(void)
 static void
 httpio_finalize(void)
 {
+    httpio_resolver_flush();
     httpio_ssl_finalize();
 }
 
-static int
-httpio_get_address_list(struct sockaddr_in *list,
-                        int maximum, const char *const url, const char *service)
-{
-    struct addrinfo hints;
-    struct addrinfo *information;
-    struct addrinfo *next;
-    int result;
-    int index;
-
-    memset(&hints, 0, sizeof(hints));
-
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-    // This is mandatory because `getaddrinfo()' uses
-    // getenv() which is not thread safe
-    pthread_mutex_lock(&GLOBAL_MUTEX);
-    // Resolve the IP
-    result = getaddrinfo(url, service, &hints, &information);
-    // Release the mutex
-    pthread_mutex_unlock(&GLOBAL_MUTEX);
-    if (result != 0)
-        return -1;
-    index = 0;
-    for (next = information; ((next != NULL) && (index < maximum)); next = next->ai_next) {
-        struct sockaddr_in *address;
-        address = (struct sockaddr_in *) next->ai_addr;
-        if (address == NULL)
-            continue;
-        memcpy(&list[index++], address, sizeof(*address));
-    }
-    freeaddrinfo(information);
-
-    return index;
-}
-
 int
 httpio_set_keep_alive(int sock)
 {
@@ -129,56 +138,186 @@ httpio_set_keep_alive(int sock)
     return 0;
 }
 
+static in_port_t
+httpio_address_port(const struct sockaddr_storage *const address)
+{
+    if (address->ss_family == AF_INET6)
+        return ntohs(((const struct sockaddr_in6 *) address)->sin6_port);
+    return ntohs(((const struct sockaddr_in *) address)->sin_port);
+}
+
+static int
+httpio_connect_start(const struct sockaddr_storage *const address)
+{
+    socklen_t length;
+    int sock;
+    if (address->ss_family == AF_INET6)
+        length = sizeof(struct sockaddr_in6);
+    else
+        length = sizeof(struct sockaddr_in);
+    sock = socket(address->ss_family, SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_TCP);
+    if (sock == -1)
+        return -1;
+    if ((connect(sock, (const struct sockaddr *) address, length) == 0) || (errno == EINPROGRESS))
+        return sock;
+    close(sock);
+    return -1;
+}
+
+// Happy eyeballs (RFC 8305), start an attempt per address every
+// CONNECT_ATTEMPT_DELAY or as soon as the previous one failed and
+// keep the first one that completes
+static int
+httpio_connect_race(const struct sockaddr_storage *list,
+                             int count, int64_t deadline, int *winner)
+{
+    struct pollfd fds[CONNECT_MAXIMUM_ATTEMPTS];
+    int indices[CONNECT_MAXIMUM_ATTEMPTS];
+    int64_t start;
+    size_t active;
+    int next;
+    int sock;
+
+    active = 0;
+    next = 0;
+    sock = -1;
+    start = httpio_monotonic_time();
+    if (count > CONNECT_MAXIMUM_ATTEMPTS)
+        count = CONNECT_MAXIMUM_ATTEMPTS;
+    for (;;) {
+        int64_t now;
+        int64_t wait;
+
+        now = httpio_monotonic_time();
+        if (now >= deadline) {
+            errno = ETIMEDOUT;
+            break;
+        }
+        if ((next < count) && ((now >= start) || (active == 0))) {
+            int attempt;
+            attempt = httpio_connect_start(&list[next]);
+            if (attempt != -1) {
+                fds[active].fd = attempt;
+                fds[active].events = POLLOUT;
+                indices[active++] = next;
+                start = now + CONNECT_ATTEMPT_DELAY;
+            }
+            next += 1;
+            continue;
+        }
+        if (active == 0)
+            break;
+        wait = deadline - now;
+        if ((next < count) && (start - now < wait))
+            wait = start - now;
+        if ((httpio_sockets_wait(fds, active, wait) == -1) && (errno != EINTR))
+            break;
+        for (size_t index = 0; index < active;) {
+            socklen_t length;
+            int error;
+            if (fds[index].revents == 0) {
+                ++index;
+                continue;
+            }
+            error = 0;
+            length = sizeof(error);
+            if (getsockopt(fds[index].fd, SOL_SOCKET, SO_ERROR, &error, &length) == -1)
+                error = errno;
+            if (error == 0) {
+                sock = fds[index].fd;
+                *winner = indices[index];
+
+                fds[index] = fds[--active];
+                indices[index] = indices[active];
+                goto done;
+            }
+            close(fds[index].fd);
+            fds[index] = fds[--active];
+            indices[index] = indices[active];
+            // Don't wait for the delay after a failure
+            start = now;
+        }
+    }
+done:
+    for (size_t index = 0; index < active; ++index)
+        close(fds[index].fd);
+    return sock;
+}
+
 static int
 httpio_create_socket(struct httpio *const link)
 {
-    struct sockaddr_in address_list[32];
-    int count;
+    struct sockaddr_storage address_list[CONNECT_MAXIMUM_ATTEMPTS];
+    struct sockaddr_storage *address;
+    int64_t deadline;
     int address_count;
+    int winner;
+    int flags;
 
-    link->socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    link->eof = false;
+    link->reusable = true;
+    if (link->timeout < 0)
+        deadline = INT64_MAX;
+    else
+        deadline = httpio_monotonic_time() + link->timeout;
+    // Cached, reconnecting doesn't wait for the resolver
+    address_count = httpio_resolve(link->host,
+                                 link->service, address_list, countof(address_list));
+    if (address_count <= 0)
+        return -1;
+    link->socket = httpio_connect_race(address_list, address_count, deadline, &winner);
     if (link->socket == -1)
         return -1;
+    // The rest of the library expects a blocking socket
+    flags = fcntl(link->socket, F_GETFL);
+    if ((flags == -1) || (fcntl(link->socket, F_SETFL, flags & ~O_NONBLOCK) == -1))
+        goto error;
+    link->nonblocking = false;
     if (httpio_set_keep_alive(link->socket) == -1)
         goto error;
-    count = countof(address_list);
-    address_count = httpio_get_address_list(address_list,
-                                              count, link->host, link->service);
-    for (int index = 0; index < address_count; ++index) {
-        struct sockaddr_in *address;
-        socklen_t length;
-        address = &address_list[index];
-        length = sizeof(*address);
-        if (connect(link->socket, (struct sockaddr *) address, length) != 0)
-            continue;
-        memcpy(&link->address, address, sizeof(*address));
-        switch (htons(address->sin_port)) {
-            case 993:
-            case 6984:
-            case 443:
-                // Grab a lock to do this safely
-                pthread_mutex_lock(&GLOBAL_MUTEX);
-                // Make an SSL object to securely communicate
-                link->ssl = httpio_ssl_create_with_socket(link->socket);
-                // Release the lock
-                pthread_mutex_unlock(&GLOBAL_MUTEX);
-                if (link->ssl == NULL)
-                    goto error;
-                break;
-            default:
-                link->ssl = NULL;
-                break;
-        }
-        return link->socket;
+    address = &address_list[winner];
+    memcpy(&link->address, address, sizeof(*address));
+    switch (httpio_address_port(address)) {
+        case 993:
+        case 6984:
+        case 443:
+            // Make an SSL object to securely communicate, the
+            // shared context and session cache are thread safe
+            // so handshakes run concurrently
+            link->ssl = httpio_ssl_create(link->context, link->socket,
+                                        link->host, httpio_address_port(address));
+            if (link->ssl == NULL)
+                goto error;
+            link->handshakes += 1;
+            if (httpio_ssl_session_reused(link->ssl) == true)
+                link->resumed += 1;
+            break;
+        default:
+            link->ssl = NULL;
+            break;
     }
+    return link->socket;
 error:
-    if (link->socket != -1)
-        close(link->socket);
+    close(link->socket);
     return -1;
 }
 
 struct httpio *
 httpio_connect(const char *const host, const char *const service)
+{
+    return httpio_connect_deadline(host, service, HTTPIO_CONNECT_DEFAULT_TIMEOUT);
+}
+
+struct httpio *
+httpio_connect_deadline(const char *const host,
+                                 const char *const service, int64_t nanoseconds)
+{
+    return httpio_connect_with_context(host, service, NULL, nanoseconds);
+}
+
+struct httpio *
+httpio_connect_with_context(const char *const host, const char *const service,
+                            struct httpio_tls_context *context, int64_t nanoseconds)
 {
     struct httpio *link;
 
@@ -192,10 +331,29 @@ httpio_connect(const char *const host, const char *const service)
     link->websocket_onclose = NULL;
     link->websocket_onerror = NULL;
     link->error_handler = NULL;
+    link->input = NULL;
+    link->head = 0;
+    link->tail = 0;
+    link->capacity = 0;
+    link->limit = RECEIVE_BUFFER_MAXIMUM_SIZE;
+    link->nonblocking = false;
+    memset(&link->output, 0, sizeof(link->output));
+    link->handshakes = 0;
+    link->resumed = 0;
+    link->timeout = nanoseconds;
+    link->pipeline = NULL;
+    link->pipeline_free = NULL;
+    link->pipe[0] = -1;
+    link->pipe[1] = -1;
+    link->ssl = NULL;
+    link->context = NULL;
+    if (context != NULL)
+        link->context = httpio_tls_context_ref(context);
     // Create the socket and connect to it
     link->socket = httpio_create_socket(link);
     if (link->socket != -1)
         return link;
+    httpio_tls_context_unref(link->context);
     free(link->service);
     free(link->host);
     free(link);
@@ -213,7 +371,16 @@ httpio_disconnect(struct httpio *link)
         close(link->socket);
     }
     httpio_ssl_free(link->ssl);
+    httpio_tls_context_unref(link->context);
+    if (link->pipeline_free != NULL)
+        link->pipeline_free(link->pipeline);
+    if (link->pipe[0] != -1) {
+        close(link->pipe[0]);
+        close(link->pipe[1]);
+    }
 
+    httpio_byte_stream_free(&link->output);
+    free(link->input);
     free(link->service);
     free(link->host);
     free(link);
@@ -230,14 +397,75 @@ httpio_wants_data(struct httpio *link, int64_t nanoseconds)
     return true;
 }
 
+static bool
+httpio_transport_has_data(struct httpio *link, int64_t nanoseconds)
+{
+    if (link->ssl == NULL)
+        return httpio_socket_has_data(link->socket, nanoseconds);
+    return httpio_ssl_has_data(link->ssl, nanoseconds);
+}
+
 bool
 httpio_has_data(struct httpio *link, int64_t nanoseconds)
 {
     if (link == NULL)
         return false;
-    if (link->ssl == NULL)
-        return httpio_socket_has_data(link->socket, nanoseconds);
-    return httpio_ssl_has_data(link->ssl, nanoseconds);
+    // Bytes already in the receive buffer are ready right away
+    if (link->tail > link->head)
+        return true;
+    return httpio_transport_has_data(link, nanoseconds);
+}
+
+int
+httpio_has_data_many(struct httpio **links, size_t count, bool *ready, int64_t nanoseconds)
+{
+    struct pollfd stack[64];
+    struct pollfd *fds;
+    int result;
+    int found;
+
+    if ((links == NULL) || (ready == NULL))
+        return -1;
+    fds = stack;
+    if (count > countof(stack)) {
+        fds = malloc(count * sizeof(*fds));
+        if (fds == NULL)
+            return -1;
+    }
+    found = 0;
+    for (size_t index = 0; index < count; ++index) {
+        struct httpio *link;
+        link = links[index];
+        fds[index].fd = -1;
+        fds[index].events = POLLIN;
+        ready[index] = false;
+        if (link == NULL)
+            continue;
+        // Data that is already decrypted or buffered doesn't
+        // show up on the socket
+        if ((link->tail > link->head) ||
+                  ((link->ssl != NULL) && (httpio_ssl_has_pending(link->ssl) == true))) {
+            ready[index] = true;
+            found += 1;
+        } else {
+            fds[index].fd = link->socket;
+        }
+    }
+    // Just check the sockets if something is ready already
+    result = httpio_sockets_wait(fds, count, (found > 0) ? 0 : nanoseconds);
+    if (result > 0) {
+        for (size_t index = 0; index < count; ++index) {
+            if ((fds[index].revents & (POLLIN | POLLERR | POLLHUP)) == 0)
+                continue;
+            ready[index] = true;
+            found += 1;
+        }
+    }
+    if (fds != stack)
+        free(fds);
+    if ((result == -1) && (found == 0))
+        return -1;
+    return found;
 }
 
 #undef _DEBUG
@@ -260,22 +488,109 @@ httpio_dump_buffer(const uint8_t *const data, ssize_t length)
 }
 #endif
 
+// One attempt, -1 with EAGAIN when the socket is full
+static ssize_t
+httpio_send_nowait(struct httpio *link, const uint8_t *const data, size_t size)
+{
+    if (link->ssl == NULL)
+        return send(link->socket, data, size, MSG_NOSIGNAL);
+    return httpio_sendssl_nowait(link->ssl, data, size);
+}
+
+static int
+httpio_queue_vector(struct httpio *link, const struct iovec *const vector, size_t count)
+{
+    for (size_t index = 0; index < count; ++index) {
+        if (httpio_byte_stream_append(&link->output, vector[index].iov_base, vector[index].iov_len) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+// Non blocking links never wait for the socket, what it doesn't
+// take is queued until it's writable again
+static ssize_t
+httpio_write_nowait(struct httpio *link, const uint8_t *const data, size_t size)
+{
+    size_t sent;
+    // Nothing may overtake what is queued already
+    if (httpio_flush(link) == -1)
+        return -1;
+    sent = 0;
+    while ((link->output.length == 0) && (sent < size)) {
+        ssize_t result;
+        result = httpio_send_nowait(link, data + sent, size - sent);
+        if ((result == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+            errno = 0;
+            break;
+        }
+        if (result <= 0) {
+            if ((errno != 0) && (link->error_handler != NULL))
+                link->error_handler(link, errno, link->error_handler_data);
+            return -1;
+        }
+        sent += result;
+    }
+    if ((sent < size) && (httpio_byte_stream_append(&link->output, data + sent, size - sent) == -1))
+        return -1;
+    return size;
+}
+
+ssize_t
+httpio_flush(struct httpio *link)
+{
+    if (link == NULL)
+        return -1;
+    errno = 0;
+    while (link->output.length > 0) {
+        ssize_t result;
+        result = httpio_send_nowait(link, link->output.data, link->output.length);
+        if ((result == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+            errno = 0;
+            break;
+        }
+        if (result <= 0) {
+            if ((errno != 0) && (link->error_handler != NULL))
+                link->error_handler(link, errno, link->error_handler_data);
+            return -1;
+        }
+        link->output.length -= result;
+        memmove(link->output.data, link->output.data + result, link->output.length);
+    }
+    return link->output.length;
+}
+
+size_t
+httpio_unsent(struct httpio *link)
+{
+    if (link == NULL)
+        return 0;
+    return link->output.length;
+}
+
 ssize_t
 httpio_write(struct httpio *link, const uint8_t *const data, size_t size)
 {
     ssize_t result;
+    size_t sent;
     if (size == 0)
         return 0;
     errno = 0;
     if ((link == NULL) || (data == NULL))
         return -1;
-    if (httpio_wants_data(link, DEFAULT_TIMEOUT) == false)
-        return -1;
-    if (link->ssl == NULL) {
-        result = send(link->socket, data, size, MSG_NOSIGNAL);
-    } else {
-        result = httpio_sendssl(link->ssl, data, size);
-    }
+    if (link->nonblocking == true)
+        return httpio_write_nowait(link, data, size);
+    sent = 0;
+    do {
+        if (link->ssl == NULL) {
+            result = send(link->socket, data + sent, size - sent, MSG_NOSIGNAL);
+        } else {
+            result = httpio_sendssl(link->ssl, data + sent, size - sent);
+        }
+        if (result <= 0)
+            break;
+        sent += result;
+    } while (sent < size);
     // What happened?
     if (result == 0) {
         // FIXME: this is done deliberately, no reason whatsoever
@@ -286,6 +601,8 @@ httpio_write(struct httpio *link, const uint8_t *const data, size_t size)
             link->error_handler(link, errno, link->error_handler_data);
         }
     }
+    if (result > 0)
+        result = sent;
 #ifdef _DEBUG
     fprintf(stderr, "\033[34m");
     httpio_dump_buffer(data, size);
@@ -294,19 +611,17 @@ httpio_write(struct httpio *link, const uint8_t *const data, size_t size)
     return result;
 }
 
-ssize_t
-httpio_read(struct httpio *link, uint8_t *const data, int size, int64_t nanoseconds)
+static ssize_t
+httpio_receive(struct httpio *link,
+               uint8_t *const data, size_t size, int64_t nanoseconds, bool partial)
 {
     ssize_t result;
-    if (size == 0)
-        return 0;
-    errno = 0;
-    if ((link == NULL) || (data == NULL))
-        return -1;
-    if (httpio_has_data(link, nanoseconds) == false)
+    if (httpio_transport_has_data(link, nanoseconds) == false)
         return -1;
     if (link->ssl == NULL) {
         result = recv(link->socket, data, size, MSG_NOSIGNAL);
+    } else if (partial == true) {
+        result = httpio_recvssl_some(link->ssl, data, size, nanoseconds);
     } else {
         result = httpio_recvssl(link->ssl, data, size, nanoseconds);
     }
@@ -314,6 +629,7 @@ httpio_read(struct httpio *link, uint8_t *const data, int size, int64_t nanoseco
     if (result == 0) {
         // FIXME: this is done deliberately, no reason whatsoever
         //        this should be fixed ASAP.
+        link->eof = true;
         result = -1;
     } else if (errno != 0) {
         if (link->error_handler != NULL) {
@@ -321,31 +637,393 @@ httpio_read(struct httpio *link, uint8_t *const data, int size, int64_t nanoseco
         }
     }
 #ifdef _DEBUG
-    httpio_dump_buffer(data, size);
+    httpio_dump_buffer(data, result);
 #endif
     return result;
 }
 
+static int
+httpio_buffer_reserve(struct httpio *link, size_t size)
+{
+    uint8_t *input;
+    size_t capacity;
+    size_t length;
+
+    length = link->tail - link->head;
+    if (link->capacity - link->tail >= size)
+        return 0;
+    // Move the pending bytes to the front, that might be enough
+    if (link->head > 0) {
+        memmove(link->input, link->input + link->head, length);
+        link->head = 0;
+        link->tail = length;
+        if (link->capacity - link->tail >= size)
+            return 0;
+    }
+    capacity = link->capacity;
+    if (capacity == 0)
+        capacity = RECEIVE_BUFFER_DEFAULT_SIZE;
+    while (capacity - length < size)
+        capacity *= 2;
+    if ((capacity > link->limit) && (link->limit - length >= size))
+        capacity = link->limit;
+    if (capacity > link->limit)
+        return -1;
+    input = realloc(link->input, capacity);
+    if (input == NULL)
+        return -1;
+    link->input = input;
+    link->capacity = capacity;
+    return 0;
+}
+
+ssize_t
+httpio_buffer_fill(struct httpio *link, int64_t nanoseconds)
+{
+    ssize_t result;
+    errno = 0;
+    if (link == NULL)
+        return -1;
+    if (httpio_buffer_reserve(link, 1) == -1)
+        return -1;
+    result = httpio_receive(link, link->input + link->tail,
+                              link->capacity - link->tail, nanoseconds, true);
+    if (result <= 0)
+        return -1;
+    link->tail += result;
+    return result;
+}
+
+ssize_t
+httpio_buffer_drain(struct httpio *link, bool *closed)
+{
+    ssize_t total;
+    if ((link == NULL) || (closed == NULL))
+        return -1;
+    *closed = false;
+    total = 0;
+    // Edge triggered readiness is only reported again after
+    // the socket was read until it would block
+    for (;;) {
+        ssize_t result;
+        size_t size;
+        if (httpio_buffer_reserve(link, 1) == -1) {
+            errno = ENOBUFS;
+            return -1;
+        }
+        size = link->capacity - link->tail;
+        errno = 0;
+        if (link->ssl == NULL) {
+            result = recv(link->socket, link->input + link->tail, size, MSG_DONTWAIT);
+        } else {
+            result = httpio_recvssl_nowait(link->ssl, link->input + link->tail, size);
+        }
+        if (result > 0) {
+            link->tail += result;
+            total += result;
+        } else if (result == 0) {
+            link->eof = true;
+            *closed = true;
+            break;
+        } else if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+            break;
+        } else if (errno != EINTR) {
+            *closed = true;
+            if (link->error_handler != NULL)
+                link->error_handler(link, errno, link->error_handler_data);
+            break;
+        }
+    }
+    return total;
+}
+
+size_t
+httpio_buffered(struct httpio *link)
+{
+    if (link == NULL)
+        return 0;
+    return link->tail - link->head;
+}
+
+ssize_t
+httpio_peek(struct httpio *link,
+                       const uint8_t **data, size_t size, int64_t nanoseconds)
+{
+    if ((link == NULL) || (data == NULL))
+        return -1;
+    while (link->tail - link->head < size) {
+        if (httpio_buffer_reserve(link, size - (link->tail - link->head)) == -1)
+            return -1;
+        if (httpio_buffer_fill(link, nanoseconds) == -1)
+            return -1;
+    }
+    *data = link->input + link->head;
+    return link->tail - link->head;
+}
+
+void
+httpio_consume(struct httpio *link, size_t size)
+{
+    if (link == NULL)
+        return;
+    if (size > link->tail - link->head)
+        size = link->tail - link->head;
+    link->head += size;
+    // Start from the beginning again whenever the buffer drains
+    if (link->head == link->tail) {
+        link->head = 0;
+        link->tail = 0;
+    }
+}
+
+ssize_t
+httpio_read_until(struct httpio *link, const char *const delimiter,
+                       size_t length, const uint8_t **data, int64_t nanoseconds)
+{
+    size_t offset;
+    if ((link == NULL) || (delimiter == NULL) || (length == 0) || (data == NULL))
+        return -1;
+    offset = 0;
+    for (;;) {
+        const uint8_t *head;
+        const uint8_t *next;
+        size_t available;
+
+        head = link->input + link->head;
+        available = link->tail - link->head;
+        while ((available - offset >= length) &&
+              (next = memchr(head + offset, delimiter[0], available - offset - length + 1)) != NULL) {
+            if (memcmp(next, delimiter, length) == 0) {
+                *data = head;
+                return (next - head) + length;
+            }
+            offset = (next - head) + 1;
+        }
+        // Don't scan the same bytes again after the next read
+        if (available >= length)
+            offset = available - length + 1;
+        if (httpio_buffer_fill(link, nanoseconds) == -1)
+            return -1;
+    }
+}
+
+ssize_t
+httpio_read(struct httpio *link, uint8_t *const data, int size, int64_t nanoseconds)
+{
+    size_t available;
+    if (size == 0)
+        return 0;
+    errno = 0;
+    if ((link == NULL) || (data == NULL))
+        return -1;
+    available = link->tail - link->head;
+    if (available == 0) {
+        // Large reads go straight to the caller's memory, short like
+        // the buffered ones, so a close ending the body loses nothing
+        if ((size_t) size >= RECEIVE_BUFFER_DEFAULT_SIZE)
+            return httpio_receive(link, data, size, nanoseconds, true);
+        if (httpio_buffer_fill(link, nanoseconds) == -1)
+            return -1;
+        available = link->tail - link->head;
+    }
+    if (available > (size_t) size)
+        available = size;
+    memcpy(data, link->input + link->head, available);
+    httpio_consume(link, available);
+    return available;
+}
+
+// For targets splice() doesn't write to, files opened for
+// appending for instance
+static int
+httpio_pipe_copy(int pipe, int fd, size_t size)
+{
+    uint8_t buffer[0x1000];
+    while (size > 0) {
+        ssize_t result;
+        result = read(pipe, buffer, (size < sizeof(buffer)) ? size : sizeof(buffer));
+        if ((result == -1) && (errno == EINTR))
+            continue;
+        if ((result <= 0) || (httpio_write_descriptor(fd, buffer, result) == -1))
+            return -1;
+        size -= result;
+    }
+    return 0;
+}
+
+ssize_t
+httpio_splice(struct httpio *link, int fd, size_t size, int64_t nanoseconds)
+{
+    ssize_t received;
+    size_t moved;
+
+    if ((link == NULL) || (fd == -1) || (size == 0))
+        return -1;
+    errno = 0;
+    // Buffered bytes go first, and TLS records are decrypted
+    // in user space anyway
+    if ((link->tail == link->head) && (link->ssl != NULL) &&
+                                     (httpio_buffer_fill(link, nanoseconds) == -1))
+        return (link->eof == true) ? 0 : -1;
+    if (link->tail > link->head) {
+        received = link->tail - link->head;
+        if ((size_t) received > size)
+            received = size;
+        if (httpio_write_descriptor(fd, link->input + link->head, received) == -1)
+            return -1;
+        httpio_consume(link, received);
+        return received;
+    }
+    if ((link->pipe[0] == -1) && (pipe2(link->pipe, O_CLOEXEC) == -1))
+        return -1;
+    do {
+        if (httpio_transport_has_data(link, nanoseconds) == false)
+            return -1;
+        received = splice(link->socket, NULL, link->pipe[1], NULL, size, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    } while ((received == -1) && ((errno == EAGAIN) || (errno == EINTR)));
+    if (received == 0)
+        link->eof = true;
+    if (received <= 0)
+        return received;
+    for (moved = 0; moved < (size_t) received;) {
+        ssize_t result;
+        result = splice(link->pipe[0], NULL, fd, NULL, received - moved, SPLICE_F_MOVE);
+        if ((result == -1) && (errno == EINVAL) &&
+                         (httpio_pipe_copy(link->pipe[0], fd, received - moved) == 0))
+            result = received - moved;
+        if ((result == -1) && (errno == EINTR))
+            continue;
+        if (result <= 0) {
+            // Whatever is left in the pipe belongs to nobody now
+            close(link->pipe[0]);
+            close(link->pipe[1]);
+            link->pipe[0] = -1;
+            link->pipe[1] = -1;
+            return -1;
+        }
+        moved += result;
+    }
+    return received;
+}
+
+ssize_t
+httpio_writev(struct httpio *link, const struct iovec *const vector, size_t count)
+{
+    struct iovec buffer[WRITE_VECTOR_DEFAULT_COUNT];
+    struct iovec *pending;
+    struct msghdr message;
+    ssize_t result;
+    size_t total;
+    size_t sent;
+
+    if ((link == NULL) || ((vector == NULL) && (count > 0)))
+        return -1;
+    total = 0;
+    for (size_t index = 0; index < count; ++index)
+        total += vector[index].iov_len;
+    if (total == 0)
+        return 0;
+    if (link->ssl != NULL) {
+        uint8_t chunk[WRITE_COALESCE_SIZE];
+        uint8_t *data;
+        size_t offset;
+        // Coalesce it so that it goes out in as few records as possible
+        data = chunk;
+        if ((total > sizeof(chunk)) && ((data = malloc(total)) == NULL))
+            return -1;
+        offset = 0;
+        for (size_t index = 0; index < count; ++index) {
+            memcpy(data + offset, vector[index].iov_base, vector[index].iov_len);
+            offset += vector[index].iov_len;
+        }
+        result = httpio_write(link, data, total);
+        if (data != chunk)
+            free(data);
+        return result;
+    }
+    if (link->nonblocking == true) {
+        // Nothing may overtake what is queued already
+        if (httpio_flush(link) == -1)
+            return -1;
+        if (link->output.length > 0)
+            return (httpio_queue_vector(link, vector, count) == -1) ? -1 : (ssize_t) total;
+    }
+    // It's modified as partial writes advance
+    pending = buffer;
+    if ((count > countof(buffer)) && ((pending = malloc(count * sizeof(*pending))) == NULL))
+        return -1;
+    memcpy(pending, vector, count * sizeof(*pending));
+    memset(&message, 0, sizeof(message));
+
+    message.msg_iov = pending;
+    message.msg_iovlen = (count < IOV_MAX) ? count : IOV_MAX;
+    errno = 0;
+    sent = 0;
+    result = -1;
+    while (sent < total) {
+        result = sendmsg(link->socket, &message, MSG_NOSIGNAL);
+        if ((result == -1) && (link->nonblocking == true) &&
+                               ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+            errno = 0;
+            // The rest goes out once the socket is writable again
+            if (httpio_queue_vector(link, message.msg_iov, count) == 0)
+                sent = total;
+            break;
+        }
+        if (result <= 0)
+            break;
+        sent += result;
+        // Skip what was sent
+        while ((result > 0) && (count > 0)) {
+            if ((size_t) result < message.msg_iov->iov_len) {
+                message.msg_iov->iov_base = (uint8_t *) message.msg_iov->iov_base + result;
+                message.msg_iov->iov_len -= result;
+                break;
+            }
+            result -= message.msg_iov->iov_len;
+            message.msg_iov += 1;
+            count -= 1;
+        }
+        message.msg_iovlen = (count < IOV_MAX) ? count : IOV_MAX;
+    }
+    if (pending != buffer)
+        free(pending);
+    if (sent < total) {
+        if ((errno != 0) && (link->error_handler != NULL))
+            link->error_handler(link, errno, link->error_handler_data);
+        return -1;
+    }
+    return sent;
+}
+
 ssize_t
 httpio_vwrite_line(struct httpio *link, const char *format, va_list args)
 {
-    char *buffer;
+    char buffer[WRITE_LINE_DEFAULT_SIZE];
+    char *line;
     ssize_t length;
+    ssize_t result;
     va_list copy;
 
-    if (httpio_wants_data(link, DEFAULT_TIMEOUT) == false)
-        return -1;
+    // Format it with the line terminator and send both at once
     va_copy(copy, args);
-    length = vsnprintf(NULL, 0, format, copy);
+    length = vsnprintf(buffer, sizeof(buffer), format, copy);
     va_end(copy);
-    buffer = malloc(length + 1);
-    if (buffer != NULL) {
-        vsnprintf(buffer, length + 1, format, args);
-        length = httpio_write(link, (uint8_t *) buffer, length);
-        free(buffer);
+    if (length < 0)
+        return -1;
+    line = buffer;
+    if ((size_t) length + 2 >= sizeof(buffer)) {
+        line = malloc(length + 3);
+        if (line == NULL)
+            return -1;
+        vsnprintf(line, length + 1, format, args);
     }
-    httpio_write(link, (uint8_t *) "\r\n", 2);
-
+    memcpy(line + length, "\r\n", 3);
+    result = httpio_write(link, (uint8_t *) line, length + 2);
+    if (line != buffer)
+        free(line);
+    if (result == -1)
+        return -1;
     return length;
 }
 
@@ -502,12 +1180,172 @@ httpio_host(struct httpio *link)
     return link->host;
 }
 
+int
+httpio_set_nonblocking(struct httpio *link, bool enable)
+{
+    int flags;
+    if ((link == NULL) || (link->socket == -1))
+        return -1;
+    flags = fcntl(link->socket, F_GETFL);
+    if (flags == -1)
+        return -1;
+    if (enable == true)
+        flags |= O_NONBLOCK;
+    else
+        flags &= ~O_NONBLOCK;
+    if (fcntl(link->socket, F_SETFL, flags) == -1)
+        return -1;
+    link->nonblocking = enable;
+    // What was queued goes out now, the socket waits again
+    if ((enable == false) && (link->output.length > 0)) {
+        size_t size;
+        size = link->output.length;
+        link->output.length = 0;
+        if (httpio_write(link, link->output.data, size) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+int
+httpio_set_receive_limit(struct httpio *link, size_t limit)
+{
+    if ((link == NULL) || (limit < RECEIVE_BUFFER_DEFAULT_SIZE))
+        return -1;
+    link->limit = limit;
+    return 0;
+}
+
+int
+httpio_socket(struct httpio *link)
+{
+    if (link == NULL)
+        return -1;
+    return link->socket;
+}
+
+const char *
+httpio_service(struct httpio *link)
+{
+    if (link == NULL)
+        return NULL;
+    return link->service;
+}
+
+struct httpio_tls_context *
+httpio_context(struct httpio *link)
+{
+    if (link == NULL)
+        return NULL;
+    return link->context;
+}
+
+bool
+httpio_is_alive(struct httpio *link)
+{
+    uint8_t value;
+    ssize_t result;
+    if ((link == NULL) || (link->socket == -1))
+        return false;
+    // Unread bytes mean the previous response was not consumed, TLS
+    // might have decrypted some that the socket no longer shows
+    if (link->tail > link->head)
+        return false;
+    if ((link->ssl != NULL) && (httpio_ssl_has_pending(link->ssl) == true))
+        return false;
+    // An idle connection has nothing to read, if it's readable
+    // then the peer closed it or sent something unexpected
+    result = recv(link->socket, &value, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (result == -1)
+        return ((errno == EAGAIN) || (errno == EWOULDBLOCK));
+    return false;
+}
+
+size_t
+httpio_tls_handshake_count(struct httpio *link)
+{
+    if (link == NULL)
+        return 0;
+    return link->handshakes;
+}
+
+size_t
+httpio_tls_resumed_count(struct httpio *link)
+{
+    if (link == NULL)
+        return 0;
+    return link->resumed;
+}
+
 int
 httpio_connection_reconnect(struct httpio *link)
 {
     if (link == NULL)
         return -1;
-    return (httpio_create_socket(link) != -1);
+    // Close the old connection first, a clean TLS shutdown
+    // keeps its session resumable
+    if (link->socket != -1) {
+        httpio_ssl_free(link->ssl);
+        shutdown(link->socket, SHUT_RDWR);
+        close(link->socket);
+    }
+    link->ssl = NULL;
+    // Whatever was pending belongs to the old connection
+    link->head = 0;
+    link->tail = 0;
+    link->output.length = 0;
+    link->socket = httpio_create_socket(link);
+    return (link->socket != -1);
+}
+
+bool
+httpio_is_reusable(struct httpio *link)
+{
+    if ((link == NULL) || (link->eof == true))
+        return false;
+    return link->reusable;
+}
+
+void
+httpio_set_reusable(struct httpio *link, bool reusable)
+{
+    if (link == NULL)
+        return;
+    link->reusable = reusable;
+}
+
+bool
+httpio_at_eof(struct httpio *link)
+{
+    if (link == NULL)
+        return true;
+    return link->eof;
+}
+
+const char *
+httpio_alpn_protocol(struct httpio *link)
+{
+    if ((link == NULL) || (link->ssl == NULL))
+        return NULL;
+    return httpio_ssl_alpn_protocol(link->ssl);
+}
+
+struct httpio_pipeline *
+httpio_get_pipeline(struct httpio *link)
+{
+    if (link == NULL)
+        return NULL;
+    return link->pipeline;
+}
+
+void
+httpio_set_pipeline(struct httpio *link,
+         struct httpio_pipeline *pipeline, void (*release)(struct httpio_pipeline *))
+{
+    if (link == NULL)
+        return;
+    link->pipeline = pipeline;
+    link->pipeline_free = release;
 }
 
 void httpio_set_error_handler(struct httpio *const link,
@@ -0,0 +1,470 @@
+#include <http-download.h>
+#include <http-protocol.h>
+#include <http-request.h>
+
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <ctype.h>
+
+#include <pthread.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+struct httpio_download
+{
+    char *host;
+    char *service;
+    char *path;
+    // Extra headers for every request
+    char **headers;
+    size_t count;
+    size_t connections;
+    size_t segment_size;
+    // The caller's, if any
+    httpio_pool *pool;
+    size_t retries;
+};
+
+// What the workers of a transfer share, segment 0 is the
+// one that told whether ranges work at all
+struct httpio_download_job
+{
+    httpio_download *download;
+    httpio_pool *pool;
+    const char *destination;
+    // For If-Range, so a changed object is not mixed with the old one
+    const char *validator;
+    int64_t length;
+    size_t next;
+    size_t count;
+    size_t retries;
+    bool failed;
+    pthread_mutex_t mutex;
+};
+
+static httpio_response *httpio_download_fetch(httpio_download *download, struct httpio *link, int fd, int64_t start, int64_t end, const char *const validator, size_t *length);
+static int httpio_download_content_range(const httpio_response *response, int64_t *start, int64_t *end, int64_t *total);
+static httpio_response *httpio_download_refetch(httpio_download *download, httpio_pool *pool, struct httpio **link, int fd, size_t *length);
+static int httpio_download_segment(struct httpio_download_job *job, struct httpio *link, int fd, size_t index);
+static void *httpio_download_worker(void *data);
+static int64_t httpio_download_segments(httpio_download *download, httpio_pool *pool, const char *const destination, const httpio_response *probe, int64_t total);
+
+httpio_download *
+httpio_download_create(const char *const host, const char *const service, const char *const path)
+{
+    httpio_download *download;
+    if ((host == NULL) || (service == NULL) || (path == NULL))
+        return NULL;
+    download = malloc(sizeof(*download));
+    if (download == NULL)
+        return NULL;
+    download->host = strdup(host);
+    download->service = strdup(service);
+    download->path = strdup(path);
+    download->headers = NULL;
+    download->count = 0;
+    download->connections = HTTPIO_DOWNLOAD_DEFAULT_CONNECTIONS;
+    download->segment_size = HTTPIO_DOWNLOAD_DEFAULT_SEGMENT_SIZE;
+    download->pool = NULL;
+    download->retries = 0;
+    if ((download->host == NULL) || (download->service == NULL) || (download->path == NULL)) {
+        httpio_download_free(download);
+        return NULL;
+    }
+    return download;
+}
+
+void
+httpio_download_free(httpio_download *download)
+{
+    if (download == NULL)
+        return;
+    for (size_t index = 0; index < download->count; ++index)
+        free(download->headers[index]);
+    free(download->headers);
+    free(download->path);
+    free(download->service);
+    free(download->host);
+    free(download);
+}
+
+int
+httpio_download_set_connections(httpio_download *download, size_t count)
+{
+    if ((download == NULL) || (count == 0))
+        return -1;
+    download->connections = count;
+    return 0;
+}
+
+int
+httpio_download_set_segment_size(httpio_download *download, size_t size)
+{
+    if ((download == NULL) || (size == 0))
+        return -1;
+    download->segment_size = size;
+    return 0;
+}
+
+void
+httpio_download_set_pool(httpio_download *download, httpio_pool *pool)
+{
+    if (download == NULL)
+        return;
+    download->pool = pool;
+}
+
+int
+httpio_download_add_header(httpio_download *download, const char *const header)
+{
+    char **headers;
+    if ((download == NULL) || (header == NULL))
+        return -1;
+    headers = realloc(download->headers, (download->count + 1) * sizeof(*headers));
+    if (headers == NULL)
+        return -1;
+    download->headers = headers;
+    headers[download->count] = strdup(header);
+    if (headers[download->count] == NULL)
+        return -1;
+    download->count += 1;
+    return 0;
+}
+
+size_t
+httpio_download_retries(const httpio_download *const download)
+{
+    if (download == NULL)
+        return 0;
+    return download->retries;
+}
+
+// The range from `start' to `end', both included, or the whole object
+// if `end' is -1. The body goes to `fd' at `start'
+static httpio_response *
+httpio_download_fetch(httpio_download *download, struct httpio *link,
+     int fd, int64_t start, int64_t end, const char *const validator, size_t *length)
+{
+    httpio_response *response;
+    httpio_request *request;
+    httpio_sink *sink;
+    int result;
+
+    *length = 0;
+    if (lseek(fd, start, SEEK_SET) == -1)
+        return NULL;
+    request = httpio_request_create("GET", download->path);
+    if (request == NULL)
+        return NULL;
+    // The port is part of it unless it's the default one
+    if ((strcmp(download->service, "80") == 0) || (strcmp(download->service, "443") == 0) ||
+                (isdigit((unsigned char) download->service[0]) == 0))
+        result = httpio_request_add_header(request, "Host: %s", download->host);
+    else
+        result = httpio_request_add_header(request, "Host: %s:%s", download->host, download->service);
+    // Ranges of an encoded representation are useless here
+    if (result == 0)
+        result = httpio_request_add_header(request, "Accept-Encoding: identity");
+    if ((result == 0) && (end != -1))
+        result = httpio_request_add_header(request, "Range: bytes=%lld-%lld", (long long) start, (long long) end);
+    if ((result == 0) && (end != -1) && (validator != NULL))
+        result = httpio_request_add_header(request, "If-Range: %s", validator);
+    for (size_t index = 0; (result == 0) && (index < download->count); ++index)
+        result = httpio_request_add_header(request, "%s", download->headers[index]);
+    sink = httpio_sink_descriptor(fd);
+    if ((result == -1) || (sink == NULL) || (httpio_request_send(request, link) == -1)) {
+        httpio_sink_free(sink);
+        httpio_request_free(request);
+        return NULL;
+    }
+    httpio_request_free(request);
+    response = httpio_read_response_sink(link, "GET", sink);
+    *length = httpio_sink_length(sink);
+    httpio_sink_free(sink);
+    return response;
+}
+
+// The whole object over again, what the probe wrote is dropped
+// first, it might even be an error page
+static httpio_response *
+httpio_download_refetch(httpio_download *download,
+                        httpio_pool *pool, struct httpio **link, int fd, size_t *length)
+{
+    if (ftruncate(fd, 0) == -1)
+        return NULL;
+    if (httpio_is_reusable(*link) == false) {
+        httpio_disconnect(*link);
+        *link = httpio_pool_checkout(pool, download->host, download->service);
+        if (*link == NULL)
+            return NULL;
+    }
+    return httpio_download_fetch(download, *link, fd, 0, -1, NULL, length);
+}
+
+// "bytes 0-499/1234", the total is -1 when the server sent "*"
+static int
+httpio_download_content_range(const httpio_response *response,
+                                 int64_t *start, int64_t *end, int64_t *total)
+{
+    const char *value;
+    char *tail;
+
+    value = httpio_header_list_get(httpio_response_get_headers((httpio_response *) response), "content-range");
+    if ((value == NULL) || (strncasecmp(value, "bytes ", 6) != 0))
+        return -1;
+    value += 6;
+    if (isdigit((unsigned char) *value) == 0)
+        return -1;
+    *start = strtoll(value, &tail, 10);
+    if (*tail != '-')
+        return -1;
+    value = tail + 1;
+    if (isdigit((unsigned char) *value) == 0)
+        return -1;
+    *end = strtoll(value, &tail, 10);
+    if ((*tail != '/') || (*end < *start))
+        return -1;
+    value = tail + 1;
+    if (*value == '*') {
+        *total = -1;
+        return 0;
+    }
+    if (isdigit((unsigned char) *value) == 0)
+        return -1;
+    *total = strtoll(value, &tail, 10);
+    if ((*tail != '\0') || (*total <= *end))
+        return -1;
+    return 0;
+}
+
+// 0 when the segment is in place, -1 to try again. A server that
+// ignores the range now means the object changed, that's final
+static int
+httpio_download_segment(struct httpio_download_job *job, struct httpio *link, int fd, size_t index)
+{
+    httpio_response *response;
+    int64_t start;
+    int64_t end;
+    int64_t first;
+    int64_t last;
+    int64_t total;
+    size_t length;
+    int result;
+
+    start = (int64_t) index * job->download->segment_size;
+    end = start + job->download->segment_size - 1;
+    if (end >= job->length)
+        end = job->length - 1;
+    response = httpio_download_fetch(job->download, link, fd, start, end, job->validator, &length);
+    if (response == NULL)
+        return -1;
+    result = -1;
+    if (httpio_response_get_code(response) != 206) {
+        pthread_mutex_lock(&job->mutex);
+        job->failed = true;
+        pthread_mutex_unlock(&job->mutex);
+    } else if ((httpio_download_content_range(response, &first, &last, &total) == 0) &&
+                   (first == start) && (last == end) && (length == (size_t) (end - start + 1))) {
+        result = 0;
+    }
+    httpio_response_free(response);
+    return result;
+}
+
+static void *
+httpio_download_worker(void *data)
+{
+    struct httpio_download_job *job;
+    struct httpio *link;
+    int fd;
+
+    job = data;
+    link = NULL;
+    // Its own descriptor, the file offset is not shared
+    fd = open(job->destination, O_WRONLY | O_CLOEXEC);
+    if (fd == -1)
+        goto failed;
+    for (;;) {
+        size_t retries;
+        size_t index;
+
+        pthread_mutex_lock(&job->mutex);
+        if ((job->failed == true) || (job->next == job->count)) {
+            pthread_mutex_unlock(&job->mutex);
+            break;
+        }
+        index = job->next++;
+        pthread_mutex_unlock(&job->mutex);
+        for (retries = 0;; ++retries) {
+            bool stop;
+            // The server closed it after the last segment, that's
+            // not a failed attempt
+            if ((link != NULL) && (httpio_is_reusable(link) == false)) {
+                httpio_disconnect(link);
+                link = NULL;
+            }
+            if (link == NULL)
+                link = httpio_pool_checkout(job->pool, job->download->host, job->download->service);
+            if ((link != NULL) && (httpio_download_segment(job, link, fd, index) == 0))
+                break;
+            // Whatever state it was left in, a new one is used
+            httpio_disconnect(link);
+            link = NULL;
+            pthread_mutex_lock(&job->mutex);
+            stop = job->failed;
+            if ((stop == false) && (retries < HTTPIO_DOWNLOAD_MAXIMUM_RETRIES))
+                job->retries += 1;
+            pthread_mutex_unlock(&job->mutex);
+            if (stop == true)
+                break;
+            if (retries == HTTPIO_DOWNLOAD_MAXIMUM_RETRIES)
+                goto failed;
+        }
+    }
+    httpio_pool_checkin(job->pool, link);
+    close(fd);
+    return NULL;
+failed:
+    pthread_mutex_lock(&job->mutex);
+    job->failed = true;
+    pthread_mutex_unlock(&job->mutex);
+    if (fd != -1)
+        close(fd);
+    return NULL;
+}
+
+// Everything after the first segment, each worker takes the next
+// one left until there's none
+static int64_t
+httpio_download_segments(httpio_download *download, httpio_pool *pool,
+            const char *const destination, const httpio_response *probe, int64_t total)
+{
+    struct httpio_download_job job;
+    const httpio_header_list *headers;
+    pthread_t *threads;
+    const char *value;
+    size_t count;
+
+    headers = httpio_response_get_headers((httpio_response *) probe);
+    job.download = download;
+    job.pool = pool;
+    job.destination = destination;
+    // Weak validators can't be used with If-Range
+    value = httpio_header_list_get(headers, "etag");
+    if ((value != NULL) && (strncmp(value, "W/", 2) == 0))
+        value = NULL;
+    if (value == NULL)
+        value = httpio_header_list_get(headers, "last-modified");
+    job.validator = value;
+    job.length = total;
+    job.next = 1;
+    job.count = (total + download->segment_size - 1) / download->segment_size;
+    job.retries = 0;
+    job.failed = false;
+    if (pthread_mutex_init(&job.mutex, NULL) != 0)
+        return -1;
+    count = download->connections;
+    if (count > job.count - 1)
+        count = job.count - 1;
+    threads = malloc(count * sizeof(*threads));
+    if (threads == NULL) {
+        pthread_mutex_destroy(&job.mutex);
+        return -1;
+    }
+    for (size_t index = 0; index < count; ++index) {
+        if (pthread_create(&threads[index], NULL, httpio_download_worker, &job) == 0)
+            continue;
+        // Those already running do the work
+        if (index == 0)
+            job.failed = true;
+        count = index;
+        break;
+    }
+    for (size_t index = 0; index < count; ++index)
+        pthread_join(threads[index], NULL);
+    free(threads);
+    pthread_mutex_destroy(&job.mutex);
+    download->retries += job.retries;
+    if (job.failed == true)
+        return -1;
+    return total;
+}
+
+int64_t
+httpio_download_to(httpio_download *download, const char *const destination)
+{
+    httpio_response *response;
+    struct httpio *link;
+    httpio_pool *pool;
+    int64_t result;
+    int64_t start;
+    int64_t end;
+    int64_t total;
+    size_t length;
+    int fd;
+
+    if ((download == NULL) || (destination == NULL))
+        return -1;
+    pool = download->pool;
+    if ((pool == NULL) && ((pool = httpio_pool_create(download->connections, HTTPIO_POOL_DEFAULT_TIMEOUT)) == NULL))
+        return -1;
+    result = -1;
+    response = NULL;
+    link = NULL;
+    fd = open(destination, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
+        goto finished;
+    // The first segment doubles as the probe for range support
+    for (size_t retries = 0; (response == NULL) && (retries <= HTTPIO_DOWNLOAD_MAXIMUM_RETRIES); ++retries) {
+        httpio_disconnect(link);
+        link = httpio_pool_checkout(pool, download->host, download->service);
+        if (link != NULL)
+            response = httpio_download_fetch(download, link, fd, 0, download->segment_size - 1, NULL, &length);
+        if ((response == NULL) && (retries > 0))
+            download->retries += 1;
+    }
+    if (response == NULL)
+        goto finished;
+    // Nothing to take a range of, the object is empty
+    if (httpio_response_get_code(response) == 416) {
+        httpio_response_free(response);
+        response = httpio_download_refetch(download, pool, &link, fd, &length);
+    } else if (httpio_response_get_code(response) == 206) {
+        // The other segments start where this one should end
+        if ((httpio_download_content_range(response, &start, &end, &total) == -1) ||
+                     (start != 0) || (length != (size_t) (end + 1)) ||
+                     ((end + 1 != (int64_t) download->segment_size) && (end + 1 != total)))
+            goto finished;
+        // A range of something with no known length
+        if (total == -1) {
+            httpio_response_free(response);
+            response = httpio_download_refetch(download, pool, &link, fd, &length);
+        } else if (total > end + 1) {
+            if (ftruncate(fd, total) == -1)
+                goto finished;
+            httpio_pool_checkin(pool, link);
+            link = NULL;
+            result = httpio_download_segments(download, pool, destination, response, total);
+            goto finished;
+        }
+    }
+    if ((response != NULL) && (httpio_response_get_code(response) / 100 == 2))
+        result = length;
+finished:
+    if (result == -1)
+        httpio_disconnect(link);
+    else
+        httpio_pool_checkin(pool, link);
+    httpio_response_free(response);
+    if (fd != -1) {
+        close(fd);
+        // Nothing of a failed transfer is kept
+        if (result == -1)
+            unlink(destination);
+    }
+    if (pool != download->pool)
+        httpio_pool_free(pool);
+    return result;
+}
@@ -0,0 +1,376 @@
+#include <http-encoding.h>
+#include <http-util.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include <pthread.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_BROTLI
+#include <brotli/decode.h>
+#endif
+
+struct httpio_zlib
+{
+    z_stream zstream;
+    // Some servers send deflate without the zlib header
+    bool fallback;
+};
+
+static void *httpio_gzip_decoder_create(void);
+static void *httpio_deflate_decoder_create(void);
+static int httpio_zlib_decode(void *state, const uint8_t *input, size_t *size, uint8_t *output, size_t *length);
+static void httpio_zlib_decoder_free(void *state);
+static void *httpio_gzip_encoder_create(int level);
+static void *httpio_deflate_encoder_create(int level);
+static int httpio_zlib_encode(void *state, const uint8_t *input, size_t *size, uint8_t *output, size_t *length, bool finish);
+static void httpio_zlib_encoder_free(void *state);
+#ifdef HAVE_ZSTD
+static void *httpio_zstd_decoder_create(void);
+static int httpio_zstd_decode(void *state, const uint8_t *input, size_t *size, uint8_t *output, size_t *length);
+static void httpio_zstd_decoder_free(void *state);
+#endif
+#ifdef HAVE_BROTLI
+static void *httpio_brotli_decoder_create(void);
+static int httpio_brotli_decode(void *state, const uint8_t *input, size_t *size, uint8_t *output, size_t *length);
+static void httpio_brotli_decoder_free(void *state);
+#endif
+
+static const httpio_codec GZIP_CODEC = {
+    "gzip",
+    httpio_gzip_decoder_create, httpio_zlib_decode, httpio_zlib_decoder_free,
+    httpio_gzip_encoder_create, httpio_zlib_encode, httpio_zlib_encoder_free
+};
+
+static const httpio_codec DEFLATE_CODEC = {
+    "deflate",
+    httpio_deflate_decoder_create, httpio_zlib_decode, httpio_zlib_decoder_free,
+    httpio_deflate_encoder_create, httpio_zlib_encode, httpio_zlib_encoder_free
+};
+
+#ifdef HAVE_ZSTD
+static const httpio_codec ZSTD_CODEC = {
+    "zstd",
+    httpio_zstd_decoder_create, httpio_zstd_decode, httpio_zstd_decoder_free,
+    NULL, NULL, NULL
+};
+#endif
+
+#ifdef HAVE_BROTLI
+static const httpio_codec BROTLI_CODEC = {
+    "br",
+    httpio_brotli_decoder_create, httpio_brotli_decode, httpio_brotli_decoder_free,
+    NULL, NULL, NULL
+};
+#endif
+
+// The fastest decoders first, it's the order of preference
+// that Accept-Encoding advertises
+static const httpio_codec *CODECS[HTTPIO_ENCODING_MAXIMUM_CODECS] = {
+#ifdef HAVE_ZSTD
+    &ZSTD_CODEC,
+#endif
+#ifdef HAVE_BROTLI
+    &BROTLI_CODEC,
+#endif
+    &GZIP_CODEC,
+    &DEFLATE_CODEC
+};
+static size_t CODECS_COUNT = 2
+#ifdef HAVE_ZSTD
+    + 1
+#endif
+#ifdef HAVE_BROTLI
+    + 1
+#endif
+;
+static pthread_mutex_t CODECS_MUTEX = PTHREAD_MUTEX_INITIALIZER;
+static char ACCEPT_ENCODING[0x100];
+
+static void *
+httpio_zlib_decoder_create_with_window(int bits, bool fallback)
+{
+    struct httpio_zlib *zlib;
+    zlib = malloc(sizeof(*zlib));
+    if (zlib == NULL)
+        return NULL;
+    memset(zlib, 0, sizeof(*zlib));
+    if (inflateInit2(&zlib->zstream, bits) != Z_OK) {
+        free(zlib);
+        return NULL;
+    }
+    zlib->fallback = fallback;
+    return zlib;
+}
+
+static void *
+httpio_gzip_decoder_create(void)
+{
+    return httpio_zlib_decoder_create_with_window(15 | 32, false);
+}
+
+static void *
+httpio_deflate_decoder_create(void)
+{
+    return httpio_zlib_decoder_create_with_window(15, true);
+}
+
+static int
+httpio_zlib_decode(void *state,
+             const uint8_t *input, size_t *size, uint8_t *output, size_t *length)
+{
+    struct httpio_zlib *zlib;
+    z_stream *zstream;
+    int result;
+
+    zlib = state;
+    zstream = &zlib->zstream;
+    for (;;) {
+        zstream->next_in = (Bytef *) input;
+        zstream->avail_in = *size;
+        zstream->next_out = output;
+        zstream->avail_out = *length;
+
+        result = inflate(zstream, Z_NO_FLUSH);
+        if ((result != Z_DATA_ERROR) || (zlib->fallback == false) || (zstream->total_out != 0))
+            break;
+        // No zlib header, start over as a raw deflate stream
+        zlib->fallback = false;
+        if (inflateReset2(zstream, -15) != Z_OK)
+            return -1;
+    }
+    *size -= zstream->avail_in;
+    *length -= zstream->avail_out;
+    switch (result) {
+    case Z_STREAM_END:
+        return 1;
+    case Z_OK:
+    case Z_BUF_ERROR:
+        return 0;
+    }
+    return -1;
+}
+
+static void
+httpio_zlib_decoder_free(void *state)
+{
+    struct httpio_zlib *zlib;
+    zlib = state;
+    if (zlib == NULL)
+        return;
+    inflateEnd(&zlib->zstream);
+    free(zlib);
+}
+
+static void *
+httpio_zlib_encoder_create_with_window(int level, int bits)
+{
+    struct httpio_zlib *zlib;
+    zlib = malloc(sizeof(*zlib));
+    if (zlib == NULL)
+        return NULL;
+    memset(zlib, 0, sizeof(*zlib));
+    if (deflateInit2(&zlib->zstream, level, Z_DEFLATED, bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        free(zlib);
+        return NULL;
+    }
+    return zlib;
+}
+
+static void *
+httpio_gzip_encoder_create(int level)
+{
+    return httpio_zlib_encoder_create_with_window(level, 15 | 16);
+}
+
+static void *
+httpio_deflate_encoder_create(int level)
+{
+    return httpio_zlib_encoder_create_with_window(level, 15);
+}
+
+static int
+httpio_zlib_encode(void *state, const uint8_t *input,
+                    size_t *size, uint8_t *output, size_t *length, bool finish)
+{
+    struct httpio_zlib *zlib;
+    z_stream *zstream;
+    int result;
+
+    zlib = state;
+    zstream = &zlib->zstream;
+    zstream->next_in = (Bytef *) input;
+    zstream->avail_in = *size;
+    zstream->next_out = output;
+    zstream->avail_out = *length;
+
+    result = deflate(zstream, (finish == true) ? Z_FINISH : Z_NO_FLUSH);
+    *size -= zstream->avail_in;
+    *length -= zstream->avail_out;
+    switch (result) {
+    case Z_STREAM_END:
+        return 1;
+    case Z_OK:
+    case Z_BUF_ERROR:
+        return 0;
+    }
+    return -1;
+}
+
+static void
+httpio_zlib_encoder_free(void *state)
+{
+    struct httpio_zlib *zlib;
+    zlib = state;
+    if (zlib == NULL)
+        return;
+    deflateEnd(&zlib->zstream);
+    free(zlib);
+}
+
+#ifdef HAVE_ZSTD
+static void *
+httpio_zstd_decoder_create(void)
+{
+    return ZSTD_createDStream();
+}
+
+static int
+httpio_zstd_decode(void *state,
+             const uint8_t *input, size_t *size, uint8_t *output, size_t *length)
+{
+    ZSTD_inBuffer in;
+    ZSTD_outBuffer out;
+    size_t result;
+
+    in.src = input;
+    in.size = *size;
+    in.pos = 0;
+    out.dst = output;
+    out.size = *length;
+    out.pos = 0;
+
+    // A body might be several frames one after the other
+    do {
+        result = ZSTD_decompressStream(state, &out, &in);
+        if (ZSTD_isError(result) != 0)
+            return -1;
+    } while ((result == 0) && (in.pos < in.size) && (out.pos < out.size));
+    *size = in.pos;
+    *length = out.pos;
+    // A frame was completely decoded and flushed, and no other
+    // one started
+    return ((result == 0) && (in.pos == in.size)) ? 1 : 0;
+}
+
+static void
+httpio_zstd_decoder_free(void *state)
+{
+    ZSTD_freeDStream(state);
+}
+#endif
+
+#ifdef HAVE_BROTLI
+static void *
+httpio_brotli_decoder_create(void)
+{
+    return BrotliDecoderCreateInstance(NULL, NULL, NULL);
+}
+
+static int
+httpio_brotli_decode(void *state,
+             const uint8_t *input, size_t *size, uint8_t *output, size_t *length)
+{
+    BrotliDecoderResult result;
+    size_t available_in;
+    size_t available_out;
+
+    available_in = *size;
+    available_out = *length;
+    result = BrotliDecoderDecompressStream(state,
+                                   &available_in, &input, &available_out, &output, NULL);
+    *size -= available_in;
+    *length -= available_out;
+    switch (result) {
+    case BROTLI_DECODER_RESULT_SUCCESS:
+        return 1;
+    case BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT:
+    case BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT:
+        return 0;
+    default:
+        break;
+    }
+    return -1;
+}
+
+static void
+httpio_brotli_decoder_free(void *state)
+{
+    if (state == NULL)
+        return;
+    BrotliDecoderDestroyInstance(state);
+}
+#endif
+
+int
+httpio_encoding_register(const httpio_codec *const codec)
+{
+    if ((codec == NULL) || (codec->name == NULL))
+        return -1;
+    pthread_mutex_lock(&CODECS_MUTEX);
+    if (CODECS_COUNT == countof(CODECS)) {
+        pthread_mutex_unlock(&CODECS_MUTEX);
+        return -1;
+    }
+    CODECS[CODECS_COUNT++] = codec;
+    // Built again next time it's needed
+    ACCEPT_ENCODING[0] = '\0';
+    pthread_mutex_unlock(&CODECS_MUTEX);
+    return 0;
+}
+
+const httpio_codec *
+httpio_encoding_find(const char *const name, size_t length)
+{
+    if (name == NULL)
+        return NULL;
+    // The last one registered for a name wins
+    for (size_t index = CODECS_COUNT; index > 0; --index) {
+        const httpio_codec *codec;
+        codec = CODECS[index - 1];
+        if ((strlen(codec->name) == length) && (strncasecmp(codec->name, name, length) == 0))
+            return codec;
+    }
+    return NULL;
+}
+
+const char *
+httpio_accept_encoding(void)
+{
+    pthread_mutex_lock(&CODECS_MUTEX);
+    if (ACCEPT_ENCODING[0] == '\0') {
+        size_t length;
+        length = 0;
+        for (size_t index = 0; index < CODECS_COUNT; ++index) {
+            const httpio_codec *codec;
+            int result;
+            codec = CODECS[index];
+            if ((codec->decode == NULL) ||
+                     (httpio_encoding_find(codec->name, strlen(codec->name)) != codec))
+                continue;
+            result = snprintf(ACCEPT_ENCODING + length, sizeof(ACCEPT_ENCODING) - length,
+                                            "%s%s", (length > 0) ? ", " : "", codec->name);
+            if ((result < 0) || ((size_t) result >= sizeof(ACCEPT_ENCODING) - length)) {
+                ACCEPT_ENCODING[length] = '\0';
+                break;
+            }
+            length += result;
+        }
+    }
+    pthread_mutex_unlock(&CODECS_MUTEX);
+    return ACCEPT_ENCODING;
+}
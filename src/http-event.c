@@ -0,0 +1,294 @@
+#include <http-event.h>
+
+#include <sys/epoll.h>
+
+#include <string.h>
+
+#include <unistd.h>
+#include <errno.h>
+
+#define EVENT_LOOP_BATCH_SIZE 64
+
+enum httpio_event_kind
+{
+    HttpEventResponse,
+    HttpEventWebSocket
+};
+
+struct httpio_event_watch
+{
+    // It's NULL once the link was removed from the loop
+    struct httpio *link;
+    enum httpio_event_kind kind;
+    httpio_event_response_handler onresponse;
+    httpio_event_frame_handler onframe;
+    void *data;
+    // Bytes were buffered before it was added, epoll won't report them
+    bool pending;
+    struct httpio_event_watch *next;
+};
+
+struct httpio_event_loop
+{
+    int epoll;
+    size_t count;
+    // Removed watches are released after the current dispatch
+    struct httpio_event_watch *watches;
+};
+
+static int httpio_event_loop_add(httpio_event_loop *loop, struct httpio *link, struct httpio_event_watch *watch);
+static void httpio_event_loop_dispatch(httpio_event_loop *loop, struct httpio_event_watch *watch, uint32_t events);
+static size_t httpio_event_loop_deliver(struct httpio_event_watch *watch, bool *failed);
+static void httpio_event_loop_sweep(httpio_event_loop *loop);
+
+httpio_event_loop *
+httpio_event_loop_create(void)
+{
+    httpio_event_loop *loop;
+    loop = malloc(sizeof(*loop));
+    if (loop == NULL)
+        return NULL;
+    loop->epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll == -1) {
+        free(loop);
+        return NULL;
+    }
+    loop->count = 0;
+    loop->watches = NULL;
+    return loop;
+}
+
+void
+httpio_event_loop_free(httpio_event_loop *loop)
+{
+    struct httpio_event_watch *next;
+    if (loop == NULL)
+        return;
+    // The links belong to the caller, they are not disconnected
+    for (struct httpio_event_watch *watch = loop->watches; watch != NULL; watch = next) {
+        next = watch->next;
+        free(watch);
+    }
+    close(loop->epoll);
+    free(loop);
+}
+
+static int
+httpio_event_loop_add(httpio_event_loop *loop,
+                             struct httpio *link, struct httpio_event_watch *watch)
+{
+    struct epoll_event event;
+    if (httpio_set_nonblocking(link, true) == -1)
+        goto failed;
+    memset(&event, 0, sizeof(event));
+
+    // Writes queue what the socket doesn't take, they go out
+    // when it's writable again
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = watch;
+    if (epoll_ctl(loop->epoll, EPOLL_CTL_ADD, httpio_socket(link), &event) == -1)
+        goto failed;
+    watch->link = link;
+    watch->pending = (httpio_buffered(link) > 0);
+    watch->next = loop->watches;
+    loop->watches = watch;
+    loop->count += 1;
+    return 0;
+failed:
+    free(watch);
+    return -1;
+}
+
+int
+httpio_event_loop_add_http(httpio_event_loop *loop, struct httpio *link,
+                               httpio_event_response_handler handler, void *data)
+{
+    struct httpio_event_watch *watch;
+    if ((loop == NULL) || (link == NULL) || (handler == NULL))
+        return -1;
+    watch = malloc(sizeof(*watch));
+    if (watch == NULL)
+        return -1;
+    watch->kind = HttpEventResponse;
+    watch->onresponse = handler;
+    watch->onframe = NULL;
+    watch->data = data;
+    return httpio_event_loop_add(loop, link, watch);
+}
+
+int
+httpio_event_loop_add_websocket(httpio_event_loop *loop, struct httpio *link,
+                                      httpio_event_frame_handler handler, void *data)
+{
+    struct httpio_event_watch *watch;
+    if ((loop == NULL) || (link == NULL) || (handler == NULL))
+        return -1;
+    watch = malloc(sizeof(*watch));
+    if (watch == NULL)
+        return -1;
+    watch->kind = HttpEventWebSocket;
+    watch->onresponse = NULL;
+    watch->onframe = handler;
+    watch->data = data;
+    return httpio_event_loop_add(loop, link, watch);
+}
+
+int
+httpio_event_loop_remove(httpio_event_loop *loop, struct httpio *link)
+{
+    if ((loop == NULL) || (link == NULL))
+        return -1;
+    for (struct httpio_event_watch *watch = loop->watches; watch != NULL; watch = watch->next) {
+        if (watch->link != link)
+            continue;
+        epoll_ctl(loop->epoll, EPOLL_CTL_DEL, httpio_socket(link), NULL);
+        // The blocking API works again after this
+        httpio_set_nonblocking(link, false);
+
+        watch->link = NULL;
+        loop->count -= 1;
+        return 0;
+    }
+    return -1;
+}
+
+size_t
+httpio_event_loop_count(const httpio_event_loop *const loop)
+{
+    if (loop == NULL)
+        return 0;
+    return loop->count;
+}
+
+static size_t
+httpio_event_loop_deliver(struct httpio_event_watch *watch, bool *failed)
+{
+    size_t count;
+    count = 0;
+    // Every complete message in the buffer, parsing never blocks here
+    while (watch->link != NULL) {
+        struct httpio *link;
+        link = watch->link;
+        if (watch->kind == HttpEventResponse) {
+            httpio_response *response;
+            if (httpio_response_buffered(link) == false)
+                break;
+            // A head that doesn't parse is buffered too, it's not
+            // consumed and the handler must not get half of it
+            response = httpio_read_response_to(link, NULL);
+            if (response == NULL)
+                goto error;
+            watch->onresponse(link, response, watch->data);
+        } else {
+            struct httpio_websocket_frame *frame;
+            if (httpio_websocket_frame_buffered(link) == false)
+                break;
+            frame = httpio_websocket_get_frame(link);
+            if (frame == NULL)
+                goto error;
+            watch->onframe(link, frame, watch->data);
+        }
+        count += 1;
+    }
+    return count;
+error:
+    *failed = true;
+    return count;
+}
+
+static void
+httpio_event_loop_dispatch(httpio_event_loop *loop, struct httpio_event_watch *watch, uint32_t events)
+{
+    struct httpio *link;
+    bool closed;
+    link = watch->link;
+    closed = false;
+    if (((events & EPOLLOUT) != 0) && (httpio_flush(link) == -1))
+        closed = true;
+    // Only room to write, nothing to read
+    if ((closed == false) && ((events & ~EPOLLOUT) == 0))
+        return;
+    while (closed == false) {
+        ssize_t result;
+        size_t count;
+        bool full;
+
+        result = httpio_buffer_drain(link, &closed);
+        full = ((result == -1) && (errno == ENOBUFS));
+        count = httpio_event_loop_deliver(watch, &closed);
+        if (watch->link == NULL)
+            return;
+        if ((closed == true) || (full == false))
+            break;
+        // The buffer is full and holds no complete message, give up
+        if (count == 0) {
+            closed = true;
+            break;
+        }
+    }
+    if (closed == false)
+        return;
+    httpio_event_loop_remove(loop, link);
+    if (watch->kind == HttpEventResponse)
+        watch->onresponse(link, NULL, watch->data);
+    else
+        watch->onframe(link, NULL, watch->data);
+}
+
+static void
+httpio_event_loop_sweep(httpio_event_loop *loop)
+{
+    struct httpio_event_watch **next;
+    next = &loop->watches;
+    while (*next != NULL) {
+        struct httpio_event_watch *watch;
+        watch = *next;
+        if (watch->link != NULL) {
+            next = &watch->next;
+        } else {
+            *next = watch->next;
+            free(watch);
+        }
+    }
+}
+
+int
+httpio_event_loop_run_once(httpio_event_loop *loop, int64_t nanoseconds)
+{
+    struct epoll_event events[EVENT_LOOP_BATCH_SIZE];
+    int timeout;
+    int count;
+    int pending;
+
+    if (loop == NULL)
+        return -1;
+    if (nanoseconds < 0)
+        timeout = -1;
+    else
+        timeout = (int) ((nanoseconds + 999999) / 1000000);
+    pending = 0;
+    for (struct httpio_event_watch *watch = loop->watches; watch != NULL; watch = watch->next) {
+        if ((watch->link == NULL) || (watch->pending == false))
+            continue;
+        watch->pending = false;
+        httpio_event_loop_dispatch(loop, watch, EPOLLIN);
+        pending += 1;
+    }
+    // Don't wait if something was delivered already
+    if (pending > 0)
+        timeout = 0;
+    count = epoll_wait(loop->epoll, events, countof(events), timeout);
+    if (count == -1) {
+        httpio_event_loop_sweep(loop);
+        return (errno == EINTR) ? pending : -1;
+    }
+    for (int index = 0; index < count; ++index) {
+        struct httpio_event_watch *watch;
+        watch = events[index].data.ptr;
+        if (watch->link == NULL)
+            continue;
+        httpio_event_loop_dispatch(loop, watch, events[index].events);
+    }
+    httpio_event_loop_sweep(loop);
+    return count + pending;
+}
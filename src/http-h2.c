@@ -0,0 +1,1052 @@
+#include <http-h2.h>
+#include <http-hpack.h>
+#include <http-scan.h>
+
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <ctype.h>
+
+#define H2_FRAME_HEADER_SIZE 9
+// What both ends start with, SETTINGS change all but the first
+#define H2_DEFAULT_FRAME_SIZE 0x4000
+#define H2_DEFAULT_INITIAL_WINDOW 0xFFFF
+#define H2_MAXIMUM_WINDOW 0x7FFFFFFF
+#define H2_MAXIMUM_IDENTIFIER 0x7FFFFFFF
+#define H2_MAXIMUM_FRAME_SIZE 0xFFFFFF
+// Servers must say how many streams they allow if there's a limit
+#define H2_DEFAULT_CONCURRENT_STREAMS 100
+
+#define H2_DATA 0x0
+#define H2_HEADERS 0x1
+#define H2_PRIORITY 0x2
+#define H2_RST_STREAM 0x3
+#define H2_SETTINGS 0x4
+#define H2_PUSH_PROMISE 0x5
+#define H2_PING 0x6
+#define H2_GOAWAY 0x7
+#define H2_WINDOW_UPDATE 0x8
+#define H2_CONTINUATION 0x9
+
+#define H2_FLAG_END_STREAM 0x1
+#define H2_FLAG_ACK 0x1
+#define H2_FLAG_END_HEADERS 0x4
+#define H2_FLAG_PADDED 0x8
+#define H2_FLAG_PRIORITY 0x20
+
+#define H2_SETTINGS_HEADER_TABLE_SIZE 0x1
+#define H2_SETTINGS_ENABLE_PUSH 0x2
+#define H2_SETTINGS_MAX_CONCURRENT_STREAMS 0x3
+#define H2_SETTINGS_INITIAL_WINDOW_SIZE 0x4
+#define H2_SETTINGS_MAX_FRAME_SIZE 0x5
+
+#define H2_NO_ERROR 0x0
+#define H2_PROTOCOL_ERROR 0x1
+#define H2_FLOW_CONTROL_ERROR 0x3
+#define H2_FRAME_SIZE_ERROR 0x6
+#define H2_CANCEL 0x8
+#define H2_COMPRESSION_ERROR 0x9
+
+struct httpio_h2_stream
+{
+    int32_t id;
+    // The response head as HTTP/1 text, and its body
+    httpio_bstream head;
+    httpio_bstream body;
+    // What we may still send, what arrived but wasn't read yet,
+    // and what was read since the last WINDOW_UPDATE
+    int64_t window;
+    size_t held;
+    size_t received;
+    // The request body, a copy, as far as it was sent
+    uint8_t *data;
+    size_t offset;
+    size_t size;
+    bool sending;
+    // The final response head arrived
+    bool headers;
+    bool complete;
+    bool failed;
+    // The application waits for this response
+    bool reading;
+    struct httpio_h2_stream *next;
+};
+
+struct httpio_h2
+{
+    struct httpio *link;
+    httpio_hpack encoder;
+    httpio_hpack decoder;
+    // Frames are queued and go out in a single write
+    httpio_bstream output;
+    // Oldest first, until their responses are read
+    struct httpio_h2_stream *streams;
+    size_t count;
+    int32_t next;
+    // Connection flow control, both directions
+    int64_t window;
+    size_t held;
+    size_t received;
+    // The server's settings
+    int64_t initial_window;
+    size_t frame_size;
+    size_t concurrent;
+    bool settings;
+    // A header block that continues in CONTINUATION frames
+    httpio_bstream block;
+    int32_t block_stream;
+    uint8_t block_flags;
+    // No new streams after GOAWAY, and no frames at all
+    // after a connection error
+    bool closed;
+    bool failed;
+};
+
+// Where the fields of a header block go
+struct httpio_h2_headers
+{
+    struct httpio_h2_stream *stream;
+    bool trailers;
+    bool malformed;
+};
+
+static const char PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+// Meaningless or forbidden in HTTP/2, RFC 9113 section 8.2.2
+static const char *CONNECTION_HEADERS[] = {
+    "connection", "keep-alive", "proxy-connection", "transfer-encoding", "upgrade", "host"
+};
+
+static uint32_t httpio_h2_get32(const uint8_t *const data);
+static void httpio_h2_put32(uint8_t *data, uint32_t value);
+static int httpio_h2_frame(httpio_h2 *session, uint8_t type, uint8_t flags, int32_t id, const uint8_t *const payload, size_t length);
+static int httpio_h2_flush(httpio_h2 *session);
+static int httpio_h2_fail(httpio_h2 *session, uint32_t code);
+static int httpio_h2_reset(httpio_h2 *session, struct httpio_h2_stream *stream, uint32_t code);
+static int httpio_h2_window_update(httpio_h2 *session, int32_t id, size_t increment);
+static int httpio_h2_replenish(httpio_h2 *session, struct httpio_h2_stream *stream);
+static int httpio_h2_consume(httpio_h2 *session, struct httpio_h2_stream *stream);
+static struct httpio_h2_stream *httpio_h2_find(httpio_h2 *session, int32_t id);
+static void httpio_h2_remove(httpio_h2 *session, struct httpio_h2_stream *stream);
+static size_t httpio_h2_active(httpio_h2 *session);
+static int httpio_h2_send_data(httpio_h2 *session, struct httpio_h2_stream *stream);
+static int httpio_h2_send_headers(httpio_h2 *session, int32_t id, const httpio_bstream *const block, bool end);
+static int httpio_h2_encode_request(httpio_h2 *session, char *data, const httpio_scanner *const scanner, httpio_bstream *block);
+static int httpio_h2_header(const char *name, size_t name_length, const char *value, size_t value_length, void *data);
+static int httpio_h2_headers_end(httpio_h2 *session);
+static int httpio_h2_unpad(uint8_t flags, const uint8_t **payload, size_t *length);
+static int httpio_h2_on_data(httpio_h2 *session, uint8_t flags, int32_t id, const uint8_t *payload, size_t length);
+static int httpio_h2_on_headers(httpio_h2 *session, uint8_t type, uint8_t flags, int32_t id, const uint8_t *payload, size_t length);
+static int httpio_h2_on_settings(httpio_h2 *session, uint8_t flags, int32_t id, const uint8_t *payload, size_t length);
+static int httpio_h2_on_window_update(httpio_h2 *session, int32_t id, const uint8_t *payload, size_t length);
+static int httpio_h2_process(httpio_h2 *session);
+
+static uint32_t
+httpio_h2_get32(const uint8_t *const data)
+{
+    return ((uint32_t) data[0] << 24) | ((uint32_t) data[1] << 16) |
+                                        ((uint32_t) data[2] << 8) | (uint32_t) data[3];
+}
+
+static void
+httpio_h2_put32(uint8_t *data, uint32_t value)
+{
+    data[0] = value >> 24;
+    data[1] = value >> 16;
+    data[2] = value >> 8;
+    data[3] = value;
+}
+
+static int
+httpio_h2_frame(httpio_h2 *session, uint8_t type,
+              uint8_t flags, int32_t id, const uint8_t *const payload, size_t length)
+{
+    uint8_t header[H2_FRAME_HEADER_SIZE];
+    header[0] = length >> 16;
+    header[1] = length >> 8;
+    header[2] = length;
+    header[3] = type;
+    header[4] = flags;
+    httpio_h2_put32(header + 5, id);
+    if (httpio_byte_stream_append(&session->output, header, sizeof(header)) == -1)
+        return -1;
+    if (length == 0)
+        return 0;
+    return httpio_byte_stream_append(&session->output, payload, length);
+}
+
+static int
+httpio_h2_flush(httpio_h2 *session)
+{
+    ssize_t result;
+    if (session->output.length == 0)
+        return 0;
+    result = httpio_write(session->link, session->output.data, session->output.length);
+    session->output.length = 0;
+    if (result == -1)
+        return -1;
+    return 0;
+}
+
+// A connection error, every stream that is still open fails
+static int
+httpio_h2_fail(httpio_h2 *session, uint32_t code)
+{
+    if (session->failed == false) {
+        uint8_t payload[8];
+        // We never accepted a stream from the server
+        httpio_h2_put32(payload, 0);
+        httpio_h2_put32(payload + 4, code);
+        session->output.length = 0;
+        if (httpio_h2_frame(session, H2_GOAWAY, 0, 0, payload, sizeof(payload)) == 0)
+            httpio_h2_flush(session);
+    }
+    session->closed = true;
+    session->failed = true;
+    for (struct httpio_h2_stream *stream = session->streams; stream != NULL; stream = stream->next) {
+        if (stream->complete == true)
+            continue;
+        stream->complete = true;
+        stream->failed = true;
+    }
+    return -1;
+}
+
+// Done with the request body, all of it sent or not
+static void
+httpio_h2_drop_data(struct httpio_h2_stream *stream)
+{
+    stream->sending = false;
+    free(stream->data);
+    stream->data = NULL;
+}
+
+// A stream error, the connection goes on
+static int
+httpio_h2_reset(httpio_h2 *session, struct httpio_h2_stream *stream, uint32_t code)
+{
+    uint8_t payload[4];
+    httpio_h2_drop_data(stream);
+    stream->failed = true;
+    if (stream->complete == true)
+        return 0;
+    stream->complete = true;
+    httpio_h2_put32(payload, code);
+    return httpio_h2_frame(session, H2_RST_STREAM, 0, stream->id, payload, sizeof(payload));
+}
+
+static int
+httpio_h2_window_update(httpio_h2 *session, int32_t id, size_t increment)
+{
+    uint8_t payload[4];
+    httpio_h2_put32(payload, increment);
+    return httpio_h2_frame(session, H2_WINDOW_UPDATE, 0, id, payload, sizeof(payload));
+}
+
+// Gives back what was read once it's half a window, the
+// server stops sending what nobody reads
+static int
+httpio_h2_replenish(httpio_h2 *session, struct httpio_h2_stream *stream)
+{
+    if (session->received >= HTTPIO_H2_DEFAULT_WINDOW / 2) {
+        if (httpio_h2_window_update(session, 0, session->received) == -1)
+            return -1;
+        session->received = 0;
+    }
+    if ((stream == NULL) || (stream->complete == true))
+        return 0;
+    if (stream->received >= HTTPIO_H2_DEFAULT_WINDOW / 2) {
+        if (httpio_h2_window_update(session, stream->id, stream->received) == -1)
+            return -1;
+        stream->received = 0;
+    }
+    return 0;
+}
+
+// The application has what arrived for the stream
+static int
+httpio_h2_consume(httpio_h2 *session, struct httpio_h2_stream *stream)
+{
+    size_t size;
+    stream->received += stream->held;
+    // The connection might have had it back already
+    size = (stream->held < session->held) ? stream->held : session->held;
+    session->held -= size;
+    session->received += size;
+    stream->held = 0;
+    return httpio_h2_replenish(session, stream);
+}
+
+static struct httpio_h2_stream *
+httpio_h2_find(httpio_h2 *session, int32_t id)
+{
+    for (struct httpio_h2_stream *stream = session->streams; stream != NULL; stream = stream->next) {
+        if (stream->id == id)
+            return stream;
+    }
+    return NULL;
+}
+
+static void
+httpio_h2_remove(httpio_h2 *session, struct httpio_h2_stream *stream)
+{
+    struct httpio_h2_stream **link;
+    for (link = &session->streams; *link != NULL; link = &(*link)->next) {
+        if (*link != stream)
+            continue;
+        *link = stream->next;
+        session->count -= 1;
+        break;
+    }
+    httpio_byte_stream_free(&stream->head);
+    httpio_byte_stream_free(&stream->body);
+    free(stream->data);
+    free(stream);
+}
+
+// Streams the server counts against its limit
+static size_t
+httpio_h2_active(httpio_h2 *session)
+{
+    size_t count;
+    count = 0;
+    for (struct httpio_h2_stream *stream = session->streams; stream != NULL; stream = stream->next) {
+        if (stream->complete == false)
+            count += 1;
+    }
+    return count;
+}
+
+// Sends as much of the request body as the windows allow, the
+// rest waits for a WINDOW_UPDATE
+static int
+httpio_h2_send_data(httpio_h2 *session, struct httpio_h2_stream *stream)
+{
+    // No DATA on streams that are over, reset ones in particular
+    if ((stream->complete == true) || (stream->failed == true))
+        httpio_h2_drop_data(stream);
+    while (stream->sending == true) {
+        uint8_t flags;
+        size_t size;
+
+        size = stream->size - stream->offset;
+        if (size > session->frame_size)
+            size = session->frame_size;
+        if ((session->window <= 0) || (stream->window <= 0))
+            size = 0;
+        if ((int64_t) size > session->window)
+            size = session->window;
+        if ((int64_t) size > stream->window)
+            size = stream->window;
+        if ((size == 0) && (stream->offset < stream->size))
+            return 0;
+        flags = (stream->offset + size == stream->size) ? H2_FLAG_END_STREAM : 0;
+        if (httpio_h2_frame(session, H2_DATA, flags, stream->id, stream->data + stream->offset, size) == -1)
+            return -1;
+        session->window -= size;
+        stream->window -= size;
+        stream->offset += size;
+        if (flags == 0)
+            continue;
+        httpio_h2_drop_data(stream);
+    }
+    return 0;
+}
+
+static int
+httpio_h2_send_headers(httpio_h2 *session, int32_t id, const httpio_bstream *const block, bool end)
+{
+    uint8_t type;
+    uint8_t flags;
+    size_t offset;
+
+    type = H2_HEADERS;
+    flags = (end == true) ? H2_FLAG_END_STREAM : 0;
+    offset = 0;
+    do {
+        size_t size;
+        size = block->length - offset;
+        if (size > session->frame_size)
+            size = session->frame_size;
+        if (offset + size == block->length)
+            flags |= H2_FLAG_END_HEADERS;
+        if (httpio_h2_frame(session, type, flags, id, block->data + offset, size) == -1)
+            return -1;
+        offset += size;
+        type = H2_CONTINUATION;
+        flags = 0;
+    } while (offset < block->length);
+    return 0;
+}
+
+// Turns the HTTP/1 head of a request into a header block, the
+// request line and Host become pseudo header fields
+static int
+httpio_h2_encode_request(httpio_h2 *session,
+                 char *data, const httpio_scanner *const scanner, httpio_bstream *block)
+{
+    const char *authority;
+    const char *service;
+    const char *method;
+    const char *path;
+    char *space;
+    size_t authority_length;
+    size_t method_length;
+    size_t path_length;
+    char buffer[300];
+
+    method = data;
+    method_length = strcspn(data, " ");
+    path = method + method_length + 1;
+    // The protocol version follows the last space
+    for (space = data + scanner->lines[0].end; (space > path) && (space[-1] != ' '); --space)
+        ;
+    if (space <= path)
+        return -1;
+    path_length = space - 1 - path;
+    authority = NULL;
+    authority_length = 0;
+    for (size_t index = 1; index < scanner->count; ++index) {
+        const httpio_scan_line *line;
+        line = &scanner->lines[index];
+        if ((line->colon - line->start == 4) && (strncasecmp(data + line->start, "host", 4) == 0)) {
+            authority = data + line->colon + 1;
+            authority_length = data + line->end - authority;
+            while ((authority_length > 0) && (*authority == ' ')) {
+                ++authority;
+                --authority_length;
+            }
+        }
+    }
+    if (authority == NULL) {
+        authority = httpio_host(session->link);
+        service = httpio_service(session->link);
+        if ((service != NULL) && (strcmp(service, "443") != 0) && (strcmp(service, "https") != 0)) {
+            snprintf(buffer, sizeof(buffer), "%s:%s", authority, service);
+            authority = buffer;
+        }
+        authority_length = strlen(authority);
+    }
+    if (httpio_hpack_encode_start(&session->encoder, block) == -1)
+        return -1;
+    if (httpio_hpack_encode(&session->encoder, ":method", 7, method, method_length, block) == -1)
+        return -1;
+    if (httpio_hpack_encode(&session->encoder, ":scheme", 7, "https", 5, block) == -1)
+        return -1;
+    if (httpio_hpack_encode(&session->encoder, ":authority", 10, authority, authority_length, block) == -1)
+        return -1;
+    if (httpio_hpack_encode(&session->encoder, ":path", 5, path, path_length, block) == -1)
+        return -1;
+    for (size_t index = 1; index < scanner->count; ++index) {
+        const httpio_scan_line *line;
+        const char *value;
+        char *name;
+        size_t name_length;
+        size_t value_length;
+        bool skip;
+
+        line = &scanner->lines[index];
+        name = data + line->start;
+        name_length = line->colon - line->start;
+        value = data + line->colon + 1;
+        value_length = data + line->end - value;
+        if (line->folded == true)
+            httpio_scan_unfold(data + line->colon + 1, value_length);
+        while ((value_length > 0) && ((*value == ' ') || (*value == '\t'))) {
+            ++value;
+            --value_length;
+        }
+        while ((value_length > 0) && ((value[value_length - 1] == ' ') || (value[value_length - 1] == '\t')))
+            --value_length;
+        // Field names are lowercase in HTTP/2
+        for (size_t position = 0; position < name_length; ++position)
+            name[position] = tolower((unsigned char) name[position]);
+        skip = false;
+        for (size_t entry = 0; entry < countof(CONNECTION_HEADERS); ++entry) {
+            if ((strlen(CONNECTION_HEADERS[entry]) == name_length) &&
+                             (memcmp(CONNECTION_HEADERS[entry], name, name_length) == 0))
+                skip = true;
+        }
+        if ((name_length == 2) && (memcmp(name, "te", 2) == 0))
+            skip = (value_length != 8) || (strncasecmp(value, "trailers", 8) != 0);
+        if (skip == true)
+            continue;
+        if (httpio_hpack_encode(&session->encoder, name, name_length, value, value_length, block) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+static int
+httpio_h2_header(const char *name,
+               size_t name_length, const char *value, size_t value_length, void *data)
+{
+    struct httpio_h2_headers *headers;
+    httpio_bstream *head;
+
+    headers = data;
+    // The head is HTTP/1 text later, nothing can break its lines
+    if ((memchr(value, '\r', value_length) != NULL) || (memchr(value, '\n', value_length) != NULL) ||
+                                              (memchr(value, '\0', value_length) != NULL))
+        headers->malformed = true;
+    if ((headers->stream == NULL) || (headers->trailers == true) || (headers->malformed == true))
+        return 0;
+    head = &headers->stream->head;
+    if ((name_length == 7) && (memcmp(name, ":status", 7) == 0)) {
+        if ((head->length > 0) || (value_length != 3)) {
+            headers->malformed = true;
+            return 0;
+        }
+        if ((httpio_byte_stream_append(head, (const uint8_t *) "HTTP/2 ", 7) == -1) ||
+                     (httpio_byte_stream_append(head, (const uint8_t *) value, value_length) == -1))
+            return -1;
+        return httpio_byte_stream_append(head, (const uint8_t *) "\r\n", 2);
+    }
+    // Responses have no other pseudo header, and :status goes first
+    if ((name_length == 0) || (name[0] == ':') || (head->length == 0)) {
+        headers->malformed = true;
+        return 0;
+    }
+    if ((httpio_byte_stream_append(head, (const uint8_t *) name, name_length) == -1) ||
+                (httpio_byte_stream_append(head, (const uint8_t *) ": ", 2) == -1) ||
+                (httpio_byte_stream_append(head, (const uint8_t *) value, value_length) == -1))
+        return -1;
+    return httpio_byte_stream_append(head, (const uint8_t *) "\r\n", 2);
+}
+
+// Every block is decoded, even for streams we forgot about,
+// or the dynamic tables would disagree
+static int
+httpio_h2_headers_end(httpio_h2 *session)
+{
+    struct httpio_h2_headers headers;
+    struct httpio_h2_stream *stream;
+    bool end;
+
+    stream = httpio_h2_find(session, session->block_stream);
+    if ((stream != NULL) && (stream->complete == true))
+        stream = NULL;
+    end = ((session->block_flags & H2_FLAG_END_STREAM) != 0);
+    headers.stream = stream;
+    headers.trailers = (stream != NULL) && (stream->headers == true);
+    headers.malformed = false;
+    if (httpio_hpack_decode(&session->decoder, session->block.data,
+                   session->block.length, httpio_h2_header, &headers) == -1)
+        return httpio_h2_fail(session, H2_COMPRESSION_ERROR);
+    session->block.length = 0;
+    session->block_stream = 0;
+    if (stream == NULL)
+        return 0;
+    if ((headers.malformed == true) || (stream->head.length == 0) ||
+                               ((headers.trailers == true) && (end == false)))
+        return httpio_h2_reset(session, stream, H2_PROTOCOL_ERROR);
+    if (headers.trailers == false) {
+        // Informational responses are skipped, like 100 Continue
+        if (stream->head.data[7] == '1') {
+            if (end == true)
+                return httpio_h2_reset(session, stream, H2_PROTOCOL_ERROR);
+            stream->head.length = 0;
+            return 0;
+        }
+        stream->headers = true;
+    }
+    if (end == true)
+        stream->complete = true;
+    return 0;
+}
+
+static int
+httpio_h2_unpad(uint8_t flags, const uint8_t **payload, size_t *length)
+{
+    size_t padding;
+    if ((flags & H2_FLAG_PADDED) == 0)
+        return 0;
+    if (*length == 0)
+        return -1;
+    padding = **payload;
+    if (padding >= *length)
+        return -1;
+    *payload += 1;
+    *length -= padding + 1;
+    return 0;
+}
+
+static int
+httpio_h2_on_data(httpio_h2 *session,
+            uint8_t flags, int32_t id, const uint8_t *payload, size_t length)
+{
+    struct httpio_h2_stream *stream;
+    size_t size;
+
+    if (id == 0)
+        return httpio_h2_fail(session, H2_PROTOCOL_ERROR);
+    size = length;
+    if (httpio_h2_unpad(flags, &payload, &length) == -1)
+        return httpio_h2_fail(session, H2_PROTOCOL_ERROR);
+    stream = httpio_h2_find(session, id);
+    if ((stream == NULL) || (stream->complete == true) || (stream->headers == false)) {
+        // Nobody will read it
+        session->received += size;
+        if (httpio_h2_replenish(session, NULL) == -1)
+            return -1;
+        if ((stream == NULL) || (stream->complete == true))
+            return 0;
+        return httpio_h2_reset(session, stream, H2_PROTOCOL_ERROR);
+    }
+    // Padding counts against the windows too, but it's never read
+    stream->received += size - length;
+    session->received += size - length;
+    if (httpio_byte_stream_append(&stream->body, payload, length) == -1) {
+        session->received += length;
+        if (httpio_h2_replenish(session, NULL) == -1)
+            return -1;
+        return httpio_h2_reset(session, stream, H2_CANCEL);
+    }
+    stream->held += length;
+    session->held += length;
+    if ((flags & H2_FLAG_END_STREAM) != 0)
+        stream->complete = true;
+    if (stream->reading == true)
+        return httpio_h2_consume(session, stream);
+    return httpio_h2_replenish(session, stream);
+}
+
+static int
+httpio_h2_on_headers(httpio_h2 *session, uint8_t type,
+                  uint8_t flags, int32_t id, const uint8_t *payload, size_t length)
+{
+    if (id == 0)
+        return httpio_h2_fail(session, H2_PROTOCOL_ERROR);
+    if (type == H2_HEADERS) {
+        if (httpio_h2_unpad(flags, &payload, &length) == -1)
+            return httpio_h2_fail(session, H2_PROTOCOL_ERROR);
+        // Priorities are advisory, we don't use them
+        if ((flags & H2_FLAG_PRIORITY) != 0) {
+            if (length < 5)
+                return httpio_h2_fail(session, H2_PROTOCOL_ERROR);
+            payload += 5;
+            length -= 5;
+        }
+        session->block_stream = id;
+        session->block_flags = flags;
+    } else if (id != session->block_stream) {
+        return httpio_h2_fail(session, H2_PROTOCOL_ERROR);
+    }
+    if (session->block.length + length > HTTPIO_H2_MAXIMUM_HEADER_BLOCK)
+        return httpio_h2_fail(session, H2_PROTOCOL_ERROR);
+    if (httpio_byte_stream_append(&session->block, payload, length) == -1)
+        return httpio_h2_fail(session, H2_PROTOCOL_ERROR);
+    if ((flags & H2_FLAG_END_HEADERS) == 0)
+        return 0;
+    return httpio_h2_headers_end(session);
+}
+
+static int
+httpio_h2_on_settings(httpio_h2 *session,
+              uint8_t flags, int32_t id, const uint8_t *payload, size_t length)
+{
+    if (id != 0)
+        return httpio_h2_fail(session, H2_PROTOCOL_ERROR);
+    if ((flags & H2_FLAG_ACK) != 0) {
+        if (length != 0)
+            return httpio_h2_fail(session, H2_FRAME_SIZE_ERROR);
+        return 0;
+    }
+    if (length % 6 != 0)
+        return httpio_h2_fail(session, H2_FRAME_SIZE_ERROR);
+    for (size_t offset = 0; offset < length; offset += 6) {
+        uint16_t identifier;
+        uint32_t value;
+
+        identifier = ((uint16_t) payload[offset] << 8) | payload[offset + 1];
+        value = httpio_h2_get32(payload + offset + 2);
+        switch (identifier) {
+        case H2_SETTINGS_HEADER_TABLE_SIZE:
+            httpio_hpack_set_limit(&session->encoder, value);
+            break;
+        case H2_SETTINGS_MAX_CONCURRENT_STREAMS:
+            session->concurrent = value;
+            break;
+        case H2_SETTINGS_INITIAL_WINDOW_SIZE:
+            if (value > H2_MAXIMUM_WINDOW)
+                return httpio_h2_fail(session, H2_FLOW_CONTROL_ERROR);
+            // Open streams' windows move by the difference
+            for (struct httpio_h2_stream *stream = session->streams; stream != NULL; stream = stream->next)
+                stream->window += (int64_t) value - session->initial_window;
+            session->initial_window = value;
+            break;
+        case H2_SETTINGS_MAX_FRAME_SIZE:
+            if ((value < H2_DEFAULT_FRAME_SIZE) || (value > H2_MAXIMUM_FRAME_SIZE))
+                return httpio_h2_fail(session, H2_PROTOCOL_ERROR);
+            session->frame_size = value;
+            break;
+        default:
+            // Unknown ones must be ignored
+            break;
+        }
+    }
+    session->settings = true;
+    if (httpio_h2_frame(session, H2_SETTINGS, H2_FLAG_ACK, 0, NULL, 0) == -1)
+        return -1;
+    // A larger window might let pending bodies through
+    for (struct httpio_h2_stream *stream = session->streams; stream != NULL; stream = stream->next) {
+        if (httpio_h2_send_data(session, stream) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+static int
+httpio_h2_on_window_update(httpio_h2 *session, int32_t id, const uint8_t *payload, size_t length)
+{
+    struct httpio_h2_stream *stream;
+    uint32_t increment;
+
+    if (length != 4)
+        return httpio_h2_fail(session, H2_FRAME_SIZE_ERROR);
+    increment = httpio_h2_get32(payload) & H2_MAXIMUM_WINDOW;
+    if (id == 0) {
+        if ((increment == 0) || (session->window + increment > H2_MAXIMUM_WINDOW))
+            return httpio_h2_fail(session, H2_FLOW_CONTROL_ERROR);
+        session->window += increment;
+        for (stream = session->streams; stream != NULL; stream = stream->next) {
+            if (httpio_h2_send_data(session, stream) == -1)
+                return -1;
+        }
+        return 0;
+    }
+    stream = httpio_h2_find(session, id);
+    if (stream == NULL)
+        return 0;
+    if ((increment == 0) || (stream->window + increment > H2_MAXIMUM_WINDOW))
+        return httpio_h2_reset(session, stream, H2_FLOW_CONTROL_ERROR);
+    stream->window += increment;
+    return httpio_h2_send_data(session, stream);
+}
+
+// Waits for the next frame and handles it, -1 means the
+// connection is unusable
+static int
+httpio_h2_process(httpio_h2 *session)
+{
+    const uint8_t *data;
+    const uint8_t *payload;
+    size_t length;
+    uint8_t type;
+    uint8_t flags;
+    int32_t id;
+    int result;
+
+    if (session->failed == true)
+        return -1;
+    // Unread bodies could take the whole connection window from the
+    // response that is waited for, their own windows still bound them
+    if (session->held >= HTTPIO_H2_DEFAULT_WINDOW / 2) {
+        session->received += session->held;
+        session->held = 0;
+        if (httpio_h2_replenish(session, NULL) == -1)
+            return httpio_h2_fail(session, H2_NO_ERROR);
+    }
+    if (httpio_h2_flush(session) == -1)
+        return httpio_h2_fail(session, H2_NO_ERROR);
+    if (httpio_peek(session->link, &data, H2_FRAME_HEADER_SIZE, DEFAULT_TIMEOUT) == -1)
+        return httpio_h2_fail(session, H2_NO_ERROR);
+    length = ((size_t) data[0] << 16) | ((size_t) data[1] << 8) | data[2];
+    // We never allowed anything larger
+    if (length > H2_DEFAULT_FRAME_SIZE)
+        return httpio_h2_fail(session, H2_FRAME_SIZE_ERROR);
+    if (httpio_peek(session->link, &data, H2_FRAME_HEADER_SIZE + length, DEFAULT_TIMEOUT) == -1)
+        return httpio_h2_fail(session, H2_NO_ERROR);
+    type = data[3];
+    flags = data[4];
+    id = httpio_h2_get32(data + 5) & H2_MAXIMUM_IDENTIFIER;
+    payload = data + H2_FRAME_HEADER_SIZE;
+    // Nothing can come between a header block's frames
+    if ((session->block_stream != 0) && (type != H2_CONTINUATION))
+        return httpio_h2_fail(session, H2_PROTOCOL_ERROR);
+    switch (type) {
+    case H2_DATA:
+        result = httpio_h2_on_data(session, flags, id, payload, length);
+        break;
+    case H2_HEADERS:
+    case H2_CONTINUATION:
+        result = httpio_h2_on_headers(session, type, flags, id, payload, length);
+        break;
+    case H2_RST_STREAM:
+        if (length != 4) {
+            result = httpio_h2_fail(session, H2_FRAME_SIZE_ERROR);
+        } else {
+            struct httpio_h2_stream *stream;
+            // Servers may reset streams they answered already, and
+            // NO_ERROR after the head ends the response all the same
+            stream = httpio_h2_find(session, id);
+            if (stream != NULL)
+                httpio_h2_drop_data(stream);
+            if ((stream != NULL) && (stream->complete == false)) {
+                stream->complete = true;
+                stream->failed = (stream->headers == false) || (httpio_h2_get32(payload) != H2_NO_ERROR);
+            }
+            result = 0;
+        }
+        break;
+    case H2_SETTINGS:
+        result = httpio_h2_on_settings(session, flags, id, payload, length);
+        break;
+    case H2_PUSH_PROMISE:
+        // We said no
+        result = httpio_h2_fail(session, H2_PROTOCOL_ERROR);
+        break;
+    case H2_PING:
+        if ((length != 8) || (id != 0))
+            result = httpio_h2_fail(session, H2_PROTOCOL_ERROR);
+        else if ((flags & H2_FLAG_ACK) == 0)
+            result = httpio_h2_frame(session, H2_PING, H2_FLAG_ACK, 0, payload, length);
+        else
+            result = 0;
+        break;
+    case H2_GOAWAY:
+        if (length < 8) {
+            result = httpio_h2_fail(session, H2_FRAME_SIZE_ERROR);
+        } else {
+            int32_t last;
+            // Streams after the last one were never processed
+            last = httpio_h2_get32(payload) & H2_MAXIMUM_IDENTIFIER;
+            for (struct httpio_h2_stream *stream = session->streams; stream != NULL; stream = stream->next) {
+                if ((stream->id > last) && (stream->complete == false)) {
+                    stream->complete = true;
+                    stream->failed = true;
+                }
+            }
+            session->closed = true;
+            result = 0;
+        }
+        break;
+    case H2_WINDOW_UPDATE:
+        result = httpio_h2_on_window_update(session, id, payload, length);
+        break;
+    default:
+        // PRIORITY and unknown frame types
+        result = 0;
+        break;
+    }
+    httpio_consume(session->link, H2_FRAME_HEADER_SIZE + length);
+    if (result == -1)
+        return httpio_h2_fail(session, H2_NO_ERROR);
+    return 0;
+}
+
+httpio_h2 *
+httpio_h2_create(struct httpio *link)
+{
+    uint8_t settings[12];
+    httpio_h2 *session;
+
+    if (link == NULL)
+        return NULL;
+    session = malloc(sizeof(*session));
+    if (session == NULL)
+        return NULL;
+    memset(session, 0, sizeof(*session));
+    session->link = link;
+    session->next = 1;
+    session->window = H2_DEFAULT_INITIAL_WINDOW;
+    session->initial_window = H2_DEFAULT_INITIAL_WINDOW;
+    session->frame_size = H2_DEFAULT_FRAME_SIZE;
+    session->concurrent = H2_DEFAULT_CONCURRENT_STREAMS;
+    httpio_hpack_start(&session->encoder, HTTPIO_HPACK_DEFAULT_TABLE_SIZE);
+    httpio_hpack_start(&session->decoder, HTTPIO_HPACK_DEFAULT_TABLE_SIZE);
+
+    // No server push, and larger windows than the default
+    settings[0] = 0;
+    settings[1] = H2_SETTINGS_ENABLE_PUSH;
+    httpio_h2_put32(settings + 2, 0);
+    settings[6] = 0;
+    settings[7] = H2_SETTINGS_INITIAL_WINDOW_SIZE;
+    httpio_h2_put32(settings + 8, HTTPIO_H2_DEFAULT_WINDOW);
+    if (httpio_byte_stream_append(&session->output, (const uint8_t *) PREFACE, sizeof(PREFACE) - 1) == -1)
+        goto error;
+    if (httpio_h2_frame(session, H2_SETTINGS, 0, 0, settings, sizeof(settings)) == -1)
+        goto error;
+    if (httpio_h2_window_update(session, 0, HTTPIO_H2_DEFAULT_WINDOW - H2_DEFAULT_INITIAL_WINDOW) == -1)
+        goto error;
+    if (httpio_h2_flush(session) == -1)
+        goto error;
+    // The server's SETTINGS come first, streams beyond its limit
+    // would be refused otherwise
+    while (session->settings == false) {
+        if (httpio_h2_process(session) == -1)
+            goto error;
+    }
+    return session;
+error:
+    session->failed = true;
+    httpio_h2_free(session);
+    return NULL;
+}
+
+void
+httpio_h2_free(httpio_h2 *session)
+{
+    if (session == NULL)
+        return;
+    if (session->failed == false) {
+        uint8_t payload[8];
+        httpio_h2_put32(payload, 0);
+        httpio_h2_put32(payload + 4, H2_NO_ERROR);
+        if (httpio_h2_frame(session, H2_GOAWAY, 0, 0, payload, sizeof(payload)) == 0)
+            httpio_h2_flush(session);
+    }
+    while (session->streams != NULL)
+        httpio_h2_remove(session, session->streams);
+    httpio_hpack_free(&session->encoder);
+    httpio_hpack_free(&session->decoder);
+    httpio_byte_stream_free(&session->output);
+    httpio_byte_stream_free(&session->block);
+    free(session);
+}
+
+int32_t
+httpio_h2_submit(httpio_h2 *session, const httpio_request *const request)
+{
+    struct httpio_h2_stream *stream;
+    struct httpio_h2_stream **last;
+    httpio_scanner scanner;
+    httpio_bstream block;
+    ssize_t head;
+    size_t length;
+    char *data;
+
+    if ((session == NULL) || (request == NULL))
+        return -1;
+    while ((session->closed == false) && (session->concurrent > 0) &&
+                            (httpio_h2_active(session) >= session->concurrent)) {
+        if (httpio_h2_process(session) == -1)
+            return -1;
+    }
+    // Identifiers can't be reused, a new connection is needed then,
+    // and no stream will ever be allowed with a limit of 0
+    if ((session->closed == true) || (session->concurrent == 0) || (session->next > H2_MAXIMUM_IDENTIFIER - 2))
+        return -1;
+    data = httpio_request_serialize(request, &length);
+    if (data == NULL)
+        return -1;
+    stream = NULL;
+    memset(&block, 0, sizeof(block));
+    httpio_scanner_start(&scanner);
+    head = httpio_scan_head(&scanner, (const uint8_t *) data, length);
+    if (head <= 0)
+        goto error;
+    stream = malloc(sizeof(*stream));
+    if (stream == NULL)
+        goto error;
+    memset(stream, 0, sizeof(*stream));
+    stream->window = session->initial_window;
+    stream->size = length - head;
+    if (stream->size > 0) {
+        stream->data = malloc(stream->size);
+        if (stream->data == NULL)
+            goto error;
+        memcpy(stream->data, data + head, stream->size);
+        stream->sending = true;
+    }
+    if (httpio_h2_encode_request(session, data, &scanner, &block) == -1)
+        goto failed;
+    stream->id = session->next;
+    session->next += 2;
+    if (httpio_h2_send_headers(session, stream->id, &block, stream->sending == false) == -1)
+        goto failed;
+    if (httpio_h2_send_data(session, stream) == -1)
+        goto failed;
+    for (last = &session->streams; *last != NULL; last = &(*last)->next)
+        ;
+    *last = stream;
+    session->count += 1;
+    httpio_scanner_free(&scanner);
+    httpio_byte_stream_free(&block);
+    free(data);
+    if (httpio_h2_flush(session) == -1) {
+        httpio_h2_fail(session, H2_NO_ERROR);
+        return -1;
+    }
+    return stream->id;
+failed:
+    // The encoder's table already changed
+    httpio_h2_fail(session, H2_NO_ERROR);
+error:
+    if (stream != NULL)
+        free(stream->data);
+    free(stream);
+    httpio_scanner_free(&scanner);
+    httpio_byte_stream_free(&block);
+    free(data);
+    return -1;
+}
+
+httpio_response *
+httpio_h2_read_response(httpio_h2 *session, int32_t id)
+{
+    struct httpio_h2_stream *stream;
+    httpio_response *response;
+
+    if (session == NULL)
+        return NULL;
+    stream = httpio_h2_find(session, id);
+    if (stream == NULL)
+        return NULL;
+    stream->reading = true;
+    if (httpio_h2_consume(session, stream) == -1)
+        httpio_h2_fail(session, H2_NO_ERROR);
+    while (stream->complete == false) {
+        if (httpio_h2_process(session) == -1)
+            break;
+    }
+    // The connection window gets the rest of the body back
+    if (httpio_h2_consume(session, stream) == -1)
+        httpio_h2_fail(session, H2_NO_ERROR);
+    response = NULL;
+    if ((stream->failed == false) && (stream->headers == true) &&
+                (httpio_byte_stream_append(&stream->head, (const uint8_t *) "\r\n", 2) == 0)) {
+        // The response takes the body over
+        response = httpio_response_create((const char *) stream->head.data,
+                                  stream->head.length, stream->body.data, stream->body.length);
+        memset(&stream->body, 0, sizeof(stream->body));
+    }
+    httpio_h2_remove(session, stream);
+    return response;
+}
+
+httpio_response *
+httpio_h2_read_next(httpio_h2 *session, int32_t *id)
+{
+    if (id != NULL)
+        *id = -1;
+    if (session == NULL)
+        return NULL;
+    while (session->streams != NULL) {
+        for (struct httpio_h2_stream *stream = session->streams; stream != NULL; stream = stream->next) {
+            if (stream->complete == false)
+                continue;
+            if (id != NULL)
+                *id = stream->id;
+            for (struct httpio_h2_stream *other = session->streams; other != NULL; other = other->next)
+                other->reading = false;
+            return httpio_h2_read_response(session, stream->id);
+        }
+        // Any of them will do, they are all being read
+        for (struct httpio_h2_stream *stream = session->streams; stream != NULL; stream = stream->next) {
+            stream->reading = true;
+            if (httpio_h2_consume(session, stream) == -1)
+                httpio_h2_fail(session, H2_NO_ERROR);
+        }
+        // Every stream is marked complete when it fails
+        httpio_h2_process(session);
+    }
+    return NULL;
+}
+
+size_t
+httpio_h2_pending(httpio_h2 *session)
+{
+    if (session == NULL)
+        return 0;
+    return session->count;
+}
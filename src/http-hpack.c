@@ -0,0 +1,634 @@
+#include <http-hpack.h>
+
+#include <string.h>
+
+#include <pthread.h>
+
+#define HPACK_STATIC_COUNT 61
+// Each entry counts this much on top of its strings
+#define HPACK_ENTRY_OVERHEAD 32
+#define HPACK_HUFFMAN_EOS 256
+#define HPACK_HUFFMAN_MAXIMUM_BITS 30
+
+struct httpio_hpack_field
+{
+    size_t name_length;
+    size_t value_length;
+    // The name followed by the value
+    char data[];
+};
+
+struct httpio_hpack_static
+{
+    const char *name;
+    const char *value;
+};
+
+struct httpio_hpack_code
+{
+    uint32_t code;
+    uint8_t bits;
+};
+
+static void httpio_hpack_initialize(void);
+static int httpio_hpack_huffman_decode(const uint8_t *data, size_t length, httpio_bstream *stream);
+static size_t httpio_hpack_huffman_length(const char *const data, size_t length);
+static int httpio_hpack_huffman_encode(const char *const data, size_t length, httpio_bstream *stream);
+static int httpio_hpack_integer_decode(const uint8_t **data, const uint8_t *const end, int prefix, size_t *value);
+static int httpio_hpack_integer_encode(httpio_bstream *stream, uint8_t flags, int prefix, size_t value);
+static int httpio_hpack_string_decode(const uint8_t **data, const uint8_t *const end, httpio_bstream *scratch, const char **string, size_t *length);
+static int httpio_hpack_string_encode(httpio_bstream *stream, const char *const string, size_t length);
+static void httpio_hpack_evict(httpio_hpack *hpack, size_t size);
+static int httpio_hpack_add(httpio_hpack *hpack, const char *const name, size_t name_length, const char *const value, size_t value_length);
+static int httpio_hpack_get(const httpio_hpack *hpack, size_t index, const char **name, size_t *name_length, const char **value, size_t *value_length);
+
+// RFC 7541, Appendix A
+static const struct httpio_hpack_static STATIC_TABLE[HPACK_STATIC_COUNT] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+// RFC 7541, Appendix B, the last one is EOS
+static const struct httpio_hpack_code HUFFMAN_CODES[HPACK_HUFFMAN_EOS + 1] = {
+    {0x00001ff8, 13}, {0x007fffd8, 23}, {0x0fffffe2, 28}, {0x0fffffe3, 28},
+    {0x0fffffe4, 28}, {0x0fffffe5, 28}, {0x0fffffe6, 28}, {0x0fffffe7, 28},
+    {0x0fffffe8, 28}, {0x00ffffea, 24}, {0x3ffffffc, 30}, {0x0fffffe9, 28},
+    {0x0fffffea, 28}, {0x3ffffffd, 30}, {0x0fffffeb, 28}, {0x0fffffec, 28},
+    {0x0fffffed, 28}, {0x0fffffee, 28}, {0x0fffffef, 28}, {0x0ffffff0, 28},
+    {0x0ffffff1, 28}, {0x0ffffff2, 28}, {0x3ffffffe, 30}, {0x0ffffff3, 28},
+    {0x0ffffff4, 28}, {0x0ffffff5, 28}, {0x0ffffff6, 28}, {0x0ffffff7, 28},
+    {0x0ffffff8, 28}, {0x0ffffff9, 28}, {0x0ffffffa, 28}, {0x0ffffffb, 28},
+    {0x00000014,  6}, {0x000003f8, 10}, {0x000003f9, 10}, {0x00000ffa, 12},
+    {0x00001ff9, 13}, {0x00000015,  6}, {0x000000f8,  8}, {0x000007fa, 11},
+    {0x000003fa, 10}, {0x000003fb, 10}, {0x000000f9,  8}, {0x000007fb, 11},
+    {0x000000fa,  8}, {0x00000016,  6}, {0x00000017,  6}, {0x00000018,  6},
+    {0x00000000,  5}, {0x00000001,  5}, {0x00000002,  5}, {0x00000019,  6},
+    {0x0000001a,  6}, {0x0000001b,  6}, {0x0000001c,  6}, {0x0000001d,  6},
+    {0x0000001e,  6}, {0x0000001f,  6}, {0x0000005c,  7}, {0x000000fb,  8},
+    {0x00007ffc, 15}, {0x00000020,  6}, {0x00000ffb, 12}, {0x000003fc, 10},
+    {0x00001ffa, 13}, {0x00000021,  6}, {0x0000005d,  7}, {0x0000005e,  7},
+    {0x0000005f,  7}, {0x00000060,  7}, {0x00000061,  7}, {0x00000062,  7},
+    {0x00000063,  7}, {0x00000064,  7}, {0x00000065,  7}, {0x00000066,  7},
+    {0x00000067,  7}, {0x00000068,  7}, {0x00000069,  7}, {0x0000006a,  7},
+    {0x0000006b,  7}, {0x0000006c,  7}, {0x0000006d,  7}, {0x0000006e,  7},
+    {0x0000006f,  7}, {0x00000070,  7}, {0x00000071,  7}, {0x00000072,  7},
+    {0x000000fc,  8}, {0x00000073,  7}, {0x000000fd,  8}, {0x00001ffb, 13},
+    {0x0007fff0, 19}, {0x00001ffc, 13}, {0x00003ffc, 14}, {0x00000022,  6},
+    {0x00007ffd, 15}, {0x00000003,  5}, {0x00000023,  6}, {0x00000004,  5},
+    {0x00000024,  6}, {0x00000005,  5}, {0x00000025,  6}, {0x00000026,  6},
+    {0x00000027,  6}, {0x00000006,  5}, {0x00000074,  7}, {0x00000075,  7},
+    {0x00000028,  6}, {0x00000029,  6}, {0x0000002a,  6}, {0x00000007,  5},
+    {0x0000002b,  6}, {0x00000076,  7}, {0x0000002c,  6}, {0x00000008,  5},
+    {0x00000009,  5}, {0x0000002d,  6}, {0x00000077,  7}, {0x00000078,  7},
+    {0x00000079,  7}, {0x0000007a,  7}, {0x0000007b,  7}, {0x00007ffe, 15},
+    {0x000007fc, 11}, {0x00003ffd, 14}, {0x00001ffd, 13}, {0x0ffffffc, 28},
+    {0x000fffe6, 20}, {0x003fffd2, 22}, {0x000fffe7, 20}, {0x000fffe8, 20},
+    {0x003fffd3, 22}, {0x003fffd4, 22}, {0x003fffd5, 22}, {0x007fffd9, 23},
+    {0x003fffd6, 22}, {0x007fffda, 23}, {0x007fffdb, 23}, {0x007fffdc, 23},
+    {0x007fffdd, 23}, {0x007fffde, 23}, {0x00ffffeb, 24}, {0x007fffdf, 23},
+    {0x00ffffec, 24}, {0x00ffffed, 24}, {0x003fffd7, 22}, {0x007fffe0, 23},
+    {0x00ffffee, 24}, {0x007fffe1, 23}, {0x007fffe2, 23}, {0x007fffe3, 23},
+    {0x007fffe4, 23}, {0x001fffdc, 21}, {0x003fffd8, 22}, {0x007fffe5, 23},
+    {0x003fffd9, 22}, {0x007fffe6, 23}, {0x007fffe7, 23}, {0x00ffffef, 24},
+    {0x003fffda, 22}, {0x001fffdd, 21}, {0x000fffe9, 20}, {0x003fffdb, 22},
+    {0x003fffdc, 22}, {0x007fffe8, 23}, {0x007fffe9, 23}, {0x001fffde, 21},
+    {0x007fffea, 23}, {0x003fffdd, 22}, {0x003fffde, 22}, {0x00fffff0, 24},
+    {0x001fffdf, 21}, {0x003fffdf, 22}, {0x007fffeb, 23}, {0x007fffec, 23},
+    {0x001fffe0, 21}, {0x001fffe1, 21}, {0x003fffe0, 22}, {0x001fffe2, 21},
+    {0x007fffed, 23}, {0x003fffe1, 22}, {0x007fffee, 23}, {0x007fffef, 23},
+    {0x000fffea, 20}, {0x003fffe2, 22}, {0x003fffe3, 22}, {0x003fffe4, 22},
+    {0x007ffff0, 23}, {0x003fffe5, 22}, {0x003fffe6, 22}, {0x007ffff1, 23},
+    {0x03ffffe0, 26}, {0x03ffffe1, 26}, {0x000fffeb, 20}, {0x0007fff1, 19},
+    {0x003fffe7, 22}, {0x007ffff2, 23}, {0x003fffe8, 22}, {0x01ffffec, 25},
+    {0x03ffffe2, 26}, {0x03ffffe3, 26}, {0x03ffffe4, 26}, {0x07ffffde, 27},
+    {0x07ffffdf, 27}, {0x03ffffe5, 26}, {0x00fffff1, 24}, {0x01ffffed, 25},
+    {0x0007fff2, 19}, {0x001fffe3, 21}, {0x03ffffe6, 26}, {0x07ffffe0, 27},
+    {0x07ffffe1, 27}, {0x03ffffe7, 26}, {0x07ffffe2, 27}, {0x00fffff2, 24},
+    {0x001fffe4, 21}, {0x001fffe5, 21}, {0x03ffffe8, 26}, {0x03ffffe9, 26},
+    {0x0ffffffd, 28}, {0x07ffffe3, 27}, {0x07ffffe4, 27}, {0x07ffffe5, 27},
+    {0x000fffec, 20}, {0x00fffff3, 24}, {0x000fffed, 20}, {0x001fffe6, 21},
+    {0x003fffe9, 22}, {0x001fffe7, 21}, {0x001fffe8, 21}, {0x007ffff3, 23},
+    {0x003fffea, 22}, {0x003fffeb, 22}, {0x01ffffee, 25}, {0x01ffffef, 25},
+    {0x00fffff4, 24}, {0x00fffff5, 24}, {0x03ffffea, 26}, {0x007ffff4, 23},
+    {0x03ffffeb, 26}, {0x07ffffe6, 27}, {0x03ffffec, 26}, {0x03ffffed, 26},
+    {0x07ffffe7, 27}, {0x07ffffe8, 27}, {0x07ffffe9, 27}, {0x07ffffea, 27},
+    {0x07ffffeb, 27}, {0x0ffffffe, 28}, {0x07ffffec, 27}, {0x07ffffed, 27},
+    {0x07ffffee, 27}, {0x07ffffef, 27}, {0x07fffff0, 27}, {0x03ffffee, 26},
+    {0x3fffffff, 30},
+};
+
+// The code is canonical, codes of the same length are consecutive
+// and in the order of their symbols
+static pthread_once_t HUFFMAN_ONCE = PTHREAD_ONCE_INIT;
+static uint32_t HUFFMAN_FIRST[HPACK_HUFFMAN_MAXIMUM_BITS + 1];
+static uint16_t HUFFMAN_COUNT[HPACK_HUFFMAN_MAXIMUM_BITS + 1];
+static uint16_t HUFFMAN_OFFSET[HPACK_HUFFMAN_MAXIMUM_BITS + 1];
+static uint16_t HUFFMAN_SYMBOLS[HPACK_HUFFMAN_EOS + 1];
+
+static void
+httpio_hpack_initialize(void)
+{
+    size_t count;
+    count = 0;
+    for (uint8_t bits = 1; bits <= HPACK_HUFFMAN_MAXIMUM_BITS; ++bits) {
+        HUFFMAN_OFFSET[bits] = count;
+        for (uint16_t symbol = 0; symbol <= HPACK_HUFFMAN_EOS; ++symbol) {
+            if (HUFFMAN_CODES[symbol].bits != bits)
+                continue;
+            if (HUFFMAN_COUNT[bits] == 0)
+                HUFFMAN_FIRST[bits] = HUFFMAN_CODES[symbol].code;
+            HUFFMAN_COUNT[bits] += 1;
+            HUFFMAN_SYMBOLS[count++] = symbol;
+        }
+    }
+}
+
+static int
+httpio_hpack_huffman_decode(const uint8_t *data, size_t length, httpio_bstream *stream)
+{
+    uint64_t bits;
+    int available;
+
+    pthread_once(&HUFFMAN_ONCE, httpio_hpack_initialize);
+    bits = 0;
+    available = 0;
+    for (size_t index = 0; index < length; ++index) {
+        bits = (bits << 8) | data[index];
+        available += 8;
+        for (int size = 5; size <= available; ++size) {
+            uint32_t code;
+            uint16_t symbol;
+            uint8_t byte;
+
+            code = (bits >> (available - size)) & ((1u << size) - 1);
+            if (code - HUFFMAN_FIRST[size] >= HUFFMAN_COUNT[size]) {
+                if (size == HPACK_HUFFMAN_MAXIMUM_BITS)
+                    return -1;
+                continue;
+            }
+            symbol = HUFFMAN_SYMBOLS[HUFFMAN_OFFSET[size] + code - HUFFMAN_FIRST[size]];
+            if (symbol == HPACK_HUFFMAN_EOS)
+                return -1;
+            byte = (uint8_t) symbol;
+            if (httpio_byte_stream_append(stream, &byte, 1) == -1)
+                return -1;
+            available -= size;
+            bits &= ((uint64_t) 1 << available) - 1;
+            // Start over with the shortest codes
+            size = 4;
+        }
+    }
+    // Padding is the most significant bits of EOS, 7 at most
+    if ((available > 7) || (bits != ((uint64_t) 1 << available) - 1))
+        return -1;
+    return 0;
+}
+
+static size_t
+httpio_hpack_huffman_length(const char *const data, size_t length)
+{
+    size_t bits;
+    bits = 0;
+    for (size_t index = 0; index < length; ++index)
+        bits += HUFFMAN_CODES[(uint8_t) data[index]].bits;
+    return (bits + 7) / 8;
+}
+
+static int
+httpio_hpack_huffman_encode(const char *const data, size_t length, httpio_bstream *stream)
+{
+    uint64_t bits;
+    int available;
+
+    bits = 0;
+    available = 0;
+    for (size_t index = 0; index < length; ++index) {
+        const struct httpio_hpack_code *code;
+        code = &HUFFMAN_CODES[(uint8_t) data[index]];
+        bits = (bits << code->bits) | code->code;
+        available += code->bits;
+        while (available >= 8) {
+            uint8_t byte;
+            available -= 8;
+            byte = (uint8_t) (bits >> available);
+            if (httpio_byte_stream_append(stream, &byte, 1) == -1)
+                return -1;
+        }
+    }
+    if (available > 0) {
+        uint8_t byte;
+        // Padded with the leading bits of EOS, all ones
+        byte = (uint8_t) ((bits << (8 - available)) | (0xFF >> available));
+        if (httpio_byte_stream_append(stream, &byte, 1) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+static int
+httpio_hpack_integer_decode(const uint8_t **data,
+                      const uint8_t *const end, int prefix, size_t *value)
+{
+    const uint8_t *next;
+    size_t mask;
+    int shift;
+
+    next = *data;
+    if (next == end)
+        return -1;
+    mask = (1u << prefix) - 1;
+    *value = *next++ & mask;
+    if (*value == mask) {
+        shift = 0;
+        do {
+            // Nothing legitimate is this large
+            if ((next == end) || (shift > 28))
+                return -1;
+            *value += (size_t) (*next & 0x7F) << shift;
+            shift += 7;
+        } while ((*next++ & 0x80) != 0);
+    }
+    *data = next;
+    return 0;
+}
+
+static int
+httpio_hpack_integer_encode(httpio_bstream *stream, uint8_t flags, int prefix, size_t value)
+{
+    uint8_t buffer[16];
+    size_t length;
+    size_t mask;
+
+    mask = (1u << prefix) - 1;
+    length = 0;
+    if (value < mask) {
+        buffer[length++] = flags | value;
+    } else {
+        buffer[length++] = flags | mask;
+        value -= mask;
+        while (value >= 0x80) {
+            buffer[length++] = (value & 0x7F) | 0x80;
+            value >>= 7;
+        }
+        buffer[length++] = value;
+    }
+    return httpio_byte_stream_append(stream, buffer, length);
+}
+
+static int
+httpio_hpack_string_decode(const uint8_t **data, const uint8_t *const end,
+                  httpio_bstream *scratch, const char **string, size_t *length)
+{
+    bool huffman;
+    size_t size;
+    size_t offset;
+
+    if (*data == end)
+        return -1;
+    huffman = ((**data & 0x80) != 0);
+    if (httpio_hpack_integer_decode(data, end, 7, &size) == -1)
+        return -1;
+    if (size > (size_t) (end - *data))
+        return -1;
+    if (huffman == false) {
+        *string = (const char *) *data;
+        *length = size;
+    } else {
+        offset = scratch->length;
+        if (httpio_hpack_huffman_decode(*data, size, scratch) == -1)
+            return -1;
+        // Resolved later, the scratch buffer might move
+        *string = NULL;
+        *length = scratch->length - offset;
+    }
+    *data += size;
+    return 0;
+}
+
+static int
+httpio_hpack_string_encode(httpio_bstream *stream, const char *const string, size_t length)
+{
+    size_t size;
+    size = httpio_hpack_huffman_length(string, length);
+    if (size < length) {
+        if (httpio_hpack_integer_encode(stream, 0x80, 7, size) == -1)
+            return -1;
+        return httpio_hpack_huffman_encode(string, length, stream);
+    }
+    if (httpio_hpack_integer_encode(stream, 0x00, 7, length) == -1)
+        return -1;
+    return httpio_byte_stream_append(stream, (const uint8_t *) string, length);
+}
+
+void
+httpio_hpack_start(httpio_hpack *hpack, size_t limit)
+{
+    hpack->entries = NULL;
+    hpack->capacity = 0;
+    hpack->first = 0;
+    hpack->count = 0;
+    hpack->size = 0;
+    hpack->maximum = limit;
+    hpack->limit = limit;
+    hpack->update = false;
+}
+
+void
+httpio_hpack_free(httpio_hpack *hpack)
+{
+    httpio_hpack_evict(hpack, 0);
+    free(hpack->entries);
+    hpack->entries = NULL;
+    hpack->capacity = 0;
+}
+
+// Drops the oldest entries until the table is no larger than `size'
+static void
+httpio_hpack_evict(httpio_hpack *hpack, size_t size)
+{
+    while ((hpack->count > 0) && (hpack->size > size)) {
+        struct httpio_hpack_field *field;
+        size_t last;
+        last = (hpack->first + hpack->count - 1) % hpack->capacity;
+        field = hpack->entries[last];
+        hpack->size -= field->name_length + field->value_length + HPACK_ENTRY_OVERHEAD;
+        hpack->count -= 1;
+        free(field);
+    }
+}
+
+static int
+httpio_hpack_add(httpio_hpack *hpack, const char *const name,
+                 size_t name_length, const char *const value, size_t value_length)
+{
+    struct httpio_hpack_field *field;
+    size_t size;
+
+    size = name_length + value_length + HPACK_ENTRY_OVERHEAD;
+    // Too large for the table, which ends up empty
+    if (size > hpack->maximum) {
+        httpio_hpack_evict(hpack, 0);
+        return 0;
+    }
+    // The name might be that of an entry about to be evicted, so
+    // it's copied first, RFC 7541 section 4.4
+    field = malloc(sizeof(*field) + name_length + value_length);
+    if (field == NULL)
+        return -1;
+    field->name_length = name_length;
+    field->value_length = value_length;
+    memcpy(field->data, name, name_length);
+    memcpy(field->data + name_length, value, value_length);
+    httpio_hpack_evict(hpack, hpack->maximum - size);
+    if (hpack->count == hpack->capacity) {
+        struct httpio_hpack_field **entries;
+        size_t capacity;
+        capacity = (hpack->capacity > 0) ? 2 * hpack->capacity : 16;
+        entries = malloc(capacity * sizeof(*entries));
+        if (entries == NULL) {
+            free(field);
+            return -1;
+        }
+        for (size_t index = 0; index < hpack->count; ++index)
+            entries[index] = hpack->entries[(hpack->first + index) % hpack->capacity];
+        free(hpack->entries);
+        hpack->entries = entries;
+        hpack->capacity = capacity;
+        hpack->first = 0;
+    }
+
+    hpack->first = (hpack->first + hpack->capacity - 1) % hpack->capacity;
+    hpack->entries[hpack->first] = field;
+    hpack->count += 1;
+    hpack->size += size;
+    return 0;
+}
+
+static int
+httpio_hpack_get(const httpio_hpack *hpack, size_t index,
+      const char **name, size_t *name_length, const char **value, size_t *value_length)
+{
+    const struct httpio_hpack_field *field;
+    if (index == 0)
+        return -1;
+    if (index <= HPACK_STATIC_COUNT) {
+        *name = STATIC_TABLE[index - 1].name;
+        *name_length = strlen(*name);
+        *value = STATIC_TABLE[index - 1].value;
+        *value_length = strlen(*value);
+        return 0;
+    }
+    index -= HPACK_STATIC_COUNT + 1;
+    if (index >= hpack->count)
+        return -1;
+    field = hpack->entries[(hpack->first + index) % hpack->capacity];
+    *name = field->data;
+    *name_length = field->name_length;
+    *value = field->data + field->name_length;
+    *value_length = field->value_length;
+    return 0;
+}
+
+void
+httpio_hpack_set_limit(httpio_hpack *hpack, size_t limit)
+{
+    size_t maximum;
+    // There's no point in a larger table than the default
+    maximum = (limit < HTTPIO_HPACK_DEFAULT_TABLE_SIZE) ? limit : HTTPIO_HPACK_DEFAULT_TABLE_SIZE;
+    hpack->limit = limit;
+    if (maximum == hpack->maximum)
+        return;
+    hpack->maximum = maximum;
+    hpack->update = true;
+    httpio_hpack_evict(hpack, maximum);
+}
+
+int
+httpio_hpack_decode(httpio_hpack *hpack, const uint8_t *const block,
+                        size_t length, httpio_hpack_handler handler, void *data)
+{
+    httpio_bstream scratch;
+    const uint8_t *next;
+    const uint8_t *end;
+    bool fields;
+
+    scratch.data = NULL;
+    scratch.capacity = 0;
+    scratch.length = 0;
+    fields = false;
+    end = block + length;
+    for (next = block; next < end;) {
+        const char *name;
+        const char *value;
+        size_t name_length;
+        size_t value_length;
+        size_t index;
+        uint8_t byte;
+        int prefix;
+
+        byte = *next;
+        if ((byte & 0x80) != 0) {
+            // Indexed field
+            if (httpio_hpack_integer_decode(&next, end, 7, &index) == -1)
+                goto error;
+            if (httpio_hpack_get(hpack, index, &name, &name_length, &value, &value_length) == -1)
+                goto error;
+            fields = true;
+            if (handler(name, name_length, value, value_length, data) != 0)
+                goto error;
+            continue;
+        }
+        if ((byte & 0xE0) == 0x20) {
+            // Dynamic table size update, only before any field
+            if ((fields == true) || (httpio_hpack_integer_decode(&next, end, 5, &index) == -1))
+                goto error;
+            if (index > hpack->limit)
+                goto error;
+            hpack->maximum = index;
+            httpio_hpack_evict(hpack, index);
+            continue;
+        }
+        // Literals, indexed or not
+        prefix = ((byte & 0xC0) == 0x40) ? 6 : 4;
+        if (httpio_hpack_integer_decode(&next, end, prefix, &index) == -1)
+            goto error;
+        scratch.length = 0;
+        if (index > 0) {
+            if (httpio_hpack_get(hpack, index, &name, &name_length, &value, &value_length) == -1)
+                goto error;
+        } else if (httpio_hpack_string_decode(&next, end, &scratch, &name, &name_length) == -1) {
+            goto error;
+        }
+        if (httpio_hpack_string_decode(&next, end, &scratch, &value, &value_length) == -1)
+            goto error;
+        // Huffman decoded strings are in the scratch buffer, the
+        // name first when both are
+        if (scratch.data == NULL)
+            scratch.data = (uint8_t *) "";
+        if (value == NULL)
+            value = (const char *) scratch.data + scratch.length - value_length;
+        if (name == NULL)
+            name = (const char *) scratch.data;
+        fields = true;
+        if (handler(name, name_length, value, value_length, data) != 0)
+            goto error;
+        if ((prefix == 6) && (httpio_hpack_add(hpack, name, name_length, value, value_length) == -1))
+            goto error;
+        if (scratch.capacity == 0)
+            scratch.data = NULL;
+    }
+    httpio_byte_stream_free(&scratch);
+    return 0;
+error:
+    httpio_byte_stream_free(&scratch);
+    return -1;
+}
+
+int
+httpio_hpack_encode_start(httpio_hpack *hpack, httpio_bstream *stream)
+{
+    if (hpack->update == false)
+        return 0;
+    hpack->update = false;
+    return httpio_hpack_integer_encode(stream, 0x20, 5, hpack->maximum);
+}
+
+int
+httpio_hpack_encode(httpio_hpack *hpack, const char *const name,
+       size_t name_length, const char *const value, size_t value_length, httpio_bstream *stream)
+{
+    size_t named;
+    bool sensitive;
+
+    named = 0;
+    for (size_t index = 1; index <= HPACK_STATIC_COUNT + hpack->count; ++index) {
+        const char *entry_name;
+        const char *entry_value;
+        size_t entry_name_length;
+        size_t entry_value_length;
+
+        httpio_hpack_get(hpack, index, &entry_name, &entry_name_length, &entry_value, &entry_value_length);
+        if ((entry_name_length != name_length) || (memcmp(entry_name, name, name_length) != 0))
+            continue;
+        if ((entry_value_length == value_length) && (memcmp(entry_value, value, value_length) == 0))
+            return httpio_hpack_integer_encode(stream, 0x80, 7, index);
+        if (named == 0)
+            named = index;
+    }
+    // Credentials never go in a table, neither here nor on proxies
+    sensitive = ((name_length == 13) && (memcmp(name, "authorization", 13) == 0)) ||
+                   ((name_length == 19) && (memcmp(name, "proxy-authorization", 19) == 0));
+    if (sensitive == true) {
+        if (httpio_hpack_integer_encode(stream, 0x10, 4, named) == -1)
+            return -1;
+    } else if (name_length + value_length + HPACK_ENTRY_OVERHEAD <= hpack->maximum) {
+        if (httpio_hpack_integer_encode(stream, 0x40, 6, named) == -1)
+            return -1;
+        if (httpio_hpack_add(hpack, name, name_length, value, value_length) == -1)
+            return -1;
+    } else if (httpio_hpack_integer_encode(stream, 0x00, 4, named) == -1) {
+        return -1;
+    }
+    if ((named == 0) && (httpio_hpack_string_encode(stream, name, name_length) == -1))
+        return -1;
+    return httpio_hpack_string_encode(stream, value, value_length);
+}
@@ -0,0 +1,255 @@
+#include <http-pipeline.h>
+
+#include <string.h>
+
+#define PIPELINE_QUEUE_DEFAULT_SIZE 16
+// Requests that go out in a single write
+#define PIPELINE_VECTOR_COUNT 16
+
+struct httpio_pipeline_entry
+{
+    char *data;
+    size_t length;
+    char method[16];
+    bool idempotent;
+    size_t retries;
+};
+
+// A ring of queued requests, the oldest `sent' ones are
+// waiting for their responses
+struct httpio_pipeline
+{
+    struct httpio_pipeline_entry *entries;
+    size_t capacity;
+    size_t first;
+    size_t count;
+    size_t sent;
+    size_t depth;
+};
+
+static struct httpio_pipeline *httpio_pipeline_create(size_t depth);
+static void httpio_pipeline_free(struct httpio_pipeline *pipeline);
+static struct httpio_pipeline_entry *httpio_pipeline_entry(struct httpio_pipeline *pipeline, size_t index);
+static void httpio_pipeline_pop(struct httpio_pipeline *pipeline);
+static int httpio_pipeline_flush(struct httpio *link, struct httpio_pipeline *pipeline);
+static int httpio_pipeline_recover(struct httpio *link, struct httpio_pipeline *pipeline);
+
+static const char *IDEMPOTENT_METHODS[] = {
+    "GET", "HEAD", "OPTIONS", "TRACE", "PUT", "DELETE"
+};
+
+static struct httpio_pipeline *
+httpio_pipeline_create(size_t depth)
+{
+    struct httpio_pipeline *pipeline;
+    pipeline = malloc(sizeof(*pipeline));
+    if (pipeline == NULL)
+        return NULL;
+    pipeline->entries = malloc(PIPELINE_QUEUE_DEFAULT_SIZE * sizeof(*pipeline->entries));
+    if (pipeline->entries == NULL) {
+        free(pipeline);
+        return NULL;
+    }
+    pipeline->capacity = PIPELINE_QUEUE_DEFAULT_SIZE;
+    pipeline->first = 0;
+    pipeline->count = 0;
+    pipeline->sent = 0;
+    pipeline->depth = depth;
+    return pipeline;
+}
+
+static void
+httpio_pipeline_free(struct httpio_pipeline *pipeline)
+{
+    if (pipeline == NULL)
+        return;
+    while (pipeline->count > 0)
+        httpio_pipeline_pop(pipeline);
+    free(pipeline->entries);
+    free(pipeline);
+}
+
+static struct httpio_pipeline_entry *
+httpio_pipeline_entry(struct httpio_pipeline *pipeline, size_t index)
+{
+    return &pipeline->entries[(pipeline->first + index) % pipeline->capacity];
+}
+
+static void
+httpio_pipeline_pop(struct httpio_pipeline *pipeline)
+{
+    struct httpio_pipeline_entry *entry;
+    entry = httpio_pipeline_entry(pipeline, 0);
+    free(entry->data);
+
+    pipeline->first = (pipeline->first + 1) % pipeline->capacity;
+    pipeline->count -= 1;
+    if (pipeline->sent > 0)
+        pipeline->sent -= 1;
+}
+
+// Sends what the depth allows, as few writes as possible
+static int
+httpio_pipeline_flush(struct httpio *link, struct httpio_pipeline *pipeline)
+{
+    while ((pipeline->sent < pipeline->count) && (pipeline->sent < pipeline->depth)) {
+        struct iovec vector[PIPELINE_VECTOR_COUNT];
+        size_t count;
+        size_t index;
+
+        count = 0;
+        for (index = pipeline->sent; (index < pipeline->count) &&
+                  (index < pipeline->depth) && (count < countof(vector)); ++index) {
+            struct httpio_pipeline_entry *entry;
+            entry = httpio_pipeline_entry(pipeline, index);
+            // Anything not idempotent goes alone, after every
+            // response before it arrived
+            if ((index > 0) && ((entry->idempotent == false) ||
+                        (httpio_pipeline_entry(pipeline, index - 1)->idempotent == false)))
+                break;
+            vector[count].iov_base = entry->data;
+            vector[count++].iov_len = entry->length;
+        }
+        if (count == 0)
+            break;
+        if (httpio_writev(link, vector, count) == -1)
+            return -1;
+        pipeline->sent += count;
+    }
+    return 0;
+}
+
+// Whatever was sent and not answered is lost with the old connection
+static int
+httpio_pipeline_recover(struct httpio *link, struct httpio_pipeline *pipeline)
+{
+    pipeline->sent = 0;
+    if (httpio_connection_reconnect(link) != 1)
+        return -1;
+    return 0;
+}
+
+int
+httpio_set_pipeline_depth(struct httpio *link, size_t depth)
+{
+    struct httpio_pipeline *pipeline;
+    if (link == NULL)
+        return -1;
+    pipeline = httpio_get_pipeline(link);
+    if ((pipeline != NULL) && (pipeline->count > 0))
+        return -1;
+    if (depth == 0) {
+        httpio_pipeline_free(pipeline);
+        httpio_set_pipeline(link, NULL, NULL);
+        return 0;
+    }
+    if (pipeline == NULL) {
+        pipeline = httpio_pipeline_create(depth);
+        if (pipeline == NULL)
+            return -1;
+        httpio_set_pipeline(link, pipeline, httpio_pipeline_free);
+    }
+    pipeline->depth = depth;
+    return 0;
+}
+
+int
+httpio_pipeline_send(struct httpio *link, const httpio_request *const request)
+{
+    struct httpio_pipeline_entry *entry;
+    struct httpio_pipeline *pipeline;
+    size_t length;
+    char *data;
+
+    if ((link == NULL) || (request == NULL))
+        return -1;
+    pipeline = httpio_get_pipeline(link);
+    if ((pipeline == NULL) && (httpio_set_pipeline_depth(link, HTTPIO_PIPELINE_DEFAULT_DEPTH) == -1))
+        return -1;
+    pipeline = httpio_get_pipeline(link);
+    if (pipeline->count == pipeline->capacity) {
+        struct httpio_pipeline_entry *entries;
+        entries = malloc(2 * pipeline->capacity * sizeof(*entries));
+        if (entries == NULL)
+            return -1;
+        // Unwrapped, the oldest goes first
+        for (size_t index = 0; index < pipeline->count; ++index)
+            entries[index] = *httpio_pipeline_entry(pipeline, index);
+        free(pipeline->entries);
+        pipeline->entries = entries;
+        pipeline->capacity *= 2;
+        pipeline->first = 0;
+    }
+    // Kept until it's answered, it might be sent again
+    data = httpio_request_serialize(request, &length);
+    if (data == NULL)
+        return -1;
+    entry = httpio_pipeline_entry(pipeline, pipeline->count);
+    entry->data = data;
+    entry->length = length;
+    entry->retries = 0;
+    length = strcspn(data, " ");
+    if (length >= sizeof(entry->method))
+        length = sizeof(entry->method) - 1;
+    memcpy(entry->method, data, length);
+    entry->method[length] = '\0';
+    entry->idempotent = false;
+    for (size_t index = 0; index < countof(IDEMPOTENT_METHODS); ++index) {
+        if (strcmp(entry->method, IDEMPOTENT_METHODS[index]) == 0)
+            entry->idempotent = true;
+    }
+    pipeline->count += 1;
+    // A failed write is handled when its response is read
+    httpio_pipeline_flush(link, pipeline);
+    return 0;
+}
+
+httpio_response *
+httpio_pipeline_read_response(struct httpio *link)
+{
+    struct httpio_pipeline *pipeline;
+
+    pipeline = httpio_get_pipeline(link);
+    if ((pipeline == NULL) || (pipeline->count == 0))
+        return NULL;
+    for (;;) {
+        struct httpio_pipeline_entry *entry;
+        httpio_response *response;
+
+        entry = httpio_pipeline_entry(pipeline, 0);
+        if (httpio_pipeline_flush(link, pipeline) == 0) {
+            response = httpio_read_response_to(link, entry->method);
+            if (response != NULL) {
+                httpio_pipeline_pop(pipeline);
+                // The server won't answer the rest on this connection
+                if ((httpio_is_reusable(link) == false) && (pipeline->count > 0))
+                    httpio_pipeline_recover(link, pipeline);
+                else
+                    httpio_pipeline_flush(link, pipeline);
+                return response;
+            }
+        }
+        // The connection failed, the oldest request is either sent
+        // again with the others on a new one or given up
+        entry->retries += 1;
+        if ((entry->idempotent == false) || (entry->retries > HTTPIO_PIPELINE_MAXIMUM_RETRIES)) {
+            httpio_pipeline_pop(pipeline);
+            httpio_pipeline_recover(link, pipeline);
+            return NULL;
+        }
+        if (httpio_pipeline_recover(link, pipeline) == -1) {
+            httpio_pipeline_pop(pipeline);
+            return NULL;
+        }
+    }
+}
+
+size_t
+httpio_pipeline_pending(struct httpio *link)
+{
+    struct httpio_pipeline *pipeline;
+    pipeline = httpio_get_pipeline(link);
+    if (pipeline == NULL)
+        return 0;
+    return pipeline->count;
+}
@@ -0,0 +1,233 @@
+#include <http-pool.h>
+
+#include <string.h>
+
+#include <pthread.h>
+
+struct httpio_pool_entry
+{
+    struct httpio *link;
+    // When it was returned to the pool
+    int64_t since;
+    struct httpio_pool_entry *next;
+};
+
+struct httpio_pool_host
+{
+    char *host;
+    char *service;
+    // Idle connections, the most recently used first
+    struct httpio_pool_entry *idle;
+    size_t count;
+    struct httpio_pool_host *next;
+};
+
+struct httpio_pool
+{
+    pthread_mutex_t mutex;
+    // Maximum idle connections per host
+    size_t maximum;
+    // Idle connections older than this are closed
+    int64_t timeout;
+    struct httpio_pool_host *hosts;
+};
+
+static struct httpio_pool_host *httpio_pool_find_host(httpio_pool *pool, const char *const host, const char *const service);
+static struct httpio_pool_host *httpio_pool_create_host(httpio_pool *pool, const char *const host, const char *const service);
+static void httpio_pool_entries_free(struct httpio_pool_entry *entry);
+
+httpio_pool *
+httpio_pool_create(size_t maximum, int64_t timeout)
+{
+    httpio_pool *pool;
+    pool = malloc(sizeof(*pool));
+    if (pool == NULL)
+        return NULL;
+    if (pthread_mutex_init(&pool->mutex, NULL) != 0) {
+        free(pool);
+        return NULL;
+    }
+    pool->maximum = maximum;
+    pool->timeout = timeout;
+    pool->hosts = NULL;
+    return pool;
+}
+
+static void
+httpio_pool_entries_free(struct httpio_pool_entry *entry)
+{
+    while (entry != NULL) {
+        struct httpio_pool_entry *next;
+        next = entry->next;
+        httpio_disconnect(entry->link);
+        free(entry);
+        entry = next;
+    }
+}
+
+void
+httpio_pool_free(httpio_pool *pool)
+{
+    struct httpio_pool_host *next;
+    if (pool == NULL)
+        return;
+    for (struct httpio_pool_host *item = pool->hosts; item != NULL; item = next) {
+        next = item->next;
+        httpio_pool_entries_free(item->idle);
+        free(item->service);
+        free(item->host);
+        free(item);
+    }
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool);
+}
+
+static struct httpio_pool_host *
+httpio_pool_find_host(httpio_pool *pool,
+                                const char *const host, const char *const service)
+{
+    for (struct httpio_pool_host *item = pool->hosts; item != NULL; item = item->next) {
+        if (strcasecmp(item->host, host) != 0)
+            continue;
+        if (strcmp(item->service, service) != 0)
+            continue;
+        return item;
+    }
+    return NULL;
+}
+
+static struct httpio_pool_host *
+httpio_pool_create_host(httpio_pool *pool,
+                                const char *const host, const char *const service)
+{
+    struct httpio_pool_host *item;
+    item = malloc(sizeof(*item));
+    if (item == NULL)
+        return NULL;
+    item->host = strdup(host);
+    item->service = strdup(service);
+    if ((item->host == NULL) || (item->service == NULL)) {
+        free(item->service);
+        free(item->host);
+        free(item);
+        return NULL;
+    }
+    item->idle = NULL;
+    item->count = 0;
+    item->next = pool->hosts;
+    pool->hosts = item;
+    return item;
+}
+
+struct httpio *
+httpio_pool_checkout(httpio_pool *pool, const char *const host, const char *const service)
+{
+    struct httpio_pool_host *item;
+    struct httpio_pool_entry *entry;
+    struct httpio *link;
+    int64_t since;
+    int64_t now;
+
+    if ((host == NULL) || (service == NULL))
+        return NULL;
+    if (pool == NULL)
+        return httpio_connect(host, service);
+    for (;;) {
+        now = httpio_monotonic_time();
+        entry = NULL;
+        pthread_mutex_lock(&pool->mutex);
+        item = httpio_pool_find_host(pool, host, service);
+        if ((item != NULL) && (item->idle != NULL)) {
+            entry = item->idle;
+            item->idle = entry->next;
+            item->count -= 1;
+        }
+        pthread_mutex_unlock(&pool->mutex);
+        if (entry == NULL)
+            break;
+        link = entry->link;
+        since = entry->since;
+        free(entry);
+        // Probe outside the lock, it's a syscall
+        if ((now - since < pool->timeout) && (httpio_is_alive(link) == true))
+            return link;
+        httpio_disconnect(link);
+    }
+    return httpio_connect(host, service);
+}
+
+void
+httpio_pool_checkin(httpio_pool *pool, struct httpio *link)
+{
+    struct httpio_pool_host *item;
+    struct httpio_pool_entry *entry;
+    if (link == NULL)
+        return;
+    // Only a connection sitting at a message boundary can be reused
+    if ((pool == NULL) || (httpio_is_reusable(link) == false) || (httpio_is_alive(link) == false))
+        goto discard;
+    // Checkouts expect the default TLS context, another one might
+    // have negotiated "h2" through ALPN
+    if (httpio_context(link) != NULL)
+        goto discard;
+    entry = malloc(sizeof(*entry));
+    if (entry == NULL)
+        goto discard;
+    entry->link = link;
+    entry->since = httpio_monotonic_time();
+
+    pthread_mutex_lock(&pool->mutex);
+    item = httpio_pool_find_host(pool, httpio_host(link), httpio_service(link));
+    if (item == NULL)
+        item = httpio_pool_create_host(pool, httpio_host(link), httpio_service(link));
+    if ((item == NULL) || (item->count >= pool->maximum)) {
+        pthread_mutex_unlock(&pool->mutex);
+        free(entry);
+        goto discard;
+    }
+    entry->next = item->idle;
+    item->idle = entry;
+    item->count += 1;
+    pthread_mutex_unlock(&pool->mutex);
+    return;
+discard:
+    httpio_disconnect(link);
+}
+
+size_t
+httpio_pool_prune(httpio_pool *pool)
+{
+    struct httpio_pool_entry *expired;
+    size_t count;
+    int64_t now;
+
+    if (pool == NULL)
+        return 0;
+    expired = NULL;
+    count = 0;
+    now = httpio_monotonic_time();
+
+    pthread_mutex_lock(&pool->mutex);
+    for (struct httpio_pool_host *item = pool->hosts; item != NULL; item = item->next) {
+        struct httpio_pool_entry **next;
+        next = &item->idle;
+        while (*next != NULL) {
+            struct httpio_pool_entry *entry;
+            entry = *next;
+            if (now - entry->since < pool->timeout) {
+                next = &entry->next;
+                continue;
+            }
+            *next = entry->next;
+            item->count -= 1;
+
+            entry->next = expired;
+            expired = entry;
+            count += 1;
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    // Close them without holding the lock
+    httpio_pool_entries_free(expired);
+    return count;
+}
@@ -84,19 +84,20 @@ httpio_post_parameters_free(httpio_postdata *parameters)
 }
 
 // TODO: make this function more generic
-static void
+static int
 httpio_post_parameters_urlencode_value(const char *const value, httpio_bstream *stream)
 {
     uint8_t plus;
     if (value == NULL)
-        return;
+        return 0;
     plus = '+';
     for (size_t i = 0; value[i] != '\0'; ++i) {
         char encoded[4];
         ssize_t length;
         switch (value[i]) {
         case ' ':
-            httpio_byte_stream_append(stream, &plus, 1);
+            if (httpio_byte_stream_append(stream, &plus, 1) == -1)
+                return -1;
             break;
         case '!':
         case '*':
@@ -129,14 +130,17 @@ httpio_post_parameters_urlencode_value(const char *const value, httpio_bstream *
         case '\\':
             length = snprintf(encoded, sizeof(encoded), "%%%02X", value[i]);
             if ((length < 0) || ((size_t) length >= sizeof(encoded)))
-                return;
-            httpio_byte_stream_append(stream, (uint8_t *) encoded, length);
+                return -1;
+            if (httpio_byte_stream_append(stream, (uint8_t *) encoded, length) == -1)
+                return -1;
             break;
         default:
-            httpio_byte_stream_append(stream, (uint8_t *) &value[i], 1);
+            if (httpio_byte_stream_append(stream, (uint8_t *) &value[i], 1) == -1)
+                return -1;
             break;
         }
     }
+    return 0;
 }
 
 char *
@@ -154,17 +158,28 @@ httpio_post_parameters_urlencoded(const httpio_postdata *const parameters)
     nul = '\0';
 
     httpio_byte_stream_start(&stream);
-    httpio_post_parameters_urlencode_value(parameters->names[0], &stream);
-    httpio_byte_stream_append(&stream, &equal, 1);
-    httpio_post_parameters_urlencode_value(parameters->values[0], &stream);
+    if (httpio_post_parameters_urlencode_value(parameters->names[0], &stream) == -1)
+        goto error;
+    if (httpio_byte_stream_append(&stream, &equal, 1) == -1)
+        goto error;
+    if (httpio_post_parameters_urlencode_value(parameters->values[0], &stream) == -1)
+        goto error;
     for (size_t i = 1; i < parameters->count; ++i) {
-        httpio_byte_stream_append(&stream, &ampersand, 1);
-        httpio_post_parameters_urlencode_value(parameters->names[i], &stream);
-        httpio_byte_stream_append(&stream, &equal, 1);
-        httpio_post_parameters_urlencode_value(parameters->values[i], &stream);
+        if (httpio_byte_stream_append(&stream, &ampersand, 1) == -1)
+            goto error;
+        if (httpio_post_parameters_urlencode_value(parameters->names[i], &stream) == -1)
+            goto error;
+        if (httpio_byte_stream_append(&stream, &equal, 1) == -1)
+            goto error;
+        if (httpio_post_parameters_urlencode_value(parameters->values[i], &stream) == -1)
+            goto error;
     }
-    httpio_byte_stream_append(&stream, &nul, 1);
+    if (httpio_byte_stream_append(&stream, &nul, 1) == -1)
+        goto error;
     return (char *) stream.data;
+error:
+    httpio_byte_stream_free(&stream);
+    return NULL;
 }
 
 void
@@ -6,18 +6,35 @@
 #include <ctype.h>
 
 #include <errno.h>
-#include <zlib.h>
 
+#include <http-arena.h>
+#include <http-chunked.h>
+#include <http-encoding.h>
+#include <http-scan.h>
+
+// Views into the header block, both are NUL terminated in place
 struct httpio_header
 {
-    char *key;
-    char *value;
+    const char *key;
+    size_t key_length;
+    const char *value;
+    size_t value_length;
+    uint32_t hash;
+    // Next header with the same key plus one, 0 ends the chain
+    uint32_t next;
 };
 
+// The list, its headers, the hash index and the header block
+// they point into are a single allocation
 struct httpio_header_list
 {
-    struct httpio_header **headers;
+    struct httpio_header *headers;
     size_t count;
+    // Open addressing, each slot holds the index of the first
+    // header with a given key plus one, 0 is an empty slot
+    uint32_t *index;
+    size_t mask;
+    char *source;
 };
 
 typedef struct httpio_status
@@ -31,6 +48,49 @@ struct httpio_body
 {
     uint8_t *data;
     size_t length;
+    // Both the body and its data live in an arena
+    bool borrowed;
+};
+
+enum httpio_body_framing
+{
+    HttpBodyNone,
+    HttpBodyContentLength,
+    HttpBodyChunked,
+    // Whatever arrives until the server closes the connection
+    HttpBodyClose
+};
+
+#define BODY_READER_MAXIMUM_STAGES 4
+
+struct httpio_decoder_stage
+{
+    const httpio_codec *codec;
+    void *state;
+    bool finished;
+    // It took some input, an empty body is not a truncated stream
+    bool started;
+    // Decoded bytes the next stage didn't take yet, the last
+    // stage writes straight to the caller's buffer
+    uint8_t *buffer;
+    size_t head;
+    size_t tail;
+};
+
+// State of a body that is read as it arrives
+struct httpio_body_reader
+{
+    enum httpio_body_framing framing;
+    // Bytes left in the body, or in the current chunk
+    int64_t remaining;
+    httpio_chunked chunked;
+    bool finished;
+    // What the connection is left as once the body ended
+    bool keep_alive;
+    // Content codings in the order they are undone, the first
+    // one reads from the receive buffer
+    struct httpio_decoder_stage stages[BODY_READER_MAXIMUM_STAGES];
+    size_t count;
 };
 
 struct httpio_response
@@ -38,6 +98,9 @@ struct httpio_response
     struct httpio_status *code;
     struct httpio_header_list *headers;
     struct httpio_body *body;
+    struct httpio_body_reader *reader;
+    // Everything but perhaps the body was allocated from it
+    httpio_arena *arena;
 };
 
 typedef struct httpio_content
@@ -47,100 +110,174 @@ typedef struct httpio_content
     ssize_t length;
 } httpio_content;
 
-static httpio_body *httpio_response_read_chunked_transfer_encoding(httpio_content *content, httpio *link);
-static httpio_body *httpio_response_read_content_length(httpio_content *content, httpio *link);
-static ssize_t httpio_content_length(const char *const source);
-static int httpio_header_list_append(httpio_header_list *list, httpio_header *header);
-static httpio_header *httpio_response_create_header(const char *const key, const char *const value);
-static int httpio_headers_compare_key(const void *const _a, const void *const _b);
-static httpio_header_list *httpio_response_parse_headers(char *source);
-static httpio_body *httpio_get_response_body(httpio_header_list *list, httpio *link);
-static httpio_body *httpio_response_body_create(const httpio_content * const content, uint8_t *body, size_t length);
-static httpio_header_list *httpio_get_response_headers(httpio *link);
-static httpio_status *httpio_get_response_code(httpio *link);
+static httpio_body *httpio_response_read_content_length(httpio_content *content, httpio *link, httpio_arena *arena);
+static int httpio_content_length(const httpio_header_list *list, int64_t *length);
+static bool httpio_header_list_has_token(const httpio_header_list *list, const char *const key, const char *const token);
+static bool httpio_transfer_chunked(const httpio_header_list *list);
+static int httpio_body_framing(const httpio_header_list *list, int status, const char *const method, enum httpio_body_framing *framing, int64_t *length);
+static bool httpio_response_keep_alive(const httpio_header_list *list, const httpio_status *const code);
+static int httpio_scan_status(const uint8_t *const line, size_t length);
+static uint32_t httpio_header_hash(const char *const key, size_t length);
+static const httpio_header *httpio_header_list_lookup(const httpio_header_list *list, const char *const key, size_t length);
+static void httpio_header_list_index(httpio_header_list *list);
+static httpio_header_list *httpio_response_parse_headers(const uint8_t *const data, size_t length, const httpio_scanner *const scanner, httpio_arena *arena);
+static httpio_body *httpio_get_response_body(httpio_header_list *list, const httpio_status *const code, const char *const method, httpio *link, httpio_arena *arena, bool *failed);
+static httpio_body *httpio_response_body_create(const httpio_content * const content, uint8_t *body, size_t length, httpio_arena *arena);
+static int httpio_get_response_head(httpio *link, httpio_arena *arena, httpio_status **code, httpio_header_list **list);
 static void httpio_response_headers_free(httpio_header_list *list);
 static void httpio_response_code_free(httpio_status *code);
 static void httpio_response_body_free(httpio_body *body);
-static uint8_t *httpio_response_body_gunzip(uint8_t *data, size_t *length);
-
-enum httpio_readline_state {
-    DoneReadingLine,
-    ExpectingFormFeed,
-    ExpectingNewLine
-};
-
-static int
-httpio_header_list_append(httpio_header_list *list, httpio_header *header)
+static struct httpio_body_reader *httpio_body_reader_create(const httpio_header_list *const list, const httpio_status *const code, const char *const method, httpio *link);
+static void httpio_body_reader_finish(struct httpio_body_reader *reader, httpio *link);
+static void httpio_body_reader_release(struct httpio_body_reader *reader);
+static void httpio_body_reader_free(struct httpio_body_reader *reader);
+static int64_t httpio_body_reader_frame(struct httpio_body_reader *reader, httpio *link);
+static ssize_t httpio_body_reader_next(struct httpio_body_reader *reader, httpio *link, const uint8_t **data);
+static void httpio_body_reader_advance(struct httpio_body_reader *reader, httpio *link, size_t size);
+static void httpio_body_reader_account(struct httpio_body_reader *reader, httpio *link, size_t size);
+static int httpio_body_reader_set_encoding(struct httpio_body_reader *reader, const httpio_header_list *list);
+static ssize_t httpio_body_reader_decode(struct httpio_body_reader *reader, httpio *link, size_t index, uint8_t *buffer, size_t size);
+static ssize_t httpio_response_read_raw(struct httpio_body_reader *reader, httpio *link, uint8_t *buffer, size_t size);
+static size_t httpio_body_reader_size_hint(const struct httpio_body_reader *const reader, httpio *link);
+static httpio_body *httpio_response_read_decoded(httpio_content *content, struct httpio_body_reader *reader, httpio *link, httpio_arena *arena);
+static void *httpio_response_alloc(httpio_arena *arena, size_t size);
+static char *httpio_response_strdup(const char *const string, httpio_arena *arena);
+static httpio_status *httpio_response_parse_status(char *const data, httpio_arena *arena);
+static httpio_response *httpio_response_read(httpio *link, httpio_arena *arena, httpio_arena *body, const char *const method, bool *failed);
+static bool httpio_chunked_buffered(const uint8_t *const data, size_t length);
+static int httpio_response_decode_memory(const httpio_header_list *list, uint8_t **data, size_t *length);
+
+// From the arena when there is one, otherwise from the heap
+static void *
+httpio_response_alloc(httpio_arena *arena, size_t size)
 {
-    httpio_header **pointer;
-
-    pointer = realloc(list->headers, (list->count + 1) * sizeof(*pointer));
-    if (pointer == NULL)
-        return -1;
-    list->headers = pointer;
-    list->headers[list->count] = header;
-    list->count += 1;
-    return 0;
+    if (arena != NULL)
+        return httpio_arena_alloc(arena, size);
+    return malloc(size);
 }
 
-static httpio_header *
-httpio_response_create_header(const char *const key, const char *const value)
+static uint32_t
+httpio_header_hash(const char *const key, size_t length)
 {
-    httpio_header *header;
+    uint32_t hash;
+    // FNV-1a over the key folded to lower case, it's ASCII
+    hash = 2166136261u;
+    for (size_t index = 0; index < length; ++index) {
+        uint8_t byte;
+        byte = (uint8_t) key[index];
+        if ((uint8_t) (byte - 'A') < 26)
+            byte |= 0x20;
+        hash = (hash ^ byte) * 16777619u;
+    }
+    return hash;
+}
 
-    header = malloc(sizeof(*header));
-    if (header == NULL)
+static const httpio_header *
+httpio_header_list_lookup(const httpio_header_list *list, const char *const key, size_t length)
+{
+    uint32_t hash;
+    size_t slot;
+    if ((list == NULL) || (key == NULL) || (list->count == 0))
         return NULL;
-    header->key = httpio_stripdup(key);
-    header->value = httpio_stripdup(value);
-
-    return header;
+    hash = httpio_header_hash(key, length);
+    for (slot = hash & list->mask; list->index[slot] != 0; slot = (slot + 1) & list->mask) {
+        const httpio_header *header;
+        header = &list->headers[list->index[slot] - 1];
+        if ((header->hash != hash) || (header->key_length != length))
+            continue;
+        if (strncasecmp(header->key, key, length) == 0)
+            return header;
+    }
+    return NULL;
 }
 
-static int
-httpio_headers_compare_key(const void *const _a, const void *const _b)
+static void
+httpio_header_list_index(httpio_header_list *list)
 {
-    httpio_header *a;
-    httpio_header *b;
-
-    a = *(httpio_header **) _a;
-    b = *(httpio_header **) _b;
-
-    return strcasecmp(a->key, b->key);
+    for (size_t index = 0; index < list->count; ++index) {
+        httpio_header *header;
+        httpio_header *first;
+        size_t slot;
+
+        header = &list->headers[index];
+        header->hash = httpio_header_hash(header->key, header->key_length);
+        header->next = 0;
+
+        first = (httpio_header *) httpio_header_list_lookup(list, header->key, header->key_length);
+        if (first != NULL) {
+            // Repeated headers are chained in the order they arrived
+            while (first->next != 0)
+                first = &list->headers[first->next - 1];
+            first->next = index + 1;
+            continue;
+        }
+        slot = header->hash & list->mask;
+        while (list->index[slot] != 0)
+            slot = (slot + 1) & list->mask;
+        list->index[slot] = index + 1;
+    }
 }
 
+// Builds the list out of the lines the scanner found in `data',
+// the start line is not part of it
 static httpio_header_list *
-httpio_response_parse_headers(char *source)
+httpio_response_parse_headers(const uint8_t *const data,
+                   size_t length, const httpio_scanner *const scanner, httpio_arena *arena)
 {
     httpio_header_list *list;
-    char *tail;
-    char *head;
-    head = source;
-    list = malloc(sizeof(*list));
+    size_t capacity;
+    size_t offset;
+    size_t slots;
+
+    capacity = (scanner->count > 0) ? scanner->count - 1 : 0;
+    offset = (capacity > 0) ? scanner->lines[1].start : length;
+    length -= offset;
+    // Keep the index at most half full
+    for (slots = 8; slots < 2 * capacity; slots *= 2)
+        ;
+    list = httpio_response_alloc(arena, sizeof(*list) + capacity *
+                       sizeof(*list->headers) + slots * sizeof(*list->index) + length + 1);
     if (list == NULL)
         return NULL;
-    memset(list, 0, sizeof(*list));
-    while ((head != NULL) && (tail = strchr(head, ':')) != NULL)
-    {
-        httpio_header *header;
-        const char *key;
-        const char *value;
+    list->headers = (struct httpio_header *) (list + 1);
+    list->index = (uint32_t *) (list->headers + capacity);
+    list->mask = slots - 1;
+    list->source = (char *) (list->index + slots);
+    list->count = 0;
 
+    memset(list->index, 0, slots * sizeof(*list->index));
+
+    memcpy(list->source, data + offset, length);
+    list->source[length] = '\0';
+
+    for (size_t index = 1; index < scanner->count; ++index) {
+        const httpio_scan_line *line;
+        httpio_header *header;
+        char *separator;
+        char *value;
+        char *tail;
+
+        line = &scanner->lines[index];
+        // Names are tokens already, only the value is trimmed
+        separator = list->source + line->colon - offset;
+        value = separator + 1;
+        tail = list->source + line->end - offset;
+        if (line->folded == true)
+            httpio_scan_unfold(value, tail - value);
+        while ((value < tail) && ((*value == ' ') || (*value == '\t')))
+            ++value;
+        while ((tail > value) && ((tail[-1] == ' ') || (tail[-1] == '\t')))
+            --tail;
+        *separator = '\0';
         *tail = '\0';
 
-        key = head;
-        value = tail + 1;
-        if (((tail = strstr(value, "\r\n")) != NULL) && ((*tail = '\0') == '\0'))
-            head = tail + 1;
-        else if ((tail = strchr(value, '\0')) != NULL)
-            head = NULL;
-        header = httpio_response_create_header(key, value);
-        if (header == NULL)
-            continue;
-        if (httpio_header_list_append(list, header) == -1)
-            free(header);
+        header = &list->headers[list->count++];
+        header->key = list->source + line->start - offset;
+        header->key_length = separator - header->key;
+        header->value = value;
+        header->value_length = tail - value;
     }
-    qsort(list->headers, list->count, sizeof(httpio_header *), httpio_headers_compare_key);
+    httpio_header_list_index(list);
     return list;
 }
 
@@ -159,7 +296,7 @@ httpio_response_code_free(httpio_status *code)
 static void
 httpio_response_body_free(httpio_body *body)
 {
-    if (body == NULL)
+    if ((body == NULL) || (body->borrowed == true))
         return;
     if (body->data != NULL)
         free(body->data);
@@ -169,24 +306,27 @@ httpio_response_body_free(httpio_body *body)
 static void
 httpio_response_headers_free(httpio_header_list *list)
 {
-    httpio_header **headers;
-    if (list == NULL)
-        return;
-    headers = list->headers;
-    if (headers == NULL)
-        return;
-    for (size_t index = 0; index < list->count; ++index)
-    {
-        free(headers[index]->value);
-        free(headers[index]->key);
-        free(headers[index]);
-    }
-    free(headers);
+    // Headers and their text were allocated with the list
     free(list);
 }
 
-httpio_status *
-httpio_response_parse_response_code(char *const data)
+static char *
+httpio_response_strdup(const char *const string, httpio_arena *arena)
+{
+    const char *head;
+    size_t length;
+    if (arena == NULL)
+        return httpio_stripdup(string);
+    // Stripped the way httpio_stripdup() does it
+    for (head = string; isspace((unsigned char) *head) != 0; ++head)
+        ;
+    for (length = strlen(head); (length > 0) && (isspace((unsigned char) head[length - 1]) != 0); --length)
+        ;
+    return httpio_arena_strndup(arena, head, length);
+}
+
+static httpio_status *
+httpio_response_parse_status(char *const data, httpio_arena *arena)
 {
     httpio_status *code;
 
@@ -196,7 +336,7 @@ httpio_response_parse_response_code(char *const data)
 
     if (data == NULL)
         return NULL;
-    code = malloc(sizeof(*code));
+    code = httpio_response_alloc(arena, sizeof(*code));
     if (code == NULL)
         return NULL;
     memset(code, 0, sizeof(*code));
@@ -218,7 +358,7 @@ httpio_response_parse_response_code(char *const data)
         switch (next)
         {
         case 0:
-            code->protocol = httpio_stripdup(head);
+            code->protocol = httpio_response_strdup(head, arena);
             break;
         case 1:
             code->value = (enum httpio_code) strtol(head, &endptr, 10);
@@ -226,7 +366,7 @@ httpio_response_parse_response_code(char *const data)
                 code->value = HTTP_INVALID_CODE;
             break;
         case 2:
-            code->message = httpio_stripdup(head);
+            code->message = httpio_response_strdup(head, arena);
             break;
         }
         *tail = last;
@@ -237,89 +377,61 @@ httpio_response_parse_response_code(char *const data)
     return code;
 }
 
-static char *
-httpio_connection_readline(httpio *link)
-{
-    httpio_bstream buffer;
-    uint8_t value;
-    enum httpio_readline_state state;
-
-    state = ExpectingFormFeed;
-
-    httpio_byte_stream_start(&buffer);
-    while (state != DoneReadingLine) {
-        if (httpio_read(link, &value, 1, DEFAULT_TIMEOUT) != 1)
-            goto invalid;
-        switch (value) {
-        case '\r':
-            if (state == ExpectingFormFeed)
-                state = ExpectingNewLine;
-            else
-                goto invalid;
-            break;
-        case '\n':
-            if (state == ExpectingNewLine)
-                state = DoneReadingLine;
-            else
-                state = ExpectingFormFeed;
-            break;
-        default:
-            httpio_byte_stream_append(&buffer, (uint8_t *) &value, 1);
-            break;
-        }
-    }
-    httpio_byte_stream_append(&buffer, (const uint8_t[]) {0}, 1);
-
-    return (char *) buffer.data;
-
-invalid:
-    httpio_byte_stream_free(&buffer);
-    return NULL;
-}
-
-static httpio_status *
-httpio_get_response_code(httpio *link)
+httpio_status *
+httpio_response_parse_response_code(char *const data)
 {
-    httpio_status *code;
-    char *line;
-    line = httpio_connection_readline(link);
-    if (line == NULL)
-        return NULL;
-    code = httpio_response_parse_response_code(line);
-    free(line);
-
-    return code;
+    return httpio_response_parse_status(data, NULL);
 }
 
-static httpio_header_list *
-httpio_get_response_headers(httpio *link)
+// The status line and the headers are scanned in one pass over
+// the receive buffer, as they arrive
+static int
+httpio_get_response_head(httpio *link,
+          httpio_arena *arena, httpio_status **code, httpio_header_list **list)
 {
-    httpio_header_list *list;
-    uint8_t value;
-    httpio_bstream buffer;
-    bool done;
-    uint8_t zero;
-
-    done = false;
-    zero = 0;
+    httpio_scanner scanner;
+    const uint8_t *data;
+    ssize_t available;
+    ssize_t length;
+    char *line;
 
-    httpio_byte_stream_start(&buffer);
-    while ((done == false) &&
-                   (httpio_read(link, &value, 1, DEFAULT_TIMEOUT) > 0))
-    {
-        httpio_byte_stream_append(&buffer, (uint8_t *) &value, 1);
-        if (value != '\n')
-            continue;
-        done = httpio_byte_stream_ends_with(&buffer, "\r\n\r\n", 4);
+    *code = NULL;
+    *list = NULL;
+    for (;;) {
+        httpio_scanner_start(&scanner);
+        available = httpio_peek(link, &data, 1, DEFAULT_TIMEOUT);
+        while ((available != -1) && ((length = httpio_scan_head(&scanner, data, available)) == 0))
+            available = httpio_peek(link, &data, available + 1, DEFAULT_TIMEOUT);
+        if ((available == -1) || (length == -1))
+            goto error;
+        line = httpio_response_alloc(arena, scanner.lines[0].end + 1);
+        if (line == NULL)
+            goto error;
+        memcpy(line, data, scanner.lines[0].end);
+        line[scanner.lines[0].end] = '\0';
+        *code = httpio_response_parse_status(line, arena);
+        if (arena == NULL)
+            free(line);
+        // It's copied, the receive buffer is reused after consuming it
+        *list = httpio_response_parse_headers(data, length, &scanner, arena);
+        httpio_consume(link, length);
+        httpio_scanner_free(&scanner);
+        if ((*code == NULL) || (*list == NULL))
+            return -1;
+        // Interim responses come before the one that answers the
+        // request, except when the protocol is switched
+        if (((*code)->value < 100) || ((*code)->value >= 200) || ((*code)->value == 101))
+            return 0;
+        if (arena == NULL) {
+            httpio_response_code_free(*code);
+            httpio_response_headers_free(*list);
+        }
+        *code = NULL;
+        *list = NULL;
     }
-    httpio_byte_stream_append(&buffer, (uint8_t *) &zero, 1);
-
-    list = NULL;
-    if (done == true)
-        list = httpio_response_parse_headers((char *) buffer.data);
-    httpio_byte_stream_free(&buffer);
-
-    return list;
+error:
+    httpio_scanner_free(&scanner);
+    return -1;
 }
 
 static bool
@@ -338,22 +450,24 @@ httpio_response_body_istext(const httpio_content *const content)
     return istext;
 }
 
+// Bodies in an arena have room for the terminator already
 static httpio_body *
 httpio_response_body_create(const httpio_content *const content,
-                                                   uint8_t *data, size_t length)
+                                    uint8_t *data, size_t length, httpio_arena *arena)
 {
     httpio_body *body;
-    body = malloc(sizeof(*body));
-    if (body == NULL)
+    body = httpio_response_alloc(arena, sizeof(*body));
+    if (body == NULL) {
+        if (arena == NULL)
+            free(data);
         return NULL;
-    if ((content->encoding != NULL) && (strstr(content->encoding, "gzip") != NULL))
-        body->data = httpio_response_body_gunzip(data, &length);
-    else
-        body->data = data;
+    }
+    body->data = data;
     body->length = length;
-    if (data != body->data)
-        free(data);
-    if (httpio_response_body_istext(content) == true) {
+    body->borrowed = (arena != NULL);
+    if (arena != NULL) {
+        body->data[body->length] = '\0';
+    } else if (httpio_response_body_istext(content) == true) {
         uint8_t *pointer;
         pointer = realloc(body->data, body->length + 1);
         if (pointer != NULL) {
@@ -369,96 +483,148 @@ httpio_response_body_create(const httpio_content *const content,
     return body;
 }
 
-static uint8_t *
-httpio_response_body_gunzip_failed(size_t *length)
+// A list of identical values is accepted, and so are repeated
+// headers that agree. Returns 0 if there's none and -1 if any
+// of them is not a valid length
+static int
+httpio_content_length(const httpio_header_list *list, int64_t *length)
 {
-    if (length != NULL)
-        *length = 0;
-    return NULL;
+    const char *value;
+    size_t position;
+    int found;
+
+    found = 0;
+    position = 0;
+    while ((value = httpio_header_list_get_next(list, "content-length", &position)) != NULL) {
+        while (*value != '\0') {
+            int64_t current;
+            size_t digits;
+
+            while ((*value == ',') || (*value == ' ') || (*value == '\t'))
+                ++value;
+            if (*value == '\0')
+                break;
+            current = 0;
+            for (digits = 0; isdigit((unsigned char) value[digits]) != 0; ++digits) {
+                if (current > (INT64_MAX - 9) / 10)
+                    return -1;
+                current = 10 * current + (value[digits] - '0');
+            }
+            value += digits;
+            while ((*value == ' ') || (*value == '\t'))
+                ++value;
+            if ((digits == 0) || ((*value != ',') && (*value != '\0')))
+                return -1;
+            if ((found == 1) && (current != *length))
+                return -1;
+            *length = current;
+            found = 1;
+        }
+    }
+    return found;
 }
 
-static uint8_t *
-httpio_response_body_gunzip(uint8_t *data, size_t *length)
+// Whether any occurrence of a comma separated list header has `token'
+static bool
+httpio_header_list_has_token(const httpio_header_list *list,
+                                const char *const key, const char *const token)
 {
-    z_stream zstream;
-    httpio_bstream stream;
-    size_t processed;
-
-    if ((data == NULL) || (length == NULL) || (*length < 10) || (data[0] != 0x1F) || (data[1] != 0x8B))
-        return httpio_response_body_gunzip_failed(length);
-
-    httpio_byte_stream_start(&stream);
-    memset(&zstream, 0, sizeof(zstream));
-
-    zstream.zalloc = Z_NULL;
-    zstream.zfree = Z_NULL;
-    zstream.opaque = Z_NULL;
-    zstream.avail_in = *length;
-    zstream.next_in = data;
-    if (inflateInit2(&zstream, 15 | 32) < 0)
-        return NULL;
-    processed = 0;
-    while (zstream.avail_out == 0) {
-        uint8_t out[0x4000];
-        size_t inflated;
-
-        memset(out, 0, sizeof(out));
-
-        zstream.avail_out = sizeof(out);
-        zstream.next_out = out;
-        switch (inflate(&zstream, Z_NO_FLUSH)) {
-        case Z_NEED_DICT:
-            fprintf(stderr, "NEED DICT\n");
-            goto error;
-        case Z_DATA_ERROR:
-            fprintf(stderr, "DATA ERROR\n");
-            goto error;
-        case Z_MEM_ERROR:
-            fprintf(stderr, "MEM ERROR\n");
-            goto error;
+    const char *value;
+    size_t position;
+    size_t size;
+
+    size = strlen(token);
+    position = 0;
+    while ((value = httpio_header_list_get_next(list, key, &position)) != NULL) {
+        while (*value != '\0') {
+            size_t length;
+            while ((*value == ',') || (isspace((unsigned char) *value) != 0))
+                ++value;
+            for (length = 0; (value[length] != '\0') && (value[length] != ',') &&
+                                     (isspace((unsigned char) value[length]) == 0); ++length)
+                ;
+            if ((length == size) && (strncasecmp(value, token, size) == 0))
+                return true;
+            value += length;
         }
-        processed += *length - zstream.avail_in;
-        *length = zstream.avail_in;
-        inflated = sizeof(out) - zstream.avail_out;
-        zstream.next_in = data + processed;
-
-        httpio_byte_stream_append(&stream, out, inflated);
     }
-    inflateEnd(&zstream);
-
-    *length = stream.length;
-    return stream.data;
+    return false;
+}
 
-error:
-    *length = 0;
+// Chunked delimits the body only as the last transfer coding
+static bool
+httpio_transfer_chunked(const httpio_header_list *list)
+{
+    const char *value;
+    const char *last;
+    size_t position;
+    size_t length;
+    size_t start;
+
+    last = NULL;
+    position = 0;
+    while ((value = httpio_header_list_get_next(list, "transfer-encoding", &position)) != NULL)
+        last = value;
+    if (last == NULL)
+        return false;
+    length = strlen(last);
+    while ((length > 0) && ((last[length - 1] == ',') || (isspace((unsigned char) last[length - 1]) != 0)))
+        --length;
+    for (start = length; (start > 0) && (last[start - 1] != ',') &&
+                                 (isspace((unsigned char) last[start - 1]) == 0); --start)
+        ;
+    return (length - start == 7) && (strncasecmp(last + start, "chunked", 7) == 0);
+}
 
-    httpio_byte_stream_free(&stream);
-    inflateEnd(&zstream);
+// RFC 7230 3.3.3 in that order: responses that never have a body,
+// chunked as the last transfer coding, a valid Content-Length and
+// otherwise whatever comes until the connection is closed
+static int
+httpio_body_framing(const httpio_header_list *list, int status,
+             const char *const method, enum httpio_body_framing *framing, int64_t *length)
+{
+    int found;
 
-    return NULL;
+    *length = 0;
+    if (((method != NULL) && (strcmp(method, "HEAD") == 0)) ||
+              ((status >= 100) && (status < 200)) || (status == 204) || (status == 304)) {
+        *framing = HttpBodyNone;
+    } else if (httpio_header_list_get(list, "transfer-encoding") != NULL) {
+        // Content-Length is ignored, it might be a smuggling attempt
+        if (httpio_transfer_chunked(list) == true)
+            *framing = HttpBodyChunked;
+        else
+            *framing = HttpBodyClose;
+    } else if ((found = httpio_content_length(list, length)) == -1) {
+        return -1;
+    } else if (found == 1) {
+        *framing = (*length > 0) ? HttpBodyContentLength : HttpBodyNone;
+    } else {
+        *framing = HttpBodyClose;
+    }
+    return 0;
 }
 
-static ssize_t
-httpio_content_length(const char *const source)
+// HTTP/1.1 keeps the connection unless told otherwise, HTTP/1.0 only
+// when asked to. A protocol switch leaves it to something else
+static bool
+httpio_response_keep_alive(const httpio_header_list *list, const httpio_status *const code)
 {
-    ssize_t length;
-    char *endptr;
-    if (source == NULL)
-        return -1;
-    length = strtol(source, &endptr, 10);
-    if (*endptr != '\0')
-        return 0;
-    return length;
+    if ((code->value == 101) || (httpio_header_list_has_token(list, "connection", "close") == true))
+        return false;
+    if ((code->protocol != NULL) && (strcmp(code->protocol, "HTTP/1.0") == 0))
+        return httpio_header_list_has_token(list, "connection", "keep-alive");
+    return true;
 }
 
 static httpio_body *
-httpio_response_read_content_length(httpio_content *content, httpio *link)
+httpio_response_read_content_length(httpio_content *content, httpio *link, httpio_arena *arena)
 {
     uint8_t *pointer;
     uint8_t *data;
     ssize_t remaining;
     // FIXME: we should not be usnig `calloc' something is wrong somewhere
-    data = malloc(content->length);
+    data = httpio_response_alloc(arena, content->length + ((arena != NULL) ? 1 : 0));
     if (data == NULL)
         return NULL;
     remaining = content->length;
@@ -475,118 +641,801 @@ httpio_response_read_content_length(httpio_content *content, httpio *link)
     if (remaining != 0)
         goto error;
 
-    return httpio_response_body_create(content, data, content->length);
+    return httpio_response_body_create(content, data, content->length, arena);
 error:
-    free(data);
+    if (arena == NULL)
+        free(data);
     return NULL;
 }
 
-static size_t
-httpio_response_body_chunked_transfer_get_chunk_length(httpio *link)
+// The link is not reusable until the body ended, `method' is that
+// of the request if it's known
+static struct httpio_body_reader *
+httpio_body_reader_create(const httpio_header_list *const list,
+                 const httpio_status *const code, const char *const method, httpio *link)
 {
-    int index;
-    size_t length;
-    char string[16] = {0};
-    bool eon;
-    char *endptr;
-    uint8_t value;
-
-    eon = false;
-    index = 0;
-    while (httpio_read(link, &value, 1, DEFAULT_TIMEOUT) != -1) {
-        if ((eon == false) && (value == ';'))
-            eon = true;
-        if ((index < 15) && (eon == false) && (value != '\r'))
-            string[index++] = value;
-        if (value == '\r') {
-            if (httpio_read(link, &value, 1, DEFAULT_TIMEOUT) == -1)
-                return -1;
-            if (value != '\n')
-                return -1;
-            string[index] = '\0';
-            length = (size_t) strtol(string, &endptr, 16);
-            if (*endptr != '\0')
+    struct httpio_body_reader *reader;
+    int64_t length;
+
+    httpio_set_reusable(link, false);
+    reader = malloc(sizeof(*reader));
+    if (reader == NULL)
+        return NULL;
+    memset(reader, 0, sizeof(*reader));
+    if (httpio_body_framing(list, code->value, method, &reader->framing, &length) == -1)
+        goto error;
+    reader->keep_alive = httpio_response_keep_alive(list, code);
+    if (reader->framing == HttpBodyChunked) {
+        httpio_chunked_start(&reader->chunked);
+    } else if (reader->framing == HttpBodyContentLength) {
+        reader->remaining = length;
+    } else if (reader->framing == HttpBodyClose) {
+        reader->keep_alive = false;
+    } else {
+        httpio_body_reader_finish(reader, link);
+        return reader;
+    }
+    if (httpio_body_reader_set_encoding(reader, list) == -1)
+        goto error;
+    return reader;
+error:
+    httpio_body_reader_free(reader);
+    return NULL;
+}
+
+static void
+httpio_body_reader_finish(struct httpio_body_reader *reader, httpio *link)
+{
+    reader->finished = true;
+    httpio_set_reusable(link, reader->keep_alive);
+}
+
+// Codings are listed in the order they were applied, the content
+// codings and then the transfer codings but chunked, which is the
+// framing. They are undone from the last one, and the body is
+// delivered as it is if any of them is unknown
+static int
+httpio_body_reader_set_encoding(struct httpio_body_reader *reader, const httpio_header_list *list)
+{
+    static const char *const KEYS[] = {"content-encoding", "transfer-encoding"};
+    const httpio_codec *codecs[BODY_READER_MAXIMUM_STAGES];
+    size_t count;
+
+    count = 0;
+    for (size_t key = 0; key < countof(KEYS); ++key) {
+        const char *encoding;
+        size_t position;
+
+        position = 0;
+        while ((encoding = httpio_header_list_get_next(list, KEYS[key], &position)) != NULL) {
+            while (*encoding != '\0') {
+                const httpio_codec *codec;
+                size_t length;
+
+                while ((*encoding == ',') || (isspace((unsigned char) *encoding) != 0))
+                    ++encoding;
+                for (length = 0; (encoding[length] != '\0') && (encoding[length] != ','); ++length)
+                    ;
+                while ((length > 0) && (isspace((unsigned char) encoding[length - 1]) != 0))
+                    --length;
+                if ((length == 0) || ((length == 8) && (strncasecmp(encoding, "identity", 8) == 0)) ||
+                                 ((length == 7) && (strncasecmp(encoding, "chunked", 7) == 0))) {
+                    encoding += length;
+                    continue;
+                }
+                codec = httpio_encoding_find(encoding, length);
+                if ((codec == NULL) || (codec->decode == NULL) || (count == countof(codecs)))
+                    return 0;
+                codecs[count++] = codec;
+                encoding += length;
+            }
+        }
+    }
+
+    for (size_t index = 0; index < count; ++index) {
+        struct httpio_decoder_stage *stage;
+        stage = &reader->stages[index];
+        stage->codec = codecs[count - index - 1];
+        stage->state = stage->codec->decoder_create();
+        if (stage->state == NULL)
+            return -1;
+        reader->count += 1;
+        if (index + 1 == count)
+            continue;
+        stage->buffer = malloc(BYTE_STREAM_DEFAULT_SIZE);
+        if (stage->buffer == NULL)
+            return -1;
+    }
+    return 0;
+}
+
+// The decoders only, for readers that live on the stack
+static void
+httpio_body_reader_release(struct httpio_body_reader *reader)
+{
+    for (size_t index = 0; index < reader->count; ++index) {
+        struct httpio_decoder_stage *stage;
+        stage = &reader->stages[index];
+        stage->codec->decoder_free(stage->state);
+        free(stage->buffer);
+    }
+}
+
+static void
+httpio_body_reader_free(struct httpio_body_reader *reader)
+{
+    if (reader == NULL)
+        return;
+    httpio_body_reader_release(reader);
+    free(reader);
+}
+
+// Consumes the framing in front of body bytes, returns how many
+// of them may follow before there's more of it, 0 at the end
+static int64_t
+httpio_body_reader_frame(struct httpio_body_reader *reader, httpio *link)
+{
+    const uint8_t *data;
+    ssize_t available;
+    if (reader->finished == true)
+        return 0;
+    while ((reader->framing == HttpBodyChunked) && (reader->remaining == 0)) {
+        ssize_t used;
+        available = httpio_peek(link, &data, 1, DEFAULT_TIMEOUT);
+        if (available == -1)
+            return -1;
+        used = httpio_chunked_parse(&reader->chunked, data, available);
+        if (used == -1)
+            return -1;
+        httpio_consume(link, used);
+        if (httpio_chunked_finished(&reader->chunked) == true) {
+            httpio_body_reader_finish(reader, link);
+            return 0;
+        }
+        if (reader->chunked.state == HttpChunkedData)
+            reader->remaining = reader->chunked.remaining;
+    }
+    if (reader->framing == HttpBodyClose)
+        return INT64_MAX;
+    return reader->remaining;
+}
+
+// Points `data' to body bytes in the receive buffer without
+// consuming them, returns 0 at the end of the body
+static ssize_t
+httpio_body_reader_next(struct httpio_body_reader *reader, httpio *link, const uint8_t **data)
+{
+    ssize_t available;
+    int64_t limit;
+    limit = httpio_body_reader_frame(reader, link);
+    if (limit <= 0)
+        return limit;
+    available = httpio_peek(link, data, 1, DEFAULT_TIMEOUT);
+    if (available == -1) {
+        // The server closing the connection is the end of it
+        if ((reader->framing == HttpBodyClose) && (httpio_at_eof(link) == true)) {
+            httpio_body_reader_finish(reader, link);
+            return 0;
+        }
+        return -1;
+    }
+    if (available > limit)
+        available = limit;
+    return available;
+}
+
+static void
+httpio_body_reader_advance(struct httpio_body_reader *reader, httpio *link, size_t size)
+{
+    httpio_consume(link, size);
+    httpio_body_reader_account(reader, link, size);
+}
+
+// For body bytes something else took from the link
+static void
+httpio_body_reader_account(struct httpio_body_reader *reader, httpio *link, size_t size)
+{
+    if (reader->framing == HttpBodyClose)
+        return;
+    reader->remaining -= size;
+    if (reader->framing == HttpBodyChunked)
+        httpio_chunked_advance(&reader->chunked, size);
+    else if ((reader->framing == HttpBodyContentLength) && (reader->remaining == 0))
+        httpio_body_reader_finish(reader, link);
+}
+
+static ssize_t
+httpio_response_read_raw(struct httpio_body_reader *reader,
+                                     httpio *link, uint8_t *buffer, size_t size)
+{
+    const uint8_t *data;
+    ssize_t available;
+    available = httpio_body_reader_next(reader, link, &data);
+    if (available <= 0)
+        return available;
+    if ((size_t) available > size)
+        available = size;
+    memcpy(buffer, data, available);
+    httpio_body_reader_advance(reader, link, available);
+    return available;
+}
+
+// Decoded output of the stage at `index', it pulls from the stage
+// before it or from the body itself as needed
+static ssize_t
+httpio_body_reader_decode(struct httpio_body_reader *reader,
+                          httpio *link, size_t index, uint8_t *buffer, size_t size)
+{
+    struct httpio_decoder_stage *stage;
+    size_t produced;
+
+    stage = &reader->stages[index];
+    produced = 0;
+    while (produced == 0) {
+        struct httpio_decoder_stage *previous;
+        const uint8_t *data;
+        ssize_t available;
+        size_t used;
+        int result;
+
+        previous = (index > 0) ? &reader->stages[index - 1] : NULL;
+        if (previous == NULL) {
+            available = httpio_body_reader_next(reader, link, &data);
+        } else {
+            if (previous->head == previous->tail) {
+                available = httpio_body_reader_decode(reader,
+                                     link, index - 1, previous->buffer, BYTE_STREAM_DEFAULT_SIZE);
+                if (available == -1)
+                    return -1;
+                previous->head = 0;
+                previous->tail = available;
+            }
+            data = previous->buffer + previous->head;
+            available = previous->tail - previous->head;
+        }
+        if (available == -1)
+            return -1;
+        // Input is consumed only as far as the decoder used it
+        used = available;
+        produced = size;
+        result = stage->codec->decode(stage->state, data, &used, buffer, &produced);
+        if (result == -1) {
+            if (stage->finished == false)
                 return -1;
-            return length;
+            // Not another stream after the one that ended
+            result = 1;
+            used = 0;
+            produced = 0;
+        }
+        if ((used > 0) || (produced > 0)) {
+            // Another stream might follow the one that ended, as
+            // zstd frames do
+            stage->finished = (result == 1);
+        } else if (result == 1) {
+            // Whatever else follows the encoded stream is ignored, but
+            // the stages before this one and the framing are read to
+            // their end so the connection is left after the body
+            stage->finished = true;
+            used = available;
         }
+        if (previous == NULL)
+            httpio_body_reader_advance(reader, link, used);
+        else
+            previous->head += used;
+        if (used > 0)
+            stage->started = true;
+        // The input ended, a stream that didn't is a truncated body
+        if ((available == 0) && (produced == 0))
+            return ((stage->finished == true) || (stage->started == false)) ? 0 : -1;
     }
-    return -1;
+    return produced;
+}
+
+// How much the decoded body will take, if it can be told
+// without waiting for it
+static size_t
+httpio_body_reader_size_hint(const struct httpio_body_reader *const reader, httpio *link)
+{
+    const uint8_t *data;
+    uint32_t size;
+    size_t length;
+
+    if (reader->framing != HttpBodyContentLength)
+        return 0;
+    length = reader->remaining;
+    if (reader->count == 0)
+        return length;
+    // Otherwise the encoded length is the best guess, decoded
+    // bodies are rarely smaller. A gzip stream ends with the
+    // uncompressed size modulo 2^32, usable when the whole
+    // compressed body is buffered already
+    if ((reader->count != 1) || (strcmp(reader->stages[0].codec->name, "gzip") != 0))
+        return length;
+    if ((length < 18) || (httpio_buffered(link) < length))
+        return length;
+    if (httpio_peek(link, &data, length, 0) == -1)
+        return length;
+    if ((data[0] != 0x1F) || (data[1] != 0x8B))
+        return length;
+    size = (uint32_t) data[length - 4] | ((uint32_t) data[length - 3] << 8) |
+                 ((uint32_t) data[length - 2] << 16) | ((uint32_t) data[length - 1] << 24);
+    // Don't trust it beyond what deflate can possibly achieve
+    if ((size < length) || (size / 1032 > length))
+        return length;
+    return size;
 }
 
 static httpio_body *
-httpio_response_read_chunked_transfer_encoding(httpio_content *content, httpio *link)
+httpio_response_read_decoded(httpio_content *content,
+                struct httpio_body_reader *reader, httpio *link, httpio_arena *arena)
 {
     httpio_bstream stream;
-    bool finish;
+    uint8_t *data;
+    size_t hint;
 
     httpio_byte_stream_start(&stream);
-    do
-    {
+    hint = httpio_body_reader_size_hint(reader, link);
+    // Room for the terminator text bodies get
+    if ((hint > 0) && (httpio_byte_stream_reserve(&stream, hint + 1) == -1))
+        goto error;
+    for (;;) {
         ssize_t length;
-        uint8_t chunk[BYTE_STREAM_DEFAULT_SIZE];
-        size_t expect;
-
-        expect = httpio_response_body_chunked_transfer_get_chunk_length(link);
-        finish = (expect == 0);
-        while (expect > 0)
-        {
-            size_t ready;
-            ready = sizeof(chunk);
-            if (ready > expect)
-                ready = expect;
-            length = httpio_read(link, chunk, ready, DEFAULT_TIMEOUT);
-            if (length < 0)
-                goto error;
-            httpio_byte_stream_append(&stream, chunk, length);
-            expect -= length;
-        }
-        httpio_read(link, chunk, 2, DEFAULT_TIMEOUT);
-    } while (finish == false);
-    return httpio_response_body_create(content, stream.data, stream.length);
+        size_t size;
+        // Decode straight into the stream, there's no need for an extra copy,
+        // and don't grow it while a reservation still has room
+        if ((stream.length == stream.capacity) &&
+                 (httpio_byte_stream_grow(&stream, BYTE_STREAM_DEFAULT_SIZE) == -1))
+            goto error;
+        size = stream.capacity - stream.length;
+        if (reader->count > 0)
+            length = httpio_body_reader_decode(reader, link, reader->count - 1, stream.data + stream.length, size);
+        else
+            length = httpio_response_read_raw(reader, link, stream.data + stream.length, size);
+        if (length == -1)
+            goto error;
+        if (length == 0)
+            break;
+        stream.length += length;
+    }
+    if (arena != NULL) {
+        // The decoded size is not known up front, move it over
+        data = httpio_arena_alloc(arena, stream.length + 1);
+        if (data == NULL)
+            goto error;
+        memcpy(data, stream.data, stream.length);
+        hint = stream.length;
+        httpio_byte_stream_free(&stream);
+        return httpio_response_body_create(content, data, hint, arena);
+    }
+    // Text bodies are resized for the terminator anyway
+    if (httpio_response_body_istext(content) == false)
+        httpio_byte_stream_shrink_to_fit(&stream);
+    return httpio_response_body_create(content, stream.data, stream.length, NULL);
 error:
     httpio_byte_stream_free(&stream);
     return NULL;
 }
 
-
 static httpio_body *
-httpio_get_response_body(httpio_header_list *list, httpio *link)
+httpio_get_response_body(httpio_header_list *list, const httpio_status *const code,
+                 const char *const method, httpio *link, httpio_arena *arena, bool *failed)
 {
+    struct httpio_body_reader *reader;
     httpio_content content;
-    const char *content_length;
-    const char *transfer_encoding;
+    httpio_body *body;
+    bool empty;
 
-    transfer_encoding = httpio_header_list_get(list, "transfer-encoding");
-    content_length = httpio_header_list_get(list, "content-length");
-    if (transfer_encoding != NULL) {
-        content.length = -1;
-    } else {
-        content.length = httpio_content_length(content_length);
-    }
+    *failed = true;
+    reader = httpio_body_reader_create(list, code, method, link);
+    if (reader == NULL)
+        return NULL;
+    content.length = -1;
+    if (reader->framing == HttpBodyContentLength)
+        content.length = reader->remaining;
     content.type = httpio_header_list_get(list, "content-type");
     content.encoding = httpio_header_list_get(list, "content-encoding");
-    if (content.length > 0) {
-        return httpio_response_read_content_length(&content, link);
-    } else if ((transfer_encoding != NULL) &&
-                              (strcasecmp(transfer_encoding, "chunked") == 0)) {
-        return httpio_response_read_chunked_transfer_encoding(&content, link);
-    }
+    // Encoded bodies are decoded while they arrive
+    empty = reader->finished;
+    if (empty == true)
+        body = NULL;
+    else if ((reader->framing == HttpBodyContentLength) && (reader->count == 0))
+        body = httpio_response_read_content_length(&content, link, arena);
+    else
+        body = httpio_response_read_decoded(&content, reader, link, arena);
+    // Read in one go, the reader didn't see the end of it
+    if ((body != NULL) && (reader->finished == false) && (reader->framing == HttpBodyContentLength) && (reader->count == 0))
+        httpio_body_reader_finish(reader, link);
+    // Even if the framing ended, an encoded stream might be cut short
+    *failed = ((body == NULL) && (empty == false));
+    // Anything left of the body would be read as the next response
+    httpio_set_reusable(link, (*failed == false) && (reader->finished == true) && (reader->keep_alive == true));
+    httpio_body_reader_free(reader);
 
+    return body;
+}
+
+httpio_response *
+httpio_read_response_head(httpio *link, const char *const method)
+{
+    httpio_response *response;
+    response = malloc(sizeof(*response));
+    if (response == NULL)
+        return NULL;
+    response->body = NULL;
+    response->headers = NULL;
+    response->reader = NULL;
+    response->arena = NULL;
+    if (httpio_get_response_head(link, NULL, &response->code, &response->headers) == -1)
+        goto error;
+    response->reader = httpio_body_reader_create(response->headers, response->code, method, link);
+    if (response->reader == NULL)
+        goto error;
+    return response;
+error:
+    httpio_response_free(response);
     return NULL;
 }
 
+ssize_t
+httpio_response_read_body(httpio_response *response,
+                                  httpio *link, uint8_t *const buffer, size_t size)
+{
+    struct httpio_body_reader *reader;
+    if ((response == NULL) || (link == NULL) || (buffer == NULL))
+        return -1;
+    reader = response->reader;
+    if (reader == NULL)
+        return -1;
+    if (size == 0)
+        return 0;
+    if (reader->count > 0)
+        return httpio_body_reader_decode(reader, link, reader->count - 1, buffer, size);
+    return httpio_response_read_raw(reader, link, buffer, size);
+}
+
+int
+httpio_response_stream_body(httpio_response *response,
+                             httpio *link, httpio_body_handler handler, void *data)
+{
+    struct httpio_body_reader *reader;
+    if ((response == NULL) || (link == NULL) || (handler == NULL))
+        return -1;
+    reader = response->reader;
+    if (reader == NULL)
+        return -1;
+    for (;;) {
+        const uint8_t *chunk;
+        uint8_t buffer[BYTE_STREAM_DEFAULT_SIZE];
+        ssize_t length;
+        if (reader->count > 0) {
+            length = httpio_body_reader_decode(reader, link, reader->count - 1, buffer, sizeof(buffer));
+            chunk = buffer;
+        } else {
+            // Straight from the receive buffer
+            length = httpio_body_reader_next(reader, link, &chunk);
+        }
+        if (length <= 0)
+            return length;
+        if (handler(chunk, length, data) != 0)
+            return -1;
+        if (reader->count == 0)
+            httpio_body_reader_advance(reader, link, length);
+    }
+}
+
 httpio_response *
-httpio_read_response(httpio *link)
+httpio_read_response_sink(httpio *link, const char *const method, httpio_sink *sink)
 {
+    struct httpio_body_reader *reader;
     httpio_response *response;
+    ssize_t length;
+    int64_t limit;
+
+    if ((link == NULL) || (sink == NULL))
+        return NULL;
     response = malloc(sizeof(*response));
     if (response == NULL)
         return NULL;
-    response->code = httpio_get_response_code(link);
-    response->headers = httpio_get_response_headers(link);
-    response->body = httpio_get_response_body(response->headers, link);
+    response->body = NULL;
+    response->headers = NULL;
+    response->reader = NULL;
+    response->arena = NULL;
+    if (httpio_get_response_head(link, NULL, &response->code, &response->headers) == -1)
+        goto error;
+    reader = httpio_body_reader_create(response->headers, response->code, method, link);
+    if (reader == NULL)
+        goto error;
+    limit = -1;
+    if ((reader->framing == HttpBodyContentLength) && (reader->count == 0))
+        limit = reader->remaining;
+    if (httpio_sink_prepare(sink, limit) == -1)
+        goto failed;
+    if (reader->count == 0) {
+        // The sink takes the bytes from the link, without
+        // copying them when it can
+        while ((limit = httpio_body_reader_frame(reader, link)) > 0) {
+            length = httpio_sink_receive(sink, link, ((uint64_t) limit < SIZE_MAX) ? (size_t) limit : SIZE_MAX);
+            if ((length == 0) && (reader->framing == HttpBodyClose)) {
+                httpio_body_reader_finish(reader, link);
+                break;
+            }
+            if (length <= 0)
+                goto failed;
+            httpio_body_reader_account(reader, link, length);
+        }
+    } else {
+        uint8_t buffer[BYTE_STREAM_DEFAULT_SIZE];
+        while ((limit = httpio_body_reader_decode(reader, link, reader->count - 1, buffer, sizeof(buffer))) > 0) {
+            if (httpio_sink_write(sink, buffer, limit) == -1)
+                goto failed;
+        }
+    }
+    if ((limit == -1) || (httpio_sink_finish(sink) == -1))
+        goto failed;
+    httpio_body_reader_free(reader);
+    return response;
+failed:
+    httpio_set_reusable(link, false);
+    httpio_body_reader_free(reader);
+error:
+    httpio_response_free(response);
+    return NULL;
+}
+
+// Whether the whole chunked body is in `data', chunk data
+// is skipped without looking at it
+static bool
+httpio_chunked_buffered(const uint8_t *const data, size_t length)
+{
+    httpio_chunked chunked;
+    size_t offset;
+
+    httpio_chunked_start(&chunked);
+    for (offset = 0; offset < length;) {
+        ssize_t used;
+        size_t size;
+
+        used = httpio_chunked_parse(&chunked, data + offset, length - offset);
+        // Reading it reports the error
+        if (used == -1)
+            return true;
+        offset += used;
+        if (httpio_chunked_finished(&chunked) == true)
+            return true;
+        if (chunked.state != HttpChunkedData)
+            continue;
+        size = length - offset;
+        if (size > chunked.remaining)
+            size = chunked.remaining;
+        httpio_chunked_advance(&chunked, size);
+        offset += size;
+    }
+    return false;
+}
+
+// The status code alone, from a status line that wasn't copied
+static int
+httpio_scan_status(const uint8_t *const line, size_t length)
+{
+    const uint8_t *space;
+    int status;
+
+    space = memchr(line, ' ', length);
+    if ((space == NULL) || (line + length - space < 4))
+        return HTTP_INVALID_CODE;
+    status = 0;
+    for (size_t index = 1; index < 4; ++index) {
+        if (isdigit(space[index]) == 0)
+            return HTTP_INVALID_CODE;
+        status = 10 * status + (space[index] - '0');
+    }
+    return status;
+}
+
+bool
+httpio_response_buffered(httpio *link)
+{
+    enum httpio_body_framing framing;
+    httpio_header_list *list;
+    httpio_scanner scanner;
+    const uint8_t *data;
+    int64_t content_length;
+    ssize_t end;
+    size_t length;
+    bool complete;
+    int status;
+
+    length = httpio_buffered(link);
+    if ((length == 0) || (httpio_peek(link, &data, length, 0) == -1))
+        return false;
+    for (;;) {
+        httpio_scanner_start(&scanner);
+        end = httpio_scan_head(&scanner, data, length);
+        // A malformed head is reported by reading it
+        if (end <= 0) {
+            httpio_scanner_free(&scanner);
+            return (end == -1);
+        }
+        status = httpio_scan_status(data, scanner.lines[0].end);
+        // Interim responses are skipped when it's read
+        if ((status < 100) || (status >= 200) || (status == 101))
+            break;
+        httpio_scanner_free(&scanner);
+        data += end;
+        length -= end;
+    }
+    list = httpio_response_parse_headers(data, end, &scanner, NULL);
+    httpio_scanner_free(&scanner);
+    if (list == NULL)
+        return false;
+    // The method isn't known here, as for httpio_read_response()
+    if (httpio_body_framing(list, status, NULL, &framing, &content_length) == -1)
+        complete = true;
+    else if (framing == HttpBodyChunked)
+        complete = httpio_chunked_buffered(data + end, length - end);
+    else if (framing == HttpBodyContentLength)
+        complete = (length - end >= (size_t) content_length);
+    else if (framing == HttpBodyClose)
+        complete = httpio_at_eof(link);
+    else
+        complete = true;
+    httpio_response_headers_free(list);
+
+    return complete;
+}
+
+static httpio_response *
+httpio_response_read(httpio *link, httpio_arena *arena,
+                       httpio_arena *body, const char *const method, bool *failed)
+{
+    httpio_response *response;
+    response = httpio_response_alloc(arena, sizeof(*response));
+    if (response == NULL)
+        return NULL;
+    response->body = NULL;
+    response->reader = NULL;
+    response->arena = arena;
+    *failed = (httpio_get_response_head(link, arena, &response->code, &response->headers) == -1);
+    if (*failed == false)
+        response->body = httpio_get_response_body(response->headers, response->code, method, link, body, failed);
+    else
+        httpio_set_reusable(link, false);
+    return response;
+}
+
+// Undoes the content codings of a body that is complete already,
+// one stage at a time over the whole of it
+static int
+httpio_response_decode_memory(const httpio_header_list *list, uint8_t **data, size_t *length)
+{
+    struct httpio_body_reader reader;
+
+    memset(&reader, 0, sizeof(reader));
+    if (httpio_body_reader_set_encoding(&reader, list) == -1)
+        goto error;
+    for (size_t index = 0; index < reader.count; ++index) {
+        struct httpio_decoder_stage *stage;
+        httpio_bstream stream;
+        size_t offset;
+
+        stage = &reader.stages[index];
+        httpio_byte_stream_start(&stream);
+        if (httpio_byte_stream_reserve(&stream, *length + 1) == -1)
+            goto error;
+        for (offset = 0; stage->finished == false;) {
+            size_t used;
+            size_t produced;
+            int result;
+
+            if ((stream.length == stream.capacity) &&
+                     (httpio_byte_stream_grow(&stream, BYTE_STREAM_DEFAULT_SIZE) == -1))
+                break;
+            used = *length - offset;
+            produced = stream.capacity - stream.length;
+            result = stage->codec->decode(stage->state,
+                                 *data + offset, &used, stream.data + stream.length, &produced);
+            if (result == -1)
+                break;
+            offset += used;
+            stream.length += produced;
+            if (result == 1)
+                stage->finished = true;
+            else if ((offset == *length) && (produced == 0))
+                break;
+        }
+        if (stage->finished == false) {
+            httpio_byte_stream_free(&stream);
+            goto error;
+        }
+        free(*data);
+        *data = stream.data;
+        *length = stream.length;
+    }
+    httpio_body_reader_release(&reader);
+    return 0;
+error:
+    httpio_body_reader_release(&reader);
+    return -1;
+}
 
+httpio_response *
+httpio_response_create(const char *const head, size_t length, uint8_t *body, size_t size)
+{
+    httpio_response *response;
+    httpio_scanner scanner;
+    httpio_content content;
+    const char *encoding;
+    char *line;
+
+    httpio_scanner_start(&scanner);
+    response = malloc(sizeof(*response));
+    if (response == NULL)
+        goto error;
+    response->code = NULL;
+    response->headers = NULL;
+    response->body = NULL;
+    response->reader = NULL;
+    response->arena = NULL;
+    if ((head == NULL) || (httpio_scan_head(&scanner, (const uint8_t *) head, length) <= 0))
+        goto error;
+    line = strndup(head, scanner.lines[0].end);
+    if (line == NULL)
+        goto error;
+    response->code = httpio_response_parse_status(line, NULL);
+    free(line);
+    response->headers = httpio_response_parse_headers((const uint8_t *) head, length, &scanner, NULL);
+    if ((response->code == NULL) || (response->headers == NULL))
+        goto error;
+    httpio_scanner_free(&scanner);
+    if (body == NULL)
+        return response;
+    encoding = httpio_header_list_get(response->headers, "content-encoding");
+    if ((encoding != NULL) && (httpio_response_decode_memory(response->headers, &body, &size) == -1))
+        goto failed;
+    content.type = httpio_header_list_get(response->headers, "content-type");
+    content.encoding = encoding;
+    content.length = size;
+    // It owns the body from now on, even if it fails
+    response->body = httpio_response_body_create(&content, body, size, NULL);
+    if (response->body == NULL) {
+        httpio_response_free(response);
+        return NULL;
+    }
     return response;
+error:
+    httpio_scanner_free(&scanner);
+failed:
+    free(body);
+    httpio_response_free(response);
+    return NULL;
+}
+
+httpio_response *
+httpio_read_response(httpio *link)
+{
+    bool failed;
+    return httpio_response_read(link, NULL, NULL, NULL, &failed);
+}
+
+httpio_response *
+httpio_read_response_to(httpio *link, const char *const method)
+{
+    httpio_response *response;
+    bool failed;
+    response = httpio_response_read(link, NULL, NULL, method, &failed);
+    if (failed == false)
+        return response;
+    httpio_response_free(response);
+    return NULL;
+}
+
+httpio_response *
+httpio_read_response_arena(httpio *link, httpio_arena *arena, bool body)
+{
+    bool failed;
+    if (arena == NULL)
+        return NULL;
+    return httpio_response_read(link, arena, (body == true) ? arena : NULL, NULL, &failed);
 }
 
 const httpio_header_list *
@@ -600,30 +1449,69 @@ httpio_response_get_headers(httpio_response *response)
 const char *
 httpio_header_list_get(const httpio_header_list *list, const char *const key)
 {
-    httpio_header **found;
-    httpio_header header;
-    httpio_header *pointer;
+    if (key == NULL)
+        return NULL;
+    return httpio_header_list_find(list, key, strlen(key), NULL);
+}
 
-    if (list == NULL)
+const char *
+httpio_header_list_find(const httpio_header_list *list,
+                            const char *const key, size_t length, size_t *size)
+{
+    const httpio_header *found;
+    found = httpio_header_list_lookup(list, key, length);
+    if (found == NULL)
         return NULL;
-    for (size_t i = 0; i < list->count; ++i) {
-        httpio_header *self;
-        self = list->headers[i];
-        if (self == NULL)
-            continue;
-    }
+    if (size != NULL)
+        *size = found->value_length;
+    return found->value;
+}
 
-    header.key = (char *) key;
-    if ((list == NULL) || (list->headers == NULL))
+const char *
+httpio_header_list_get_next(const httpio_header_list *list,
+                                  const char *const key, size_t *position)
+{
+    const httpio_header *found;
+    if ((list == NULL) || (key == NULL) || (position == NULL))
         return NULL;
-    pointer = &header;
-    found = bsearch(&pointer, list->headers, list->count,
-        sizeof(*found), httpio_headers_compare_key);
+    if (*position == 0)
+        found = httpio_header_list_lookup(list, key, strlen(key));
+    else if ((*position <= list->count) && (list->headers[*position - 1].next != 0))
+        found = &list->headers[list->headers[*position - 1].next - 1];
+    else
+        found = NULL;
     if (found == NULL)
         return NULL;
-    pointer = *found;
+    *position = (found - list->headers) + 1;
+    return found->value;
+}
 
-    return pointer->value;
+size_t
+httpio_header_list_count(const httpio_header_list *list)
+{
+    if (list == NULL)
+        return 0;
+    return list->count;
+}
+
+const char *
+httpio_header_list_key_at(const httpio_header_list *list, size_t index, size_t *length)
+{
+    if ((list == NULL) || (index >= list->count))
+        return NULL;
+    if (length != NULL)
+        *length = list->headers[index].key_length;
+    return list->headers[index].key;
+}
+
+const char *
+httpio_header_list_value_at(const httpio_header_list *list, size_t index, size_t *length)
+{
+    if ((list == NULL) || (index >= list->count))
+        return NULL;
+    if (length != NULL)
+        *length = list->headers[index].value_length;
+    return list->headers[index].value;
 }
 
 void
@@ -631,9 +1519,13 @@ httpio_response_free(httpio_response *response)
 {
     if (response == NULL)
         return;
+    httpio_response_body_free(response->body);
+    httpio_body_reader_free(response->reader);
+    // The rest goes away when the arena is reset
+    if (response->arena != NULL)
+        return;
     httpio_response_headers_free(response->headers);
     httpio_response_code_free(response->code);
-    httpio_response_body_free(response->body);
 
     free(response);
 }
@@ -660,7 +1552,15 @@ httpio_response_body_take_data(httpio_body *body)
     uint8_t *data;
     if (body == NULL)
         return NULL;
-    data = body->data;
+    if ((body->borrowed == true) && (body->data != NULL)) {
+        // The caller frees it, it can't stay in the arena
+        data = malloc(body->length + 1);
+        if (data == NULL)
+            return NULL;
+        memcpy(data, body->data, body->length + 1);
+    } else {
+        data = body->data;
+    }
     body->data = NULL;
     body->length = 0;
     return data;
@@ -689,6 +1589,8 @@ httpio_response_get_code(httpio_response *response)
 void
 httpio_response_update_cookie(char **cookie, const httpio_header_list *const list)
 {
+    const char *value;
+    size_t position;
     size_t length;
     if ((list == NULL) || (cookie == NULL))
         return;
@@ -696,19 +1598,16 @@ httpio_response_update_cookie(char **cookie, const httpio_header_list *const lis
         length = strlen(*cookie);
     else
         length = 0;
-    for (size_t i = 0; i < list->count; ++i)
+    position = 0;
+    while ((value = httpio_header_list_get_next(list, "set-cookie", &position)) != NULL)
     {
-        char *separator;
-        const httpio_header *header;
+        const char *separator;
         ptrdiff_t size;
         void *pointer;
-        header = list->headers[i];
-        if (strcasecmp(header->key, "set-cookie") != 0)
-            continue;
-        separator = strchr(header->value, ';');
+        separator = strchr(value, ';');
         if (separator == NULL)
-            separator = strchr(header->value, '\0');
-        size = (separator - header->value);
+            separator = strchr(value, '\0');
+        size = (separator - value);
 
         pointer = realloc(*cookie, length + size + 3);
         if (pointer == NULL)
@@ -722,7 +1621,7 @@ httpio_response_update_cookie(char **cookie, const httpio_header_list *const lis
         }
         (*cookie)[length + size] = '\0';
 
-        memcpy(*cookie + length, header->value, size);
+        memcpy(*cookie + length, value, size);
         length += size;
     }
 }
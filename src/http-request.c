@@ -0,0 +1,207 @@
+#include <http-request.h>
+#include <http-encoding.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#define REQUEST_HEAD_DEFAULT_SIZE 0x200
+
+struct httpio_request
+{
+    // Request line and headers, each with its line terminator
+    // but without the empty line that ends them
+    char *head;
+    size_t length;
+    size_t capacity;
+    // Belongs to the caller
+    const uint8_t *body;
+    size_t size;
+    // Otherwise the compiled in codings are advertised
+    bool accept_encoding;
+};
+
+static int httpio_request_vappend(httpio_request *request, const char *format, va_list args);
+static int httpio_request_append(httpio_request *request, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+static int
+httpio_request_vappend(httpio_request *request, const char *format, va_list args)
+{
+    for (;;) {
+        size_t available;
+        va_list copy;
+        void *pointer;
+        int length;
+
+        // Always leave room for the line terminator
+        available = request->capacity - request->length;
+        va_copy(copy, args);
+        length = vsnprintf(request->head + request->length, available, format, copy);
+        va_end(copy);
+        if (length < 0)
+            return -1;
+        if ((size_t) length + 3 <= available) {
+            memcpy(request->head + request->length + length, "\r\n", 3);
+            request->length += length + 2;
+            return 0;
+        }
+        pointer = realloc(request->head, 2 * request->capacity + length + 3);
+        if (pointer == NULL)
+            return -1;
+        request->head = pointer;
+        request->capacity = 2 * request->capacity + length + 3;
+    }
+}
+
+static int
+httpio_request_append(httpio_request *request, const char *format, ...)
+{
+    va_list args;
+    int result;
+
+    va_start(args, format);
+    result = httpio_request_vappend(request, format, args);
+    va_end(args);
+
+    return result;
+}
+
+httpio_request *
+httpio_request_create(const char *const method, const char *const path)
+{
+    httpio_request *request;
+    if ((method == NULL) || (path == NULL))
+        return NULL;
+    request = malloc(sizeof(*request));
+    if (request == NULL)
+        return NULL;
+    request->head = malloc(REQUEST_HEAD_DEFAULT_SIZE);
+    if (request->head == NULL)
+        goto error;
+    request->length = 0;
+    request->capacity = REQUEST_HEAD_DEFAULT_SIZE;
+    request->body = NULL;
+    request->size = 0;
+    request->accept_encoding = false;
+    if (httpio_request_append(request, "%s %s HTTP/1.1", method, path) == -1)
+        goto error;
+    return request;
+error:
+    httpio_request_free(request);
+    return NULL;
+}
+
+void
+httpio_request_free(httpio_request *request)
+{
+    if (request == NULL)
+        return;
+    free(request->head);
+    free(request);
+}
+
+int
+httpio_request_vadd_header(httpio_request *request, const char *format, va_list args)
+{
+    size_t length;
+    if ((request == NULL) || (format == NULL))
+        return -1;
+    length = request->length;
+    if (httpio_request_vappend(request, format, args) == -1)
+        return -1;
+    if (strncasecmp(request->head + length, "Accept-Encoding:", 16) == 0)
+        request->accept_encoding = true;
+    return 0;
+}
+
+int
+httpio_request_add_header(httpio_request *request, const char *format, ...)
+{
+    va_list args;
+    int result;
+
+    va_start(args, format);
+    result = httpio_request_vadd_header(request, format, args);
+    va_end(args);
+
+    return result;
+}
+
+int
+httpio_request_set_body(httpio_request *request, const uint8_t *const data, size_t size)
+{
+    if ((request == NULL) || ((data == NULL) && (size > 0)))
+        return -1;
+    if (request->body != NULL)
+        return -1;
+    if (httpio_request_append(request, "Content-Length: %zu", size) == -1)
+        return -1;
+    request->body = data;
+    request->size = size;
+    return 0;
+}
+
+// The pieces of the request in the order they go out
+static size_t
+httpio_request_vector(const httpio_request *const request, struct iovec vector[6])
+{
+    size_t count;
+    count = 0;
+    vector[count].iov_base = request->head;
+    vector[count++].iov_len = request->length;
+    if (request->accept_encoding == false) {
+        const char *accept;
+        accept = httpio_accept_encoding();
+        vector[count].iov_base = (void *) "Accept-Encoding: ";
+        vector[count++].iov_len = 17;
+        vector[count].iov_base = (void *) accept;
+        vector[count++].iov_len = strlen(accept);
+        vector[count].iov_base = (void *) "\r\n";
+        vector[count++].iov_len = 2;
+    }
+    vector[count].iov_base = (void *) "\r\n";
+    vector[count++].iov_len = 2;
+    if (request->size > 0) {
+        vector[count].iov_base = (void *) request->body;
+        vector[count++].iov_len = request->size;
+    }
+    return count;
+}
+
+ssize_t
+httpio_request_send(const httpio_request *const request, struct httpio *link)
+{
+    struct iovec vector[6];
+    size_t count;
+    if ((request == NULL) || (link == NULL))
+        return -1;
+    count = httpio_request_vector(request, vector);
+    return httpio_writev(link, vector, count);
+}
+
+char *
+httpio_request_serialize(const httpio_request *const request, size_t *length)
+{
+    struct iovec vector[6];
+    size_t count;
+    char *result;
+    size_t size;
+    if (request == NULL)
+        return NULL;
+    count = httpio_request_vector(request, vector);
+    size = 0;
+    for (size_t index = 0; index < count; ++index)
+        size += vector[index].iov_len;
+    result = malloc(size + 1);
+    if (result == NULL)
+        return NULL;
+    size = 0;
+    for (size_t index = 0; index < count; ++index) {
+        memcpy(result + size, vector[index].iov_base, vector[index].iov_len);
+        size += vector[index].iov_len;
+    }
+    result[size] = '\0';
+    if (length != NULL)
+        *length = size;
+    return result;
+}
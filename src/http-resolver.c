@@ -0,0 +1,377 @@
+#include <http-resolver.h>
+#include <http-util.h>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <netdb.h>
+
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdbool.h>
+
+#include <pthread.h>
+
+#define RESOLVER_BUCKET_COUNT 64
+#define RESOLVER_MAXIMUM_ADDRESSES 32
+
+struct httpio_resolver_entry
+{
+    char *host;
+    char *service;
+    // A negative entry has no addresses
+    struct sockaddr_storage addresses[RESOLVER_MAXIMUM_ADDRESSES];
+    int count;
+    // When the addresses were resolved, and when a background
+    // refresh was last started
+    int64_t fetched;
+    int64_t attempted;
+    bool refreshing;
+    struct httpio_resolver_entry *next;
+};
+
+struct httpio_resolver_refresh
+{
+    char *host;
+    char *service;
+};
+
+static pthread_mutex_t RESOLVER_MUTEX = PTHREAD_MUTEX_INITIALIZER;
+static struct httpio_resolver_entry *RESOLVER_BUCKETS[RESOLVER_BUCKET_COUNT];
+static httpio_resolver_stats RESOLVER_STATS;
+// A TTL of 0 disables the cache
+static int64_t RESOLVER_TTL = RESOLVER_DEFAULT_TTL;
+static int64_t RESOLVER_STALE_TTL = RESOLVER_DEFAULT_STALE_TTL;
+static int64_t RESOLVER_NEGATIVE_TTL = RESOLVER_DEFAULT_NEGATIVE_TTL;
+
+static int httpio_resolver_lookup(const char *const host, const char *const service, struct sockaddr_storage *list, int maximum);
+static size_t httpio_resolver_hash(const char *const host, const char *const service);
+static struct httpio_resolver_entry *httpio_resolver_find(const char *const host, const char *const service);
+static struct httpio_resolver_entry *httpio_resolver_store(const char *const host, const char *const service, const struct sockaddr_storage *list, int count, int64_t now);
+static void httpio_resolver_schedule(struct httpio_resolver_entry *entry, int64_t now);
+static void *httpio_resolver_refresh(void *data);
+static void httpio_resolver_entry_free(struct httpio_resolver_entry *entry);
+
+static int
+httpio_resolver_lookup(const char *const host,
+                      const char *const service, struct sockaddr_storage *list, int maximum)
+{
+    struct addrinfo hints;
+    struct addrinfo *information;
+    struct addrinfo *first[2];
+    struct addrinfo *next[2];
+    int result;
+    int index;
+
+    memset(&hints, 0, sizeof(hints));
+
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    // Resolve the IP, `getaddrinfo()' is thread safe. It reads
+    // the environment, so it only races with `setenv()' which
+    // no part of this library calls
+    result = getaddrinfo(host, service, &hints, &information);
+    if (result != 0)
+        return -1;
+    // Interleave the address families as RFC 8305 suggests,
+    // starting with the one `getaddrinfo()' preferred
+    first[0] = information;
+    first[1] = NULL;
+    for (struct addrinfo *item = information; item != NULL; item = item->ai_next) {
+        if (item->ai_family != information->ai_family) {
+            first[1] = item;
+            break;
+        }
+    }
+    next[0] = first[0];
+    next[1] = first[1];
+    index = 0;
+    while (index < maximum) {
+        bool found;
+        found = false;
+        for (int family = 0; ((family < 2) && (index < maximum)); ++family) {
+            struct addrinfo *item;
+            item = next[family];
+            // Skip what belongs to the other family
+            while ((item != NULL) && (item->ai_family != first[family]->ai_family))
+                item = item->ai_next;
+            if (item == NULL)
+                continue;
+            next[family] = item->ai_next;
+            found = true;
+            if ((item->ai_addr == NULL) || (item->ai_addrlen > sizeof(*list)))
+                continue;
+            if ((item->ai_family != AF_INET) && (item->ai_family != AF_INET6))
+                continue;
+            memset(&list[index], 0, sizeof(*list));
+            memcpy(&list[index++], item->ai_addr, item->ai_addrlen);
+        }
+        if (found == false)
+            break;
+    }
+    freeaddrinfo(information);
+
+    return index;
+}
+
+static size_t
+httpio_resolver_hash(const char *const host, const char *const service)
+{
+    uint32_t hash;
+    // FNV-1a, host names are case insensitive
+    hash = 2166136261u;
+    for (const char *next = host; *next != '\0'; ++next)
+        hash = (hash ^ (uint8_t) tolower((unsigned char) *next)) * 16777619u;
+    hash = (hash ^ ':') * 16777619u;
+    for (const char *next = service; *next != '\0'; ++next)
+        hash = (hash ^ (uint8_t) *next) * 16777619u;
+    return hash % RESOLVER_BUCKET_COUNT;
+}
+
+static struct httpio_resolver_entry *
+httpio_resolver_find(const char *const host, const char *const service)
+{
+    struct httpio_resolver_entry *entry;
+    entry = RESOLVER_BUCKETS[httpio_resolver_hash(host, service)];
+    for (; entry != NULL; entry = entry->next) {
+        if (strcasecmp(entry->host, host) != 0)
+            continue;
+        if (strcmp(entry->service, service) != 0)
+            continue;
+        return entry;
+    }
+    return NULL;
+}
+
+static void
+httpio_resolver_entry_free(struct httpio_resolver_entry *entry)
+{
+    free(entry->service);
+    free(entry->host);
+    free(entry);
+}
+
+static struct httpio_resolver_entry *
+httpio_resolver_store(const char *const host, const char *const service,
+                           const struct sockaddr_storage *list, int count, int64_t now)
+{
+    struct httpio_resolver_entry **next;
+    struct httpio_resolver_entry *entry;
+
+    next = &RESOLVER_BUCKETS[httpio_resolver_hash(host, service)];
+    entry = NULL;
+    // Drop whatever can't be served anymore from this bucket, so
+    // the cache only holds hosts that are in use
+    while (*next != NULL) {
+        struct httpio_resolver_entry *item;
+        int64_t lifetime;
+        item = *next;
+        if ((strcasecmp(item->host, host) == 0) && (strcmp(item->service, service) == 0)) {
+            entry = item;
+            next = &item->next;
+            continue;
+        }
+        if (item->count == 0)
+            lifetime = RESOLVER_NEGATIVE_TTL;
+        else
+            lifetime = RESOLVER_TTL + RESOLVER_STALE_TTL;
+        if ((item->refreshing == true) || (now - item->fetched < lifetime)) {
+            next = &item->next;
+            continue;
+        }
+        *next = item->next;
+        httpio_resolver_entry_free(item);
+    }
+
+    if (entry == NULL) {
+        entry = malloc(sizeof(*entry));
+        if (entry == NULL)
+            return NULL;
+        entry->host = strdup(host);
+        entry->service = strdup(service);
+        if ((entry->host == NULL) || (entry->service == NULL)) {
+            httpio_resolver_entry_free(entry);
+            return NULL;
+        }
+        entry->attempted = now;
+        entry->refreshing = false;
+        entry->next = NULL;
+        *next = entry;
+    }
+    if (count > 0)
+        memcpy(entry->addresses, list, count * sizeof(*list));
+    entry->count = count;
+    entry->fetched = now;
+    return entry;
+}
+
+static void *
+httpio_resolver_refresh(void *data)
+{
+    struct sockaddr_storage list[RESOLVER_MAXIMUM_ADDRESSES];
+    struct httpio_resolver_refresh *refresh;
+    struct httpio_resolver_entry *entry;
+    int count;
+
+    refresh = data;
+    count = httpio_resolver_lookup(refresh->host, refresh->service, list, countof(list));
+
+    pthread_mutex_lock(&RESOLVER_MUTEX);
+    // It might have been flushed in the meantime
+    entry = httpio_resolver_find(refresh->host, refresh->service);
+    if (entry != NULL) {
+        // On failure keep serving the stale addresses until they
+        // expire, it's better than nothing after a resolver blip
+        if (count > 0) {
+            memcpy(entry->addresses, list, count * sizeof(*list));
+            entry->count = count;
+            entry->fetched = httpio_monotonic_time();
+        }
+        entry->refreshing = false;
+    }
+    pthread_mutex_unlock(&RESOLVER_MUTEX);
+
+    free(refresh->service);
+    free(refresh->host);
+    free(refresh);
+    return NULL;
+}
+
+static void
+httpio_resolver_schedule(struct httpio_resolver_entry *entry, int64_t now)
+{
+    struct httpio_resolver_refresh *refresh;
+    pthread_attr_t attributes;
+    pthread_t thread;
+    int result;
+
+    // One refresh at a time, and a failed one is not retried
+    // sooner than a negative entry would be
+    if (entry->refreshing == true)
+        return;
+    if (now - entry->attempted < RESOLVER_NEGATIVE_TTL)
+        return;
+    refresh = malloc(sizeof(*refresh));
+    if (refresh == NULL)
+        return;
+    refresh->host = strdup(entry->host);
+    refresh->service = strdup(entry->service);
+    if ((refresh->host == NULL) || (refresh->service == NULL))
+        goto failed;
+    if (pthread_attr_init(&attributes) != 0)
+        goto failed;
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+    result = pthread_create(&thread, &attributes, httpio_resolver_refresh, refresh);
+    pthread_attr_destroy(&attributes);
+    if (result != 0)
+        goto failed;
+    entry->attempted = now;
+    entry->refreshing = true;
+    RESOLVER_STATS.refreshes += 1;
+    return;
+failed:
+    free(refresh->service);
+    free(refresh->host);
+    free(refresh);
+}
+
+int
+httpio_resolve(const char *const host,
+                 const char *const service, struct sockaddr_storage *list, int maximum)
+{
+    struct sockaddr_storage addresses[RESOLVER_MAXIMUM_ADDRESSES];
+    struct httpio_resolver_entry *entry;
+    int64_t now;
+    int64_t age;
+    int count;
+
+    if ((host == NULL) || (service == NULL) || (maximum <= 0))
+        return -1;
+    now = httpio_monotonic_time();
+
+    pthread_mutex_lock(&RESOLVER_MUTEX);
+    if (RESOLVER_TTL <= 0) {
+        RESOLVER_STATS.misses += 1;
+        pthread_mutex_unlock(&RESOLVER_MUTEX);
+        return httpio_resolver_lookup(host, service, list, maximum);
+    }
+    entry = httpio_resolver_find(host, service);
+    if (entry == NULL)
+        goto miss;
+    age = now - entry->fetched;
+    if (entry->count == 0) {
+        if (age >= RESOLVER_NEGATIVE_TTL)
+            goto miss;
+        RESOLVER_STATS.negative_hits += 1;
+        pthread_mutex_unlock(&RESOLVER_MUTEX);
+        return -1;
+    }
+    if (age < RESOLVER_TTL) {
+        RESOLVER_STATS.hits += 1;
+    } else if (age < RESOLVER_TTL + RESOLVER_STALE_TTL) {
+        // Serve it while a fresh list is fetched in the background
+        RESOLVER_STATS.stale_hits += 1;
+        httpio_resolver_schedule(entry, now);
+    } else {
+        goto miss;
+    }
+    count = (entry->count < maximum) ? entry->count : maximum;
+    memcpy(list, entry->addresses, count * sizeof(*list));
+    pthread_mutex_unlock(&RESOLVER_MUTEX);
+    return count;
+miss:
+    RESOLVER_STATS.misses += 1;
+    pthread_mutex_unlock(&RESOLVER_MUTEX);
+
+    // Concurrent misses for the same host all resolve it, the
+    // last one to finish wins
+    count = httpio_resolver_lookup(host, service, addresses, countof(addresses));
+    pthread_mutex_lock(&RESOLVER_MUTEX);
+    httpio_resolver_store(host, service, addresses, (count > 0) ? count : 0, httpio_monotonic_time());
+    pthread_mutex_unlock(&RESOLVER_MUTEX);
+    if (count <= 0)
+        return -1;
+    if (count > maximum)
+        count = maximum;
+    memcpy(list, addresses, count * sizeof(*list));
+    return count;
+}
+
+void
+httpio_resolver_set_ttl(int64_t ttl, int64_t stale, int64_t negative)
+{
+    pthread_mutex_lock(&RESOLVER_MUTEX);
+    RESOLVER_TTL = ttl;
+    RESOLVER_STALE_TTL = (stale < 0) ? 0 : stale;
+    RESOLVER_NEGATIVE_TTL = (negative < 0) ? 0 : negative;
+    pthread_mutex_unlock(&RESOLVER_MUTEX);
+}
+
+void
+httpio_resolver_get_stats(httpio_resolver_stats *stats)
+{
+    if (stats == NULL)
+        return;
+    pthread_mutex_lock(&RESOLVER_MUTEX);
+    memcpy(stats, &RESOLVER_STATS, sizeof(*stats));
+    pthread_mutex_unlock(&RESOLVER_MUTEX);
+}
+
+void
+httpio_resolver_flush(void)
+{
+    pthread_mutex_lock(&RESOLVER_MUTEX);
+    for (size_t index = 0; index < RESOLVER_BUCKET_COUNT; ++index) {
+        struct httpio_resolver_entry *entry;
+        entry = RESOLVER_BUCKETS[index];
+        while (entry != NULL) {
+            struct httpio_resolver_entry *next;
+            next = entry->next;
+            httpio_resolver_entry_free(entry);
+            entry = next;
+        }
+        RESOLVER_BUCKETS[index] = NULL;
+    }
+    pthread_mutex_unlock(&RESOLVER_MUTEX);
+}
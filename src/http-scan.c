@@ -0,0 +1,290 @@
+#include <http-scan.h>
+#include <http-util.h>
+
+#include <string.h>
+
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_SCAN_VECTORS 1
+#endif
+
+// Each block yields one bit per byte in 64 bit masks
+#define SCAN_BLOCK_SIZE 64
+
+typedef void (*httpio_scan_block)(const uint8_t *const data, uint64_t *newline, uint64_t *colon, uint64_t *invalid);
+
+static void httpio_scan_initialize(void);
+static void httpio_scan_block_scalar(const uint8_t *const data, size_t length, uint64_t *newline, uint64_t *colon, uint64_t *invalid);
+static void httpio_scan_block_generic(const uint8_t *const data, uint64_t *newline, uint64_t *colon, uint64_t *invalid);
+#ifdef HAVE_SCAN_VECTORS
+static void httpio_scan_block_sse42(const uint8_t *const data, uint64_t *newline, uint64_t *colon, uint64_t *invalid);
+static void httpio_scan_block_avx2(const uint8_t *const data, uint64_t *newline, uint64_t *colon, uint64_t *invalid);
+#endif
+static int httpio_scanner_add_line(httpio_scanner *scanner, size_t end);
+
+static const char TOKEN_CHARACTERS[] = "!#$%&'*+-.^_`|~"
+                                       "0123456789"
+                                       "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                                       "abcdefghijklmnopqrstuvwxyz";
+static pthread_once_t SCAN_ONCE = PTHREAD_ONCE_INIT;
+static bool TOKEN[256];
+// A byte is a token character when the entries for its low and
+// its high nibble have a bit in common, shuffles look them up
+static uint8_t TOKEN_LOW[16];
+static uint8_t TOKEN_HIGH[16];
+static httpio_scan_block SCAN_BLOCK = httpio_scan_block_generic;
+
+static void
+httpio_scan_initialize(void)
+{
+    for (size_t index = 0; TOKEN_CHARACTERS[index] != '\0'; ++index) {
+        uint8_t byte;
+        byte = (uint8_t) TOKEN_CHARACTERS[index];
+        TOKEN[byte] = true;
+        // Only 7 bit characters are tokens, 8 bits are enough
+        TOKEN_LOW[byte & 0x0F] |= 1 << (byte >> 4);
+    }
+    for (size_t index = 0; index < 8; ++index)
+        TOKEN_HIGH[index] = 1 << index;
+#ifdef HAVE_SCAN_VECTORS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") != 0)
+        SCAN_BLOCK = httpio_scan_block_avx2;
+    else if (__builtin_cpu_supports("sse4.2") != 0)
+        SCAN_BLOCK = httpio_scan_block_sse42;
+#endif
+}
+
+static void
+httpio_scan_block_scalar(const uint8_t *const data,
+               size_t length, uint64_t *newline, uint64_t *colon, uint64_t *invalid)
+{
+    *newline = 0;
+    *colon = 0;
+    *invalid = 0;
+    for (size_t index = 0; index < length; ++index) {
+        uint64_t bit;
+        bit = (uint64_t) 1 << index;
+        if (data[index] == '\n')
+            *newline |= bit;
+        else if (data[index] == ':')
+            *colon |= bit;
+        if (TOKEN[data[index]] == false)
+            *invalid |= bit;
+    }
+}
+
+static void
+httpio_scan_block_generic(const uint8_t *const data,
+                              uint64_t *newline, uint64_t *colon, uint64_t *invalid)
+{
+    httpio_scan_block_scalar(data, SCAN_BLOCK_SIZE, newline, colon, invalid);
+}
+
+#ifdef HAVE_SCAN_VECTORS
+__attribute__((target("sse4.2"))) static void
+httpio_scan_block_sse42(const uint8_t *const data,
+                              uint64_t *newline, uint64_t *colon, uint64_t *invalid)
+{
+    __m128i low;
+    __m128i high;
+    __m128i nibble;
+    __m128i zero;
+
+    low = _mm_loadu_si128((const __m128i *) TOKEN_LOW);
+    high = _mm_loadu_si128((const __m128i *) TOKEN_HIGH);
+    nibble = _mm_set1_epi8(0x0F);
+    zero = _mm_setzero_si128();
+
+    *newline = 0;
+    *colon = 0;
+    *invalid = 0;
+    for (size_t index = 0; index < SCAN_BLOCK_SIZE; index += 16) {
+        __m128i bytes;
+        __m128i class;
+        bytes = _mm_loadu_si128((const __m128i *) (data + index));
+        class = _mm_and_si128(_mm_shuffle_epi8(low, _mm_and_si128(bytes, nibble)),
+                      _mm_shuffle_epi8(high, _mm_and_si128(_mm_srli_epi16(bytes, 4), nibble)));
+        *newline |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n'))) << index;
+        *colon |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(':'))) << index;
+        *invalid |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(class, zero)) << index;
+    }
+}
+
+__attribute__((target("avx2"))) static void
+httpio_scan_block_avx2(const uint8_t *const data,
+                              uint64_t *newline, uint64_t *colon, uint64_t *invalid)
+{
+    __m256i low;
+    __m256i high;
+    __m256i nibble;
+    __m256i zero;
+
+    // Shuffles work on each 128 bit lane, both need the tables
+    low = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) TOKEN_LOW));
+    high = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) TOKEN_HIGH));
+    nibble = _mm256_set1_epi8(0x0F);
+    zero = _mm256_setzero_si256();
+
+    *newline = 0;
+    *colon = 0;
+    *invalid = 0;
+    for (size_t index = 0; index < SCAN_BLOCK_SIZE; index += 32) {
+        __m256i bytes;
+        __m256i class;
+        bytes = _mm256_loadu_si256((const __m256i *) (data + index));
+        class = _mm256_and_si256(_mm256_shuffle_epi8(low, _mm256_and_si256(bytes, nibble)),
+                      _mm256_shuffle_epi8(high, _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibble)));
+        *newline |= (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\n'))) << index;
+        *colon |= (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(':'))) << index;
+        *invalid |= (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(class, zero)) << index;
+    }
+}
+#endif
+
+void
+httpio_scanner_start(httpio_scanner *scanner)
+{
+    scanner->lines = scanner->inline_lines;
+    scanner->count = 0;
+    scanner->capacity = countof(scanner->inline_lines);
+    scanner->offset = 0;
+    scanner->start = 0;
+    scanner->colon = HTTPIO_SCAN_NONE;
+    scanner->invalid = HTTPIO_SCAN_NONE;
+}
+
+void
+httpio_scanner_free(httpio_scanner *scanner)
+{
+    if (scanner->lines != scanner->inline_lines)
+        free(scanner->lines);
+    scanner->lines = scanner->inline_lines;
+    scanner->count = 0;
+}
+
+static int
+httpio_scanner_add_line(httpio_scanner *scanner, size_t end)
+{
+    httpio_scan_line *line;
+    if (scanner->count == scanner->capacity) {
+        httpio_scan_line *lines;
+        size_t capacity;
+        capacity = 2 * scanner->capacity;
+        if (scanner->lines == scanner->inline_lines) {
+            lines = malloc(capacity * sizeof(*lines));
+            if (lines != NULL)
+                memcpy(lines, scanner->lines, scanner->count * sizeof(*lines));
+        } else {
+            lines = realloc(scanner->lines, capacity * sizeof(*lines));
+        }
+        if (lines == NULL)
+            return -1;
+        scanner->lines = lines;
+        scanner->capacity = capacity;
+    }
+    line = &scanner->lines[scanner->count++];
+    line->start = scanner->start;
+    line->colon = scanner->colon;
+    line->end = end;
+    line->folded = false;
+    return 0;
+}
+
+ssize_t
+httpio_scan_head(httpio_scanner *scanner, const uint8_t *const data, size_t length)
+{
+    size_t offset;
+
+    pthread_once(&SCAN_ONCE, httpio_scan_initialize);
+    for (offset = scanner->offset; offset < length;) {
+        uint64_t newline;
+        uint64_t colon;
+        uint64_t invalid;
+        uint64_t events;
+        size_t size;
+
+        size = length - offset;
+        if (size >= SCAN_BLOCK_SIZE) {
+            size = SCAN_BLOCK_SIZE;
+            SCAN_BLOCK(data + offset, &newline, &colon, &invalid);
+        } else {
+            httpio_scan_block_scalar(data + offset, size, &newline, &colon, &invalid);
+        }
+        // Most blocks are inside of values, nothing to do but
+        // looking for the next line then
+        events = newline;
+        if (scanner->colon == HTTPIO_SCAN_NONE)
+            events |= colon | invalid;
+        while (events != 0) {
+            uint64_t bit;
+            size_t position;
+            size_t end;
+
+            bit = events & -events;
+            position = offset + __builtin_ctzll(events);
+            events ^= bit;
+            if ((newline & bit) == 0) {
+                if ((colon & bit) != 0) {
+                    scanner->colon = position;
+                    // The rest of the line is the value
+                    events &= newline;
+                } else if (scanner->invalid == HTTPIO_SCAN_NONE) {
+                    scanner->invalid = position;
+                }
+                continue;
+            }
+            end = position;
+            if ((end > scanner->start) && (data[end - 1] == '\r'))
+                end -= 1;
+            if ((end == scanner->start) && (scanner->count > 0)) {
+                scanner->offset = position + 1;
+                return position + 1;
+            }
+            if ((scanner->count > 1) && ((data[scanner->start] == ' ') || (data[scanner->start] == '\t'))) {
+                httpio_scan_line *line;
+                // Obsolete line folding, the previous value goes on
+                line = &scanner->lines[scanner->count - 1];
+                line->end = end;
+                line->folded = true;
+            } else {
+                if (scanner->count == 0) {
+                    // The start line, it's not a field
+                    scanner->colon = HTTPIO_SCAN_NONE;
+                } else if ((scanner->colon == HTTPIO_SCAN_NONE) || (scanner->colon == scanner->start)) {
+                    return -1;
+                } else if ((scanner->invalid != HTTPIO_SCAN_NONE) && (scanner->invalid < scanner->colon)) {
+                    return -1;
+                }
+                if (httpio_scanner_add_line(scanner, end) == -1)
+                    return -1;
+            }
+            scanner->start = position + 1;
+            scanner->colon = HTTPIO_SCAN_NONE;
+            scanner->invalid = HTTPIO_SCAN_NONE;
+            // What's left of the block matters again for the next line
+            events |= (colon | invalid) & ~(bit | (bit - 1));
+        }
+        offset += size;
+    }
+    scanner->offset = offset;
+    return 0;
+}
+
+void
+httpio_scan_unfold(char *value, size_t length)
+{
+    bool fold;
+
+    // The whitespace after a line break is part of the fold too
+    fold = false;
+    for (size_t index = 0; index < length; ++index) {
+        if ((value[index] == '\r') || (value[index] == '\n'))
+            fold = true;
+        else if (value[index] != '\t')
+            fold = fold && (value[index] == ' ');
+        if (fold == true)
+            value[index] = ' ';
+    }
+}
@@ -0,0 +1,223 @@
+#include <http-sink.h>
+
+#include <string.h>
+#include <limits.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+enum httpio_sink_kind
+{
+    HttpSinkBuffer,
+    HttpSinkDescriptor,
+    HttpSinkFile
+};
+
+struct httpio_sink
+{
+    enum httpio_sink_kind kind;
+    // The caller's buffer, or the file once it's mapped
+    uint8_t *data;
+    size_t size;
+    // Body bytes so far, stored or not
+    size_t length;
+    int fd;
+    bool mapped;
+};
+
+static httpio_sink *httpio_sink_create(enum httpio_sink_kind kind);
+static ssize_t httpio_sink_receive_memory(httpio_sink *sink, struct httpio *link, size_t size);
+
+static httpio_sink *
+httpio_sink_create(enum httpio_sink_kind kind)
+{
+    httpio_sink *sink;
+    sink = malloc(sizeof(*sink));
+    if (sink == NULL)
+        return NULL;
+    sink->kind = kind;
+    sink->data = NULL;
+    sink->size = 0;
+    sink->length = 0;
+    sink->fd = -1;
+    sink->mapped = false;
+    return sink;
+}
+
+// Straight from the link into the buffer or the mapping, what
+// doesn't fit in a buffer is skipped
+static ssize_t
+httpio_sink_receive_memory(httpio_sink *sink, struct httpio *link, size_t size)
+{
+    const uint8_t *data;
+    ssize_t received;
+    size_t room;
+
+    room = (sink->length < sink->size) ? sink->size - sink->length : 0;
+    if (room > 0) {
+        if (size > room)
+            size = room;
+        if (size > INT_MAX)
+            size = INT_MAX;
+        received = httpio_read(link, sink->data + sink->length, size, DEFAULT_TIMEOUT);
+    } else if (sink->kind == HttpSinkBuffer) {
+        received = httpio_peek(link, &data, 1, DEFAULT_TIMEOUT);
+        if ((received > 0) && ((size_t) received > size))
+            received = size;
+        if (received > 0)
+            httpio_consume(link, received);
+    } else {
+        // More than Content-Length said
+        return -1;
+    }
+    if (received == -1)
+        return (httpio_at_eof(link) == true) ? 0 : -1;
+    sink->length += received;
+    return received;
+}
+
+httpio_sink *
+httpio_sink_buffer(uint8_t *buffer, size_t size)
+{
+    httpio_sink *sink;
+    if ((buffer == NULL) && (size > 0))
+        return NULL;
+    sink = httpio_sink_create(HttpSinkBuffer);
+    if (sink == NULL)
+        return NULL;
+    sink->data = buffer;
+    sink->size = size;
+    return sink;
+}
+
+httpio_sink *
+httpio_sink_descriptor(int fd)
+{
+    httpio_sink *sink;
+    if (fd == -1)
+        return NULL;
+    sink = httpio_sink_create(HttpSinkDescriptor);
+    if (sink == NULL)
+        return NULL;
+    sink->fd = fd;
+    return sink;
+}
+
+httpio_sink *
+httpio_sink_file(const char *const path)
+{
+    httpio_sink *sink;
+    if (path == NULL)
+        return NULL;
+    sink = httpio_sink_create(HttpSinkFile);
+    if (sink == NULL)
+        return NULL;
+    // Read access too, or it can't be mapped
+    sink->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (sink->fd == -1) {
+        free(sink);
+        return NULL;
+    }
+    return sink;
+}
+
+void
+httpio_sink_free(httpio_sink *sink)
+{
+    if (sink == NULL)
+        return;
+    if (sink->kind == HttpSinkFile) {
+        httpio_sink_finish(sink);
+        close(sink->fd);
+    }
+    free(sink);
+}
+
+size_t
+httpio_sink_length(const httpio_sink *const sink)
+{
+    if (sink == NULL)
+        return 0;
+    return sink->length;
+}
+
+bool
+httpio_sink_overflowed(const httpio_sink *const sink)
+{
+    if ((sink == NULL) || (sink->kind != HttpSinkBuffer))
+        return false;
+    return (sink->length > sink->size);
+}
+
+int
+httpio_sink_prepare(httpio_sink *sink, int64_t length)
+{
+    void *data;
+    if (sink == NULL)
+        return -1;
+    if ((sink->kind != HttpSinkFile) || (length <= 0) || ((uint64_t) length > SIZE_MAX))
+        return 0;
+    if (ftruncate(sink->fd, length) == -1)
+        return -1;
+    // It's written like a descriptor if it can't be mapped
+    data = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, sink->fd, 0);
+    if (data == MAP_FAILED)
+        return ftruncate(sink->fd, 0);
+    sink->data = data;
+    sink->size = length;
+    sink->mapped = true;
+    return 0;
+}
+
+int
+httpio_sink_write(httpio_sink *sink, const uint8_t *const data, size_t size)
+{
+    size_t room;
+    if ((sink == NULL) || ((data == NULL) && (size > 0)))
+        return -1;
+    if ((sink->kind == HttpSinkBuffer) || (sink->mapped == true)) {
+        room = (sink->length < sink->size) ? sink->size - sink->length : 0;
+        if ((sink->mapped == true) && (size > room))
+            return -1;
+        if (room > 0)
+            memcpy(sink->data + sink->length, data, (size < room) ? size : room);
+    } else if (httpio_write_descriptor(sink->fd, data, size) == -1) {
+        return -1;
+    }
+    sink->length += size;
+    return 0;
+}
+
+ssize_t
+httpio_sink_receive(httpio_sink *sink, struct httpio *link, size_t size)
+{
+    ssize_t received;
+    if ((sink == NULL) || (link == NULL) || (size == 0))
+        return -1;
+    if ((sink->kind == HttpSinkBuffer) || (sink->mapped == true))
+        return httpio_sink_receive_memory(sink, link, size);
+    received = httpio_splice(link, sink->fd, size, DEFAULT_TIMEOUT);
+    if (received > 0)
+        sink->length += received;
+    return received;
+}
+
+// The file ends up as long as the body, even if it was cut short
+int
+httpio_sink_finish(httpio_sink *sink)
+{
+    if (sink == NULL)
+        return -1;
+    if (sink->mapped == false)
+        return 0;
+    munmap(sink->data, sink->size);
+    sink->mapped = false;
+    sink->data = NULL;
+    if (sink->length < sink->size)
+        return ftruncate(sink->fd, sink->length);
+    return 0;
+}
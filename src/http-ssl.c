@@ -6,29 +6,365 @@
 
 #include <pthread.h>
 
+#include <arpa/inet.h>
+
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <errno.h>
+
+#define SESSION_DEFAULT_LIFETIME 7200000000000LL
 
 struct httpio_ssl {
     SSL *ssl;
+    struct httpio_tls_context *context;
+    // "host:port", the key for the session cache
+    char *peer;
+    // What the server chose out of the context's ALPN list
+    char alpn[32];
 };
 
+struct httpio_session {
+    char *peer;
+    SSL_SESSION *session;
+    int64_t expires;
+    struct httpio_session *next;
+};
+
+struct httpio_tls_context {
+    SSL_CTX *ctx;
+    int references;
+    // Sessions to resume, one per peer
+    pthread_mutex_t mutex;
+    struct httpio_session *sessions;
+    int64_t lifetime;
+};
+
+static int httpio_session_new(SSL *ssl, SSL_SESSION *session);
+static void httpio_sessions_free(struct httpio_session *session);
+
+// The context links use unless they are given another one
+static struct httpio_tls_context *DEFAULT_CONTEXT;
+static pthread_mutex_t DEFAULT_CONTEXT_MUTEX = PTHREAD_MUTEX_INITIALIZER;
+
+struct httpio_tls_context *
+httpio_tls_context_create(void)
+{
+    struct httpio_tls_context *context;
+    context = malloc(sizeof(*context));
+    if (context == NULL)
+        return NULL;
+    context->ctx = SSL_CTX_new(TLS_client_method());
+    if (context->ctx == NULL) {
+        ERR_print_errors_fp(stderr);
+        free(context);
+        return NULL;
+    }
+    // No verification by default, like before contexts were shared
+    SSL_CTX_set_verify(context->ctx, SSL_VERIFY_NONE, NULL);
+    // Sessions, and TLS 1.3 tickets which arrive after the
+    // handshake, are handed to `httpio_session_new()'
+    SSL_CTX_set_session_cache_mode(context->ctx,
+                           SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(context->ctx, httpio_session_new);
+    pthread_mutex_init(&context->mutex, NULL);
+
+    context->sessions = NULL;
+    context->lifetime = SESSION_DEFAULT_LIFETIME;
+    context->references = 1;
+    return context;
+}
+
+static void
+httpio_sessions_free(struct httpio_session *session)
+{
+    while (session != NULL) {
+        struct httpio_session *next;
+        next = session->next;
+        SSL_SESSION_free(session->session);
+        free(session->peer);
+        free(session);
+        session = next;
+    }
+}
+
+static int
+httpio_session_new(SSL *ssl, SSL_SESSION *session)
+{
+    struct httpio_tls_context *context;
+    struct httpio_session *entry;
+    struct httpio_session *stale;
+    struct httpio_ssl *owner;
+    int64_t lifetime;
+
+    owner = SSL_get_app_data(ssl);
+    if ((owner == NULL) || (owner->peer == NULL))
+        return 0;
+    context = owner->context;
+    if (context->lifetime <= 0)
+        return 0;
+    entry = malloc(sizeof(*entry));
+    if (entry == NULL)
+        return 0;
+    entry->peer = strdup(owner->peer);
+    if (entry->peer == NULL) {
+        free(entry);
+        return 0;
+    }
+    // Whichever ends first, our lifetime or the server's
+    lifetime = (int64_t) SSL_SESSION_get_timeout(session) * 1000000000LL;
+    if ((lifetime <= 0) || (lifetime > context->lifetime))
+        lifetime = context->lifetime;
+    entry->session = session;
+    entry->expires = httpio_monotonic_time() + lifetime;
+
+    stale = NULL;
+    pthread_mutex_lock(&context->mutex);
+    // Only the newest session for each peer is kept
+    for (struct httpio_session **next = &context->sessions; *next != NULL; next = &(*next)->next) {
+        if (strcmp((*next)->peer, entry->peer) != 0)
+            continue;
+        stale = *next;
+        *next = stale->next;
+        stale->next = NULL;
+        break;
+    }
+    entry->next = context->sessions;
+    context->sessions = entry;
+    pthread_mutex_unlock(&context->mutex);
+
+    httpio_sessions_free(stale);
+    // We keep the reference OpenSSL gave us
+    return 1;
+}
+
+static SSL_SESSION *
+httpio_session_find(struct httpio_tls_context *context, const char *const peer)
+{
+    struct httpio_session *entry;
+    SSL_SESSION *session;
+    int64_t now;
+
+    session = NULL;
+    entry = NULL;
+    now = httpio_monotonic_time();
+
+    pthread_mutex_lock(&context->mutex);
+    for (struct httpio_session **next = &context->sessions; *next != NULL; next = &(*next)->next) {
+        if (strcmp((*next)->peer, peer) != 0)
+            continue;
+        entry = *next;
+        // TLS 1.3 tickets are meant to be used once, expired
+        // sessions are useless, both leave the cache now
+        if ((entry->expires <= now) ||
+                   (SSL_SESSION_is_resumable(entry->session) == 0) ||
+                   (SSL_SESSION_get_protocol_version(entry->session) >= TLS1_3_VERSION)) {
+            *next = entry->next;
+            entry->next = NULL;
+        } else {
+            SSL_SESSION_up_ref(entry->session);
+            session = entry->session;
+            entry = NULL;
+        }
+        break;
+    }
+    pthread_mutex_unlock(&context->mutex);
+    if ((entry != NULL) && (entry->expires > now) &&
+                               (SSL_SESSION_is_resumable(entry->session) != 0)) {
+        SSL_SESSION_up_ref(entry->session);
+        session = entry->session;
+    }
+    httpio_sessions_free(entry);
+    return session;
+}
+
+int
+httpio_tls_context_set_session_lifetime(struct httpio_tls_context *context, int64_t nanoseconds)
+{
+    if (context == NULL)
+        return -1;
+    // Zero or less disables resumption
+    context->lifetime = nanoseconds;
+    return 0;
+}
+
+void
+httpio_tls_context_flush_sessions(struct httpio_tls_context *context)
+{
+    struct httpio_session *sessions;
+    if (context == NULL)
+        return;
+    pthread_mutex_lock(&context->mutex);
+    sessions = context->sessions;
+    context->sessions = NULL;
+    pthread_mutex_unlock(&context->mutex);
+
+    httpio_sessions_free(sessions);
+}
+
+struct httpio_tls_context *
+httpio_tls_context_ref(struct httpio_tls_context *context)
+{
+    if (context != NULL)
+        __atomic_add_fetch(&context->references, 1, __ATOMIC_RELAXED);
+    return context;
+}
+
+void
+httpio_tls_context_unref(struct httpio_tls_context *context)
+{
+    if (context == NULL)
+        return;
+    if (__atomic_sub_fetch(&context->references, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+    httpio_sessions_free(context->sessions);
+    pthread_mutex_destroy(&context->mutex);
+    SSL_CTX_free(context->ctx);
+    free(context);
+}
+
+int
+httpio_tls_context_set_protocols(struct httpio_tls_context *context, int minimum, int maximum)
+{
+    if (context == NULL)
+        return -1;
+    // Zero means whatever OpenSSL supports
+    if (SSL_CTX_set_min_proto_version(context->ctx, minimum) != 1)
+        return -1;
+    if (SSL_CTX_set_max_proto_version(context->ctx, maximum) != 1)
+        return -1;
+    return 0;
+}
+
+int
+httpio_tls_context_set_ciphers(struct httpio_tls_context *context,
+                                      const char *const list, const char *const suites)
+{
+    if (context == NULL)
+        return -1;
+    // `list' is for TLS 1.2 and below, `suites' for TLS 1.3
+    if ((list != NULL) && (SSL_CTX_set_cipher_list(context->ctx, list) != 1))
+        return -1;
+    if ((suites != NULL) && (SSL_CTX_set_ciphersuites(context->ctx, suites) != 1))
+        return -1;
+    return 0;
+}
+
+int
+httpio_tls_context_set_alpn(struct httpio_tls_context *context, const char *const protocols)
+{
+    uint8_t wire[256];
+    const char *name;
+    size_t length;
+
+    if ((context == NULL) || (protocols == NULL))
+        return -1;
+    // "h2,http/1.1" becomes "\x02h2\x08http/1.1"
+    length = 0;
+    for (name = protocols; *name != '\0';) {
+        size_t size;
+        size = strcspn(name, ",");
+        if ((size == 0) || (size > 255) || (length + size + 1 > sizeof(wire)))
+            return -1;
+        wire[length++] = size;
+        memcpy(wire + length, name, size);
+        length += size;
+        name += size;
+        if (*name == ',')
+            ++name;
+    }
+    // Unlike most of OpenSSL, zero is success here
+    if (SSL_CTX_set_alpn_protos(context->ctx, wire, length) != 0)
+        return -1;
+    return 0;
+}
+
+int
+httpio_tls_context_set_verify(struct httpio_tls_context *context,
+                            bool verify, const char *const file, const char *const path)
+{
+    if (context == NULL)
+        return -1;
+    if (verify == false) {
+        SSL_CTX_set_verify(context->ctx, SSL_VERIFY_NONE, NULL);
+        return 0;
+    }
+    // The CA store is loaded once here, not on every connection
+    if ((file != NULL) || (path != NULL)) {
+        if (SSL_CTX_load_verify_locations(context->ctx, file, path) != 1)
+            return -1;
+    } else if (SSL_CTX_set_default_verify_paths(context->ctx) != 1) {
+        return -1;
+    }
+    SSL_CTX_set_verify(context->ctx, SSL_VERIFY_PEER, NULL);
+    return 0;
+}
+
+struct httpio_tls_context *
+httpio_tls_context_default(void)
+{
+    struct httpio_tls_context *context;
+    pthread_mutex_lock(&DEFAULT_CONTEXT_MUTEX);
+    if (DEFAULT_CONTEXT == NULL)
+        DEFAULT_CONTEXT = httpio_tls_context_create();
+    context = httpio_tls_context_ref(DEFAULT_CONTEXT);
+    pthread_mutex_unlock(&DEFAULT_CONTEXT_MUTEX);
+    return context;
+}
+
+void
+httpio_tls_context_set_default(struct httpio_tls_context *context)
+{
+    struct httpio_tls_context *previous;
+    pthread_mutex_lock(&DEFAULT_CONTEXT_MUTEX);
+    previous = DEFAULT_CONTEXT;
+    DEFAULT_CONTEXT = httpio_tls_context_ref(context);
+    pthread_mutex_unlock(&DEFAULT_CONTEXT_MUTEX);
+    // Existing links keep their own reference
+    httpio_tls_context_unref(previous);
+}
+
+static bool
+httpio_is_ip_address(const char *const host)
+{
+    uint8_t address[16];
+    if (inet_pton(AF_INET, host, address) == 1)
+        return true;
+    return (inet_pton(AF_INET6, host, address) == 1);
+}
+
 static SSL *
-httpio_create_openssl_object(int socket)
+httpio_create_openssl_object(struct httpio_ssl *owner, int socket, const char *const host)
 {
-    SSL_CTX *context;
+    SSL_SESSION *session;
     SSL *ssl;
 
-    ssl = NULL;
-    context = SSL_CTX_new(SSLv23_client_method());
-    if (context == NULL)
-        goto failed;
-    ssl = SSL_new(context);
+    ssl = SSL_new(owner->context->ctx);
     if (ssl == NULL)
         goto failed;
+    // For `httpio_session_new()' to find the peer
+    SSL_set_app_data(ssl, owner);
+    // Writes queued on non blocking links are retried from a
+    // buffer that might have moved
+    SSL_set_mode(ssl, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
     if (SSL_set_fd(ssl, socket) == 0)
         goto failed;
+    if ((host != NULL) && (httpio_is_ip_address(host) == false)) {
+        // Server Name Indication, and the name to verify if enabled
+        SSL_set_tlsext_host_name(ssl, host);
+        SSL_set1_host(ssl, host);
+    }
+    if (owner->peer != NULL) {
+        // Try an abbreviated handshake with the last session
+        session = httpio_session_find(owner->context, owner->peer);
+        if (session != NULL) {
+            SSL_set_session(ssl, session);
+            SSL_SESSION_free(session);
+        }
+    }
     SSL_set_connect_state(ssl);
     if (SSL_do_handshake(ssl) <= 0)
         goto failed;
@@ -47,24 +383,20 @@ failed:
 static void
 httpio_openssl_free(SSL *ssl)
 {
-    SSL_CTX *ctx;
     if (ssl != NULL) {
-        ctx = SSL_get_SSL_CTX(ssl);
         SSL_shutdown(ssl);
         SSL_free(ssl);
-
-        // ERR_remove_thread_state(0);
-        if (ctx == NULL)
-            return;
-        SSL_CTX_free(ctx);
     }
 }
 
 void
 httpio_openssl_finalize()
 {
+    httpio_tls_context_set_default(NULL);
     SSL_COMP_free_compression_methods();
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
     FIPS_mode_set(0);
+#endif
 
     ERR_free_strings();
     EVP_cleanup();
@@ -149,15 +481,145 @@ httpio_recvopenssl(SSL *ssl, uint8_t *buffer, size_t size, int64_t nanoseconds)
     return received;
 }
 
+static ssize_t
+httpio_recvopenssl_some(SSL *ssl, uint8_t *buffer, size_t size, int64_t nanoseconds)
+{
+    ssize_t result;
+    // Return as soon as one record is available, instead
+    // of waiting for the whole `size' bytes
+    while (httpio_openssl_has_data(ssl, nanoseconds) == true) {
+        result = SSL_read(ssl, buffer, size);
+        if (result > 0)
+            return result;
+        switch (SSL_get_error(ssl, result)) {
+        case SSL_ERROR_WANT_WRITE:
+        case SSL_ERROR_WANT_READ:
+            break;
+        case SSL_ERROR_ZERO_RETURN:
+            // The peer closed it, like `recv()' returning 0
+            return 0;
+#ifdef SSL_R_UNEXPECTED_EOF_WHILE_READING
+        case SSL_ERROR_SSL:
+            // Many servers don't send close_notify, bodies with a
+            // length still tell a truncated one
+            if (ERR_GET_REASON(ERR_peek_error()) == SSL_R_UNEXPECTED_EOF_WHILE_READING) {
+                ERR_clear_error();
+                return 0;
+            }
+            return -1;
+#endif
+        default:
+            return -1;
+        }
+    }
+    return -1;
+}
+
+static ssize_t
+httpio_sendopenssl_nowait(SSL *ssl, const uint8_t *const buffer, size_t size)
+{
+    ssize_t result;
+    result = SSL_write(ssl, buffer, size);
+    if (result > 0)
+        return result;
+    switch (SSL_get_error(ssl, result)) {
+    case SSL_ERROR_WANT_WRITE:
+    case SSL_ERROR_WANT_READ:
+        // Like `send()' on a full non blocking socket, the retry
+        // has to start with the same bytes
+        errno = EAGAIN;
+        return -1;
+    default:
+        return -1;
+    }
+}
+
+static ssize_t
+httpio_recvopenssl_nowait(SSL *ssl, uint8_t *buffer, size_t size)
+{
+    ssize_t result;
+    result = SSL_read(ssl, buffer, size);
+    if (result > 0)
+        return result;
+    switch (SSL_get_error(ssl, result)) {
+    case SSL_ERROR_WANT_WRITE:
+    case SSL_ERROR_WANT_READ:
+        // Nothing decrypted yet, like `recv()' on a non blocking socket
+        errno = EAGAIN;
+        return -1;
+    case SSL_ERROR_ZERO_RETURN:
+        return 0;
+    default:
+        return -1;
+    }
+}
+
 struct httpio_ssl *
-httpio_ssl_create_with_socket(int sock)
+httpio_ssl_create(struct httpio_tls_context *context,
+                                    int sock, const char *const host, int port)
 {
+    const unsigned char *selected;
     struct httpio_ssl *ssl;
+    unsigned int length;
     ssl = malloc(sizeof(*ssl));
     if (ssl == NULL)
         return NULL;
-    ssl->ssl = httpio_create_openssl_object(sock);
+    ssl->peer = NULL;
+    ssl->ssl = NULL;
+    ssl->alpn[0] = '\0';
+    if (context == NULL)
+        ssl->context = httpio_tls_context_default();
+    else
+        ssl->context = httpio_tls_context_ref(context);
+    if (ssl->context == NULL)
+        goto failed;
+    if (host != NULL) {
+        char port_string[8];
+        snprintf(port_string, sizeof(port_string), "%d", port);
+        ssl->peer = httpio_concatenate(host, ":", port_string, NULL);
+    }
+    ssl->ssl = httpio_create_openssl_object(ssl, sock, host);
+    if (ssl->ssl == NULL)
+        goto failed;
+    SSL_get0_alpn_selected(ssl->ssl, &selected, &length);
+    if ((selected != NULL) && (length < sizeof(ssl->alpn))) {
+        memcpy(ssl->alpn, selected, length);
+        ssl->alpn[length] = '\0';
+    }
     return ssl;
+failed:
+    httpio_tls_context_unref(ssl->context);
+    free(ssl->peer);
+    free(ssl);
+    return NULL;
+}
+
+struct httpio_ssl *
+httpio_ssl_create_with_socket(int sock)
+{
+    return httpio_ssl_create(NULL, sock, NULL, 0);
+}
+
+bool
+httpio_ssl_session_reused(struct httpio_ssl *ssl)
+{
+    if (ssl == NULL)
+        return false;
+    return (SSL_session_reused(ssl->ssl) == 1);
+}
+
+const char *
+httpio_ssl_alpn_protocol(struct httpio_ssl *ssl)
+{
+    if ((ssl == NULL) || (ssl->alpn[0] == '\0'))
+        return NULL;
+    return ssl->alpn;
+}
+
+bool
+httpio_ssl_has_pending(struct httpio_ssl *ssl)
+{
+    return (SSL_pending(ssl->ssl) > 0);
 }
 
 bool
@@ -179,6 +641,25 @@ httpio_recvssl(struct httpio_ssl *ssl,
     return httpio_recvopenssl(ssl->ssl, buffer, size, nanoseconds);
 }
 
+ssize_t
+httpio_sendssl_nowait(struct httpio_ssl *ssl, const uint8_t *const buffer, size_t size)
+{
+    return httpio_sendopenssl_nowait(ssl->ssl, buffer, size);
+}
+
+ssize_t
+httpio_recvssl_nowait(struct httpio_ssl *ssl, uint8_t *const buffer, size_t size)
+{
+    return httpio_recvopenssl_nowait(ssl->ssl, buffer, size);
+}
+
+ssize_t
+httpio_recvssl_some(struct httpio_ssl *ssl,
+                        uint8_t *const buffer, size_t size, int64_t nanoseconds)
+{
+    return httpio_recvopenssl_some(ssl->ssl, buffer, size, nanoseconds);
+}
+
 void
 httpio_ssl_finalize()
 {
@@ -197,5 +678,7 @@ httpio_ssl_free(struct httpio_ssl *ssl)
     if (ssl == NULL)
         return;
     httpio_openssl_free(ssl->ssl);
+    httpio_tls_context_unref(ssl->context);
+    free(ssl->peer);
     free(ssl);
 }
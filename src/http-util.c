@@ -1,3 +1,5 @@
+// For `ppoll()'
+#define _GNU_SOURCE
 #include <http-util.h>
 
 #include <stdarg.h>
@@ -10,6 +12,8 @@
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
+#include <poll.h>
 
 #include <signal.h>
 #include <errno.h>
@@ -20,8 +24,8 @@ httpio_get_timeout(struct time *source, int64_t value)
 {
     if (value < 0)
         return NULL;
-    source->tv_sec = ((time_t) ((double) value / 1.0E9));
-    source->tv_nsec = ((time_t) ((double) value - 1.0E9 * source->tv_sec));
+    source->tv_sec = (time_t) (value / 1000000000LL);
+    source->tv_nsec = (long) (value % 1000000000LL);
     return source;
 }
 
@@ -30,19 +34,18 @@ static inline void base64_encode_chunk(const uint8_t *const chunk, uint8_t desti
 static inline void base64_decode_chunk(const uint8_t *const data, uint8_t result[3]);
 
 static int
-httpio_select(int nfds, fd_set *readfds, fd_set *writefds,
-                              fd_set *exceptfds, const struct timespec *timeout)
+httpio_poll(struct pollfd *fds, nfds_t count, const struct timespec *timeout)
 {
     sigset_t sigset;
     int result;
 
     sigemptyset(&sigset);
 
-    result = pselect(nfds, readfds, writefds, exceptfds, timeout, &sigset);
+    result = ppoll(fds, count, timeout, &sigset);
     switch (result) {
     case -1:
         if (errno == EINTR)
-            fprintf(stderr, "pselect was, interrupted by a signal\n");
+            fprintf(stderr, "ppoll was, interrupted by a signal\n");
         break;
     case 0:
         break;
@@ -243,33 +246,88 @@ httpio_string_list_free(char **list)
     free(list);
 }
 
+static double BYTE_STREAM_GROWTH = BYTE_STREAM_DEFAULT_GROWTH;
+
+int
+httpio_byte_stream_set_growth(double factor)
+{
+    // Anything below this would grow by less than a byte eventually
+    if ((isfinite(factor) == 0) || (factor < 1.125))
+        return -1;
+    BYTE_STREAM_GROWTH = factor;
+    return 0;
+}
+
 void
 httpio_byte_stream_start(struct httpio_bstream *buffer)
 {
     buffer->data = malloc(BYTE_STREAM_DEFAULT_SIZE);
-    buffer->capacity = BYTE_STREAM_DEFAULT_SIZE;
+    buffer->capacity = (buffer->data != NULL) ? BYTE_STREAM_DEFAULT_SIZE : 0;
     buffer->length = 0;
 }
 
-void
-httpio_byte_stream_append(struct httpio_bstream *buffer, const uint8_t *const data, size_t size)
+int
+httpio_byte_stream_reserve(struct httpio_bstream *buffer, size_t capacity)
 {
-    size_t length;
+    uint8_t *resized;
+    if (capacity <= buffer->capacity)
+        return 0;
+    resized = realloc(buffer->data, capacity);
+    if (resized == NULL)
+        return -1;
+    buffer->data = resized;
+    buffer->capacity = capacity;
+    return 0;
+}
 
-    length = buffer->length;
-    if (length + size >= buffer->capacity) {
-        uint8_t *resized;
-        size_t capacity;
-        capacity = BYTE_STREAM_DEFAULT_SIZE + length + size;
-        resized = realloc(buffer->data, capacity);
-        if (resized == NULL)
-            return;
-        buffer->data = resized;
-        buffer->capacity = capacity;
-    }
-    memcpy(&buffer->data[length], data, size);
+int
+httpio_byte_stream_grow(struct httpio_bstream *buffer, size_t size)
+{
+    size_t required;
+    size_t capacity;
+    double scaled;
+
+    if (size > SIZE_MAX - buffer->length)
+        return -1;
+    required = buffer->length + size;
+    if (required <= buffer->capacity)
+        return 0;
+    // Geometric growth keeps appending amortized O(1)
+    scaled = buffer->capacity * BYTE_STREAM_GROWTH;
+    capacity = (scaled < (double) SIZE_MAX) ? (size_t) scaled : SIZE_MAX;
+    if (capacity < BYTE_STREAM_DEFAULT_SIZE)
+        capacity = BYTE_STREAM_DEFAULT_SIZE;
+    if (capacity < required)
+        capacity = required;
+    if (httpio_byte_stream_reserve(buffer, capacity) == 0)
+        return 0;
+    // Perhaps there is room for what's needed only
+    return httpio_byte_stream_reserve(buffer, required);
+}
+
+int
+httpio_byte_stream_shrink_to_fit(struct httpio_bstream *buffer)
+{
+    uint8_t *resized;
+    if ((buffer->length == buffer->capacity) || (buffer->length == 0))
+        return 0;
+    resized = realloc(buffer->data, buffer->length);
+    if (resized == NULL)
+        return -1;
+    buffer->data = resized;
+    buffer->capacity = buffer->length;
+    return 0;
+}
+
+int
+httpio_byte_stream_append(struct httpio_bstream *buffer, const uint8_t *const data, size_t size)
+{
+    if (httpio_byte_stream_grow(buffer, size) == -1)
+        return -1;
+    memcpy(&buffer->data[buffer->length], data, size);
 
     buffer->length += size;
+    return 0;
 }
 
 bool
@@ -298,20 +356,13 @@ httpio_byte_stream_free(struct httpio_bstream *buffer)
 int32_t
 httpio_safe_random(void)
 {
-    struct timeval timeout;
     int devrandom;
     int value;
-    fd_set set;
-
-    memset(&timeout, 0, sizeof(timeout));
 
     devrandom = open("/dev/random", O_RDONLY);
     if (devrandom == -1)
         return rand();
-    FD_ZERO(&set);
-    FD_SET(devrandom, &set);
-
-    if (select(devrandom + 1, &set, NULL, NULL, &timeout) == 1)
+    if (httpio_socket_has_data(devrandom, 0) == true)
     {
         if (read(devrandom, &value, sizeof(value)) == (ssize_t) sizeof(value))
         {
@@ -417,30 +468,69 @@ httpio_strreplace(char **output, const char *const needle, const char *const rep
     return length + (add - remove) * count;
 }
 
-bool
-httpio_socket_has_data(int sock, int64_t nanoseconds)
+int64_t
+httpio_monotonic_time(void)
+{
+    struct time now;
+    if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+        return 0;
+    return (int64_t) now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static bool
+httpio_socket_wait(int sock, short events, int64_t nanoseconds)
 {
     struct time _timeout;
     struct time *timeout;
-    fd_set set;
-    FD_ZERO(&set);
-    FD_SET(sock, &set);
+    struct pollfd pollfd;
+
+    pollfd.fd = sock;
+    pollfd.events = events;
+    pollfd.revents = 0;
+
     timeout = httpio_get_timeout(&_timeout, nanoseconds);
-    if (httpio_select(sock + 1, &set, NULL, NULL, timeout) != 1)
+    if (httpio_poll(&pollfd, 1, timeout) != 1)
         return false;
-    return FD_ISSET(sock, &set);
+    // Errors and hangups are reported as readiness too, the
+    // following read or write call will tell what happened
+    return (pollfd.revents & (events | POLLERR | POLLHUP)) != 0;
+}
+
+int
+httpio_write_descriptor(int fd, const uint8_t *data, size_t size)
+{
+    while (size > 0) {
+        ssize_t result;
+        result = write(fd, data, size);
+        if ((result == -1) && (errno == EINTR))
+            continue;
+        if (result <= 0)
+            return -1;
+        data += result;
+        size -= result;
+    }
+    return 0;
+}
+
+bool
+httpio_socket_has_data(int sock, int64_t nanoseconds)
+{
+    return httpio_socket_wait(sock, POLLIN, nanoseconds);
 }
 
 bool
 httpio_socket_wants_data(int sock, int64_t nanoseconds)
+{
+    return httpio_socket_wait(sock, POLLOUT, nanoseconds);
+}
+
+int
+httpio_sockets_wait(struct pollfd *fds, size_t count, int64_t nanoseconds)
 {
     struct time _timeout;
     struct time *timeout;
-    fd_set set;
-    FD_ZERO(&set);
-    FD_SET(sock, &set);
+    for (size_t index = 0; index < count; ++index)
+        fds[index].revents = 0;
     timeout = httpio_get_timeout(&_timeout, nanoseconds);
-    if (httpio_select(sock + 1, NULL, &set, NULL, timeout) != 1)
-        return false;
-    return FD_ISSET(sock, &set);
+    return httpio_poll(fds, count, timeout);
 }
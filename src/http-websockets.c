@@ -27,6 +27,7 @@ bool
 httpio_websocket_send_string(struct httpio *link, const char *const message)
 {
     ssize_t length;
+    struct iovec vector[3];
     uint8_t header[2];
     int32_t mask;
     uint8_t *masked;
@@ -47,14 +48,19 @@ httpio_websocket_send_string(struct httpio *link, const char *const message)
         header[1] = 127;
     }
     header[1] |= 0x80;
-    if (httpio_write(link, header, sizeof(header)) != sizeof(header))
-        return false;
-    if (httpio_write(link, (uint8_t *) &mask, sizeof(mask)) != sizeof(mask))
-        return false;
     masked = malloc(length);
+    if (masked == NULL)
+        return false;
     for (size_t index = 0; message[index] != '\0'; ++index)
         masked[index] = message[index] ^ ((uint8_t *) &mask)[index % 4];
-    result = httpio_write(link, masked, length);
+    // Header, mask and payload in a single write
+    vector[0].iov_base = header;
+    vector[0].iov_len = sizeof(header);
+    vector[1].iov_base = &mask;
+    vector[1].iov_len = sizeof(mask);
+    vector[2].iov_base = masked;
+    vector[2].iov_len = length;
+    result = httpio_writev(link, vector, countof(vector));
 
     free(masked);
     if (result < 0)
@@ -99,7 +105,7 @@ httpio_websocket_get_frame(struct httpio *link)
     zero = 0;
     do {
         int64_t length;
-        uint8_t buffer[4];
+        uint8_t buffer[8];
         int8_t masked;
         if (httpio_read(link, buffer, 2, DEFAULT_TIMEOUT) <= 0)
             goto error;
@@ -114,12 +120,12 @@ httpio_websocket_get_frame(struct httpio *link)
             length = (buffer[0] << 8) | buffer[1];
             break;
         case 127:
-            if (httpio_read(link, buffer, 4, DEFAULT_TIMEOUT) <= 0)
+            // The extended payload length is 64 bits, network order
+            if (httpio_read(link, buffer, 8, DEFAULT_TIMEOUT) != 8)
                 goto error;
-            length = buffer[3];
-            length |= (buffer[1] << 16);
-            length |= (buffer[2] << 8);
-            length |= (buffer[0] << 24);
+            length = 0;
+            for (size_t index = 0; index < 8; ++index)
+                length = (length << 8) | buffer[index];
             break;
         }
 
@@ -128,6 +134,15 @@ httpio_websocket_get_frame(struct httpio *link)
             ssize_t received;
             size_t expect;
 
+            // The payload length is known, plus the terminator, but it's
+            // the peer's word, past a buffer appending grows the stream
+            if (length < 0)
+                goto error;
+            expect = sizeof(buffer);
+            if (length < (int64_t) sizeof(buffer))
+                expect = length + 1;
+            if (httpio_byte_stream_grow(&stream, expect) == -1)
+                goto error;
             received = 0;
             while (received < length) {
                 ssize_t result;
@@ -139,7 +154,8 @@ httpio_websocket_get_frame(struct httpio *link)
                                                        expect, DEFAULT_TIMEOUT);
                 if (result <= 0)
                     goto error;
-                httpio_byte_stream_append(&stream, buffer, result);
+                if (httpio_byte_stream_append(&stream, buffer, result) == -1)
+                    goto error;
 
                 received += result;
             }
@@ -149,7 +165,8 @@ httpio_websocket_get_frame(struct httpio *link)
     } while (final == 0);
     if (stream.length == 0)
         goto error;
-    httpio_byte_stream_append(&stream, (uint8_t *) &zero, 1);
+    if (httpio_byte_stream_append(&stream, (uint8_t *) &zero, 1) == -1)
+        goto error;
 
     frame->type = type;
     frame->length = stream.length - 1;
@@ -162,6 +179,50 @@ error:
     return NULL;
 }
 
+bool
+httpio_websocket_frame_buffered(struct httpio *link)
+{
+    const uint8_t *data;
+    size_t length;
+    size_t offset;
+
+    length = httpio_buffered(link);
+    if ((length == 0) || (httpio_peek(link, &data, length, 0) == -1))
+        return false;
+    // Walk the fragments up to the final one without consuming them
+    offset = 0;
+    for (;;) {
+        uint64_t size;
+        size_t header;
+        bool final;
+
+        if (length - offset < 2)
+            return false;
+        final = ((data[offset] & 0x80) == 0x80);
+        size = (data[offset + 1] & 0x7F);
+        header = 2;
+        if (size == 126)
+            header = 4;
+        else if (size == 127)
+            header = 10;
+        if (length - offset < header)
+            return false;
+        if (size >= 126) {
+            size = 0;
+            for (size_t index = offset + 2; index < offset + header; ++index)
+                size = (size << 8) | data[index];
+        }
+        // Masked frames are rejected by the parser, let it see them
+        if ((data[offset + 1] & 0x80) == 0x80)
+            return true;
+        if (length - offset - header < size)
+            return false;
+        offset += header + size;
+        if (final == true)
+            return true;
+    }
+}
+
 void
 httpio_websocket_frame_free(struct httpio_websocket_frame *frame)
 {